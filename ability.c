@@ -16,8 +16,8 @@ float MP_UseAbility(MP_Ability* ability) {
     }
 
     // Skip if we're on cooldown.
-    if (ability->cooldown > 0) {
-        return ability->cooldown / (float) MP_FRAMERATE;
+    if (*ability->cooldown > 0) {
+        return *ability->cooldown / (float) MP_FRAMERATE;
     }
 
     // Try to get the callback.
@@ -28,7 +28,7 @@ float MP_UseAbility(MP_Ability* ability) {
             float cooldown = luaL_checknumber(L, -1);
             if (cooldown > 0) {
                 // OK, multiply with frame rate to get tick count.
-                ability->cooldown = (unsigned int) (MP_FRAMERATE * cooldown);
+                *ability->cooldown = (unsigned int) (MP_FRAMERATE * cooldown);
             }
             lua_pop(L, 1); // pop result
 
@@ -23,8 +23,9 @@ extern "C" {
         /** Reference to the Lua table containing property values */
         int properties;
 
-        /** The remaining cooldown time before the ability can trigger again */
-        unsigned int cooldown;
+        /** The remaining cooldown time before the ability can trigger again,
+         * stored with those of the other units of the player */
+        unsigned int* cooldown;
     };
 
     /** Activates the specified ability, if it is not on cooldown. */
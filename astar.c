@@ -1,4 +1,6 @@
 #include <assert.h>
+#include <float.h>
+#include <limits.h>
 #include <malloc.h>
 #include <math.h>
 #include <memory.h>
@@ -28,101 +30,607 @@ typedef struct {
 
     /** The node that came before this one in the path it is part of */
     unsigned int came_from;
+
+    /** Position of the node in the open heap, or NODE_CLOSED */
+    unsigned int heapIndex;
 } PathNode;
 
+/** Per cell lookup entry, valid only if stamped with the current search */
+typedef struct {
+    /** The search generation this entry was written in */
+    unsigned int generation;
+
+    /** Index of the node for this cell in the node list */
+    unsigned int node;
+} CellInfo;
+
+/** Number of recent changes remembered per grid, to repair fields */
+#define GRID_CHANGE_LOG 32
+
+/** A change of a block in a grid */
+typedef struct {
+    /** Coordinates of the block, in map space */
+    unsigned int x, y;
+
+    /** Whether the block became passable or blocked */
+    int passable;
+
+    /** The version of the grid before and after the change */
+    unsigned int previous, version;
+} GridChange;
+
+/** Blocks reached by one flood when checking whether a component split */
+typedef struct {
+    /** The blocks, in the order they were reached */
+    unsigned int* blocks;
+
+    /** Next block to expand, number of blocks and capacity of the list */
+    unsigned int head;
+    unsigned int count;
+    unsigned int capacity;
+} Flood;
+
+/** Packed passability bits at A* granularity, stored row by row */
+struct AStarGrid {
+    /** Number of cells per row and column */
+    unsigned int size;
+
+    /** Number of words per row (rows are padded to whole words) */
+    unsigned int stride;
+
+    /** The actual bits, set for passable cells */
+    unsigned int* bits;
+
+    /** The same bits stored column by column, for scanning vertically */
+    unsigned int* columns;
+
+    /** Jump distances per cell and direction (JPS+), null if disabled */
+    short* jumps;
+
+    /** Cells whose diagonal jumps have to be repaired after a change */
+    unsigned int* dirty;
+    unsigned int dirtyCount;
+    unsigned int dirtyCapacity;
+
+    /** Changes whenever cells change, unique over all grids */
+    unsigned int version;
+
+    /** The most recent changes, used as a ring buffer */
+    GridChange changes[GRID_CHANGE_LOG];
+    unsigned int changeCount;
+
+    /** Connected component label per block, zero for blocked blocks */
+    unsigned int* labels;
+
+    /** Union-find parent and rank per label, label zero is unused */
+    unsigned int* parents;
+    unsigned char* ranks;
+    unsigned int labelCount;
+    unsigned int labelCapacity;
+
+    /** Per block stamps of the floods used when checking for splits */
+    unsigned int* marks;
+    unsigned int mark;
+
+    /** One flood per neighbor of a block that became blocked */
+    Flood floods[4];
+};
+
+/** Entrances of a cluster in a hierarchy and the distances between them */
+typedef struct {
+    /** Cells of the entrances, as y * size + x */
+    unsigned int* entrances;
+
+    /** Two per entrance: the linked entrance cells in neighboring clusters */
+    unsigned int* links;
+
+    /** Distances between entrances inside the cluster, negative if none */
+    float* distances;
+
+    /** Number of entrances, and capacity of the entrance and link lists */
+    unsigned int count;
+    unsigned int capacity;
+} Cluster;
+
+/** Abstract graph over a passability grid, for long distance searches */
+struct AStarHierarchy {
+    /** The grid this hierarchy was built for */
+    const AStarGrid* grid;
+
+    /** Number of clusters per row and column */
+    unsigned int size;
+
+    /** The clusters, stored row by row */
+    Cluster* clusters;
+
+    /** Per cluster flag whether it has to be rebuilt */
+    char* dirty;
+
+    /** Number of clusters currently marked dirty */
+    unsigned int dirtyCount;
+};
+
+/** Waypoint of an abstract path, used when refining it */
+typedef struct {
+    /** Cell coordinates of the waypoint */
+    unsigned int x, y;
+
+    /** Abstract path cost from the start up to this waypoint */
+    float gscore;
+} Waypoint;
+
+/** Target of a multi-target search, sorted by cell for lookups */
+typedef struct {
+    /** Cell coordinates of the target */
+    unsigned int x, y;
+
+    /** Cell of the target, as y * size + x */
+    unsigned int cell;
+
+    /** Index of the target in the list passed to the search */
+    unsigned int index;
+} Target;
+
+/** Target of a distance field */
+typedef struct {
+    /** The position of the target, in map space */
+    vec2 position;
+
+    /** User data identifying the target */
+    void* data;
+
+    /** Whether the target was removed, but is still in the distances */
+    char removed;
+
+    /** Whether the target was added to the distances already */
+    char seeded;
+} FieldTarget;
+
+/** Distances to the nearest of a set of targets, for each cell of a grid */
+struct AStarField {
+    /** The grid and its version the distances were computed for */
+    const AStarGrid* grid;
+    unsigned int version;
+
+    /** Number of cells per row and column the distances were computed for */
+    unsigned int size;
+
+    /** Distance to the nearest target per cell, FLT_MAX if unreachable */
+    float* distances;
+
+    /** Index of the nearest target per cell, NO_LINK if unreachable */
+    unsigned int* sources;
+
+    /** The targets */
+    FieldTarget* targets;
+    unsigned int targetCount;
+    unsigned int targetCapacity;
+
+    /** New indices of the targets when removing some, same capacity */
+    unsigned int* remap;
+
+    /** Whether targets were added or removed since the last update */
+    char changed;
+
+    /** Cells that lost their target when removing some */
+    unsigned int* invalid;
+    unsigned int invalidCount;
+    unsigned int invalidCapacity;
+};
+
+/** Distances from a few landmark cells, for a better heuristic */
+struct AStarLandmarks {
+    /** One field per landmark, with the landmark as its only target */
+    AStarField* fields;
+    unsigned int count;
+
+    /** Whether all landmarks were placed at least once */
+    int placed;
+};
+
+/** Search state, owned by a single thread at a time */
+struct AStarContext {
+    /** Number of cells in the grid used for our A* algorithm */
+    int gridSize;
+    int gridCapacity;
+
+    /** Per cell node handles for quick lookup of open and closed nodes */
+    CellInfo* cells;
+
+    /** Current search generation, used to invalidate the cell table lazily */
+    unsigned int generation;
+
+    /** All nodes touched in the current search (open and closed) */
+    PathNode* nodes;
+
+    /** Open set, as a d-ary min-heap of node indices ordered by fscore */
+    unsigned int* openSet;
+
+    /** Capacity of A* node sets */
+    unsigned int nodeCapacity;
+    unsigned int openSetCapacity;
+
+    /** Number of entries used in the node list and the open set */
+    unsigned int nodeCount;
+    unsigned int openSetCount;
+
+    /** The passability grid used in the current search, if any */
+    const AStarGrid* grid;
+
+    /** The passability check used in the current search if there's no grid */
+    AStarPassableCallback passable;
+
+    /** User data passed along to the passability check */
+    const void* userdata;
+
+    /** Distances from the start and goal to their clusters' entrances */
+    float* entranceCosts;
+    unsigned int entranceCostCapacity;
+
+    /** Abstract path found in a hierarchical search, in walk order */
+    Waypoint* waypoints;
+    unsigned int waypointCapacity;
+
+    /** Hierarchy of the current search if it's a hierarchical one, how far
+     * it got, and the number of waypoints of its abstract path once that was
+     * found */
+    const AStarHierarchy* hierarchy;
+    unsigned int stage;
+    unsigned int waypointCount;
+
+    /** Grid path refined from the abstract one so far, the waypoint the next
+     * part of it starts at, and its length, see refinePath. Also whether the
+     * local search of that part was suspended */
+    vec2* refined;
+    unsigned int refinedCapacity;
+    unsigned int refinedCount;
+    unsigned int refineIndex;
+    float refinedLength;
+    int refineSuspended;
+
+    /** Context for the searches inside clusters of hierarchical searches,
+     * created on demand */
+    struct AStarContext* local;
+
+    /** Targets of a multi-target search, sorted by cell */
+    Target* targets;
+    unsigned int targetCapacity;
+
+    /** Cells containing at least one target, cleared after each search */
+    BitSet targetCells;
+    unsigned int targetCellCapacity;
+
+    /** Node expansions left before searches are suspended, if limited */
+    unsigned int budget;
+    int limited;
+
+    /** Whether the last search was suspended, and its start and goal */
+    int suspended;
+    vec2 start;
+    vec2 goal;
+
+    /** Node the path found by the last search ends in plus one, zero if it
+     * found none, and the number of nodes in that path */
+    unsigned int tail;
+    unsigned int tailDepth;
+
+    /** Whether searches run from both ends, and whether the current one does */
+    int bidirectional;
+    int meeting;
+
+    /** Context of the backwards search from the goal, created on demand */
+    struct AStarContext* reverse;
+
+    /** Cost of the shortest path over a cell reached from both ends so far,
+     * and the nodes of that cell in this context and the reverse one */
+    float meetCost;
+    unsigned int meetNode;
+    unsigned int meetReverseNode;
+
+    /** Landmarks used to improve the heuristic of grid searches, if any */
+    const AStarLandmarks* landmarks;
+
+    /** Distances of the landmarks usable in the current search, and the
+     * distance from each of them to the current goal */
+    const float** landmarkDistances;
+    float* landmarkGoals;
+    unsigned int landmarkCount;
+    unsigned int landmarkCapacity;
+
+    /** How searches trade path quality for speed, and its weight or epsilon */
+    AStarPolicy policy;
+    float factor;
+
+    /** Number of nodes expanded in this context so far */
+    unsigned long expanded;
+};
+
+/** Adapter data for the legacy passability callback of AStar() */
+typedef struct {
+    int(*passable)(float x, float y);
+} LegacyPassable;
+
 ///////////////////////////////////////////////////////////////////////////////
 // Globals
 ///////////////////////////////////////////////////////////////////////////////
 
-/** Root of two */
-static const float SQRT2 = 1.41421356237309504880f;
+/** Number of bits per word in passability grids */
+#define GRID_WORD_BITS (CHAR_BIT * sizeof (unsigned int))
+
+/** Number of directions stored per cell in jump tables */
+#define JUMP_DIRECTIONS 8
 
-/** Number of cells in the grid used for our A* algorithm */
-static int gGridSize = 0;
-static int gGridCapacity = 0;
+/** Number of cells per row and column of a cluster in a hierarchy */
+#define CLUSTER_CELLS (ASTAR_CLUSTER_SIZE * ASTAR_GRANULARITY)
 
-/** Bitset for quick lookup of closed set in A* */
-static char* gClosedSetLookup = 0;
+/** Border runs at least this long get an entrance at each end */
+#define CLUSTER_LONG_ENTRANCE 6
+
+/** Marks unused entrance links */
+static const unsigned int NO_LINK = (unsigned int) -1;
+
+/** Root of two */
+static const float SQRT2 = 1.41421356237309504880f;
 
-/** Re-used waypoint sets for A* search */
-static PathNode* gOpenSet = 0;
-static PathNode* gClosedSet = 0;
+/** Marks nodes that have been moved to the closed set */
+static const unsigned int NODE_CLOSED = (unsigned int) -1;
 
-/** Capacity of A* node sets */
-static unsigned int gOpenSetCapacity = 0;
-static unsigned int gClosedSetCapacity = 0;
+/** Stages of a hierarchical search: connecting the start and the goal to the
+ * entrances of their clusters, searching the abstract graph, and refining the
+ * path found there */
+static const unsigned int STAGE_START = 0;
+static const unsigned int STAGE_GOAL = 1;
+static const unsigned int STAGE_ABSTRACT = 2;
+static const unsigned int STAGE_REFINE = 3;
 
-/** Number of entries used in the open and closed set */
-static unsigned int gOpenSetCount = 0;
-static unsigned int gClosedSetCount = 0;
+/** Last version assigned to a grid, so that versions are unique */
+static unsigned int gGridVersion = 0;
 
-/** The unit we're currently checking for */
-static int(*gIsPassable)(float x, float y);
+/** Context used by the non-reentrant AStar() entry point */
+static AStarContext* gDefaultContext = NULL;
 
 ///////////////////////////////////////////////////////////////////////////////
 // Allocation
 ///////////////////////////////////////////////////////////////////////////////
 
-/** Get a new node for the open queue, at the specified sort key */
-static PathNode* newOpenNode(float key) {
-    unsigned int low = 0, high = gOpenSetCount;
+/** Makes sure we can allocate the specified number of additional nodes */
+static void ensureNodeCapacity(AStarContext* context, unsigned int count) {
+    if (context->nodeCount + count > context->nodeCapacity) {
+        context->nodeCapacity = context->nodeCapacity * 2 + count + 8;
+        if (!(context->nodes = realloc(context->nodes, context->nodeCapacity * sizeof (PathNode)))) {
+            fprintf(stderr, "Out of memory while resizing A* node list.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
 
-    // Ensure we have the capacity to add the node.
-    if (gOpenSetCount + 1 >= gOpenSetCapacity) {
-        gOpenSetCapacity = gOpenSetCapacity * 2 + 8;
-        if (!(gOpenSet = realloc(gOpenSet, gOpenSetCapacity * sizeof (PathNode)))) {
-            fprintf(stderr, "Out of memory while resizing A* open queue.\n");
+/** Makes sure the waypoint list can hold the specified number of entries */
+static void ensureWaypointCapacity(AStarContext* context, unsigned int count) {
+    if (count > context->waypointCapacity) {
+        context->waypointCapacity = count;
+        if (!(context->waypoints = realloc(context->waypoints, context->waypointCapacity * sizeof (Waypoint)))) {
+            fprintf(stderr, "Out of memory while resizing A* waypoint list.\n");
             exit(EXIT_FAILURE);
         }
     }
+}
 
-    // Find where to insert; we want to keep this list sorted, so that the entry
-    // with the lowest score is first.
-    while (high > low) {
-        unsigned mid = (low + high) / 2;
-        if (gOpenSet[mid].fscore < key) {
-            low = mid + 1;
-        } else {
-            high = mid;
+/** Makes sure the refined path can hold the specified number of nodes */
+static void ensureRefinedCapacity(AStarContext* context, unsigned int count) {
+    if (count > context->refinedCapacity) {
+        context->refinedCapacity = context->refinedCapacity * 2 > count ? context->refinedCapacity * 2 : count;
+        if (!(context->refined = realloc(context->refined, context->refinedCapacity * sizeof (vec2)))) {
+            fprintf(stderr, "Out of memory while resizing A* refined path.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/** Get the node for the specified cell, if it was touched in this search */
+inline static PathNode* getNode(AStarContext* context, unsigned int x, unsigned int y) {
+    const CellInfo* cell = &context->cells[y * context->gridSize + x];
+    if (cell->generation == context->generation) {
+        return &context->nodes[cell->node];
+    }
+    return NULL;
+}
+
+/** Allocates a new node for the specified cell; capacity must be ensured */
+static PathNode* newNode(AStarContext* context, unsigned int x, unsigned int y) {
+    CellInfo* cell = &context->cells[y * context->gridSize + x];
+    PathNode* node = &context->nodes[context->nodeCount];
+
+    assert(context->nodeCount < context->nodeCapacity);
+
+    cell->generation = context->generation;
+    cell->node = context->nodeCount++;
+
+    node->x = x;
+    node->y = y;
+    // Not in the open set until explicitly pushed.
+    node->heapIndex = NODE_CLOSED;
+
+    return node;
+}
+
+/** Resets the node sets for a new search over the current grid size */
+static void beginSearch(AStarContext* context) {
+    // Ensure size of lookup table is sufficient.
+    if (context->gridSize > context->gridCapacity) {
+        context->gridCapacity = context->gridSize;
+        free(context->cells);
+        if (!(context->cells = calloc(context->gridCapacity * context->gridCapacity, sizeof (CellInfo)))) {
+            fprintf(stderr, "Out of memory while resizing A* cell table.\n");
+            exit(EXIT_FAILURE);
         }
+        context->generation = 0;
     }
 
-    // Move everything above one up, if necessary.
-    if (low < gOpenSetCount) {
-        memmove(&gOpenSet[low + 1], &gOpenSet[low],
-                (gOpenSetCount - low) * sizeof (PathNode));
+    // Reset number of entries used in the open set and the node list. This
+    // also drops any suspended search and the last found path.
+    context->openSetCount = 0;
+    context->nodeCount = 0;
+    context->suspended = 0;
+    context->hierarchy = NULL;
+    context->waypointCount = 0;
+    context->tail = 0;
+
+    // Begin a new search generation, which invalidates all cell entries of
+    // previous searches. Only clear the table when the counter wraps.
+    if (++context->generation == 0) {
+        memset(context->cells, 0, context->gridCapacity * context->gridCapacity * sizeof (CellInfo));
+        context->generation = 1;
+    }
+}
+
+/** Tests whether the specified cell is in the closed set */
+inline static int isClosed(AStarContext* context, unsigned int x, unsigned int y) {
+    const PathNode* node = getNode(context, x, y);
+    return node && node->heapIndex == NODE_CLOSED;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Open set (indexed d-ary heap)
+///////////////////////////////////////////////////////////////////////////////
+
+/** Moves the entry at the specified heap position up until ordered */
+static void siftUp(AStarContext* context, unsigned int position) {
+    const unsigned int index = context->openSet[position];
+    const float key = context->nodes[index].fscore;
+
+    while (position > 0) {
+        const unsigned int parent = (position - 1) / ASTAR_HEAP_ARITY;
+        if (context->nodes[context->openSet[parent]].fscore <= key) {
+            break;
+        }
+        context->openSet[position] = context->openSet[parent];
+        context->nodes[context->openSet[position]].heapIndex = position;
+        position = parent;
     }
 
-    // Remember there's one more now.
-    ++gOpenSetCount;
+    context->openSet[position] = index;
+    context->nodes[index].heapIndex = position;
+}
+
+/** Moves the entry at the specified heap position down until ordered */
+static void siftDown(AStarContext* context, unsigned int position) {
+    const unsigned int index = context->openSet[position];
+    const float key = context->nodes[index].fscore;
+
+    while (1) {
+        const unsigned int first = position * ASTAR_HEAP_ARITY + 1;
+        unsigned int last = first + ASTAR_HEAP_ARITY;
+        unsigned int best = position;
+        float bestKey = key;
+
+        if (first >= context->openSetCount) {
+            break;
+        }
+        if (last > context->openSetCount) {
+            last = context->openSetCount;
+        }
+
+        // Find the child with the lowest score.
+        for (unsigned int child = first; child < last; ++child) {
+            const float childKey = context->nodes[context->openSet[child]].fscore;
+            if (childKey < bestKey) {
+                best = child;
+                bestKey = childKey;
+            }
+        }
+        if (best == position) {
+            break;
+        }
+
+        context->openSet[position] = context->openSet[best];
+        context->nodes[context->openSet[position]].heapIndex = position;
+        position = best;
+    }
 
-    // Return it.
-    return &gOpenSet[low];
+    context->openSet[position] = index;
+    context->nodes[index].heapIndex = position;
 }
 
-/** Move the first entry in the open queue to the closed set and return it */
-static PathNode* popOpenNodeToClosedSet(void) {
+/** Adds a node to the open set; its fscore must already be set */
+static void pushOpenNode(AStarContext* context, PathNode* node) {
     // Ensure we have the capacity to add the node.
-    if (gClosedSetCount + 1 >= gClosedSetCapacity) {
-        gClosedSetCapacity = gClosedSetCapacity * 2 + 8;
-        if (!(gClosedSet = realloc(gClosedSet, gClosedSetCapacity * sizeof (PathNode)))) {
-            fprintf(stderr, "Out of memory while resizing A* closed set.\n");
+    if (context->openSetCount + 1 >= context->openSetCapacity) {
+        context->openSetCapacity = context->openSetCapacity * 2 + 8;
+        if (!(context->openSet = realloc(context->openSet, context->openSetCapacity * sizeof (unsigned int)))) {
+            fprintf(stderr, "Out of memory while resizing A* open queue.\n");
             exit(EXIT_FAILURE);
         }
     }
 
-    // Copy it over.
-    gClosedSet[gClosedSetCount] = gOpenSet[0];
+    context->openSet[context->openSetCount] = node - context->nodes;
+    siftUp(context, context->openSetCount++);
+}
+
+/** Remove the best entry from the open queue, mark it closed and return it */
+static PathNode* popOpenNodeToClosedSet(AStarContext* context) {
+    PathNode* node = &context->nodes[context->openSet[0]];
+
+    // Mark as closed.
+    node->heapIndex = NODE_CLOSED;
+
+    // Move the last entry to the top and restore heap order.
+    if (--context->openSetCount > 0) {
+        context->openSet[0] = context->openSet[context->openSetCount];
+        siftDown(context, 0);
+    }
+
+    return node;
+}
+
+/**
+ * Removes the open node closest to the goal among the ones with an fscore of
+ * at most 1 + epsilon times the best one, marks it closed and returns it.
+ * Only the first ASTAR_FOCAL_WIDTH entries of the heap are checked, which
+ * hold the best nodes, but not necessarily in order. Any node within the
+ * bound keeps the guarantee on the path length, though.
+ */
+static PathNode* popFocalNodeToClosedSet(AStarContext* context) {
+    const float bound = context->nodes[context->openSet[0]].fscore * (1.0f + context->factor);
+    const unsigned int width = context->openSetCount < ASTAR_FOCAL_WIDTH
+            ? context->openSetCount : ASTAR_FOCAL_WIDTH;
+    unsigned int best = 0, position;
+    float bestDistance = FLT_MAX;
+    PathNode* node;
+
+    // Find the node closest to the goal, which is the heuristic part of its
+    // score. Ties go to the first one, which is closer to the top.
+    for (position = 0; position < width; ++position) {
+        const PathNode* candidate = &context->nodes[context->openSet[position]];
+        const float distance = candidate->fscore - candidate->gscore;
+        if (candidate->fscore <= bound && distance < bestDistance) {
+            best = position;
+            bestDistance = distance;
+        }
+    }
+    node = &context->nodes[context->openSet[best]];
+
+    // Mark as closed.
+    node->heapIndex = NODE_CLOSED;
 
-    // Mark as closed in our bitset.
-    BS_Set(gClosedSetLookup, gOpenSet[0].y * gGridSize + gOpenSet[0].x);
+    // Move the last entry to the free spot and restore heap order. It may
+    // have to move up or down, if it moved up the entry now in its spot was
+    // its ancestor, so moving that one down does nothing.
+    if (--context->openSetCount > best) {
+        context->openSet[best] = context->openSet[context->openSetCount];
+        siftUp(context, best);
+        siftDown(context, best);
+    }
 
-    // Shift open list to the left to remove first entry.
-    --gOpenSetCount;
-    memmove(&gOpenSet[0], &gOpenSet[1], gOpenSetCount * sizeof (PathNode));
+    return node;
+}
 
-    // Return the copied node.
-    return &gClosedSet[gClosedSetCount++];
+/** Removes the next node to expand according to the search policy */
+inline static PathNode* popNextNodeToClosedSet(AStarContext* context) {
+    ++context->expanded;
+    if (context->policy == ASTAR_POLICY_FOCAL) {
+        return popFocalNodeToClosedSet(context);
+    }
+    return popOpenNodeToClosedSet(context);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -130,12 +638,12 @@ static PathNode* popOpenNodeToClosedSet(void) {
 ///////////////////////////////////////////////////////////////////////////////
 
 /** Clamps an arbitrary coordinate to a valid one (in bounds) */
-inline static unsigned int clamp(int coordinate) {
+inline static unsigned int clamp(AStarContext* context, int coordinate) {
     if (coordinate < 0) {
         return 0;
     }
-    if (coordinate >= gGridSize) {
-        return gGridSize - 1;
+    if (coordinate >= context->gridSize) {
+        return context->gridSize - 1;
     }
     return coordinate;
 }
@@ -151,11 +659,56 @@ inline static float h(unsigned int fromX, unsigned int fromY,
 /** Computes the heuristic */
 inline static float f(unsigned int x, unsigned int y,
                       unsigned int goalX, unsigned int goalY) {
-    const unsigned int dx = abs(x - goalX);
-    const unsigned int dy = abs(y - goalY);
+    const unsigned int dx = abs((int) x - (int) goalX);
+    const unsigned int dy = abs((int) y - (int) goalY);
     return SQRT2 * (dx > dy ? dx : dy);
 }
 
+/** Computes the length of a path if there were no obstacles */
+inline static float octile(unsigned int x, unsigned int y,
+                           unsigned int goalX, unsigned int goalY) {
+    const unsigned int dx = abs((int) x - (int) goalX);
+    const unsigned int dy = abs((int) y - (int) goalY);
+    return dx > dy
+            ? dx + (SQRT2 - 1.0f) * dy
+            : dy + (SQRT2 - 1.0f) * dx;
+}
+
+/**
+ * Computes the heuristic for the search policy, improved by the landmarks
+ * usable in the current search. The distance to the goal is at least the
+ * difference of the distances of the cell and the goal to any landmark.
+ */
+inline static float estimate(const AStarContext* context, unsigned int x, unsigned int y,
+                             unsigned int goalX, unsigned int goalY) {
+    float result = context->policy == ASTAR_POLICY_DEFAULT
+            ? f(x, y, goalX, goalY)
+            : octile(x, y, goalX, goalY);
+    for (unsigned int i = 0; i < context->landmarkCount; ++i) {
+        const float distance = context->landmarkDistances[i][y * context->gridSize + x];
+        if (distance < FLT_MAX && fabsf(distance - context->landmarkGoals[i]) > result) {
+            result = fabsf(distance - context->landmarkGoals[i]);
+        }
+    }
+    return result;
+}
+
+/** Computes the fscore of a node for the search policy */
+inline static float score(const AStarContext* context, float gscore,
+                          unsigned int x, unsigned int y,
+                          unsigned int goalX, unsigned int goalY) {
+    switch (context->policy) {
+        case ASTAR_POLICY_OPTIMAL:
+        case ASTAR_POLICY_FOCAL:
+            return gscore + estimate(context, x, y, goalX, goalY);
+        case ASTAR_POLICY_WEIGHTED:
+            return gscore + context->factor * estimate(context, x, y, goalX, goalY);
+        default:
+            // The factor in the end is used for tie breaking.
+            return (gscore + estimate(context, x, y, goalX, goalY)) * 1.001f;
+    }
+}
+
 /** Converts local coordinates to global ones */
 inline static float toGlobal(unsigned int coordinate) {
     return (coordinate + 0.5f) / (float) ASTAR_GRANULARITY;
@@ -166,35 +719,47 @@ inline static float toLocal(float coordinate) {
     return (unsigned int) floorf(coordinate * ASTAR_GRANULARITY);
 }
 
+/** Reads the bit for a cell of a passability grid, using local coordinates */
+inline static int testGrid(const AStarGrid* grid, unsigned int x, unsigned int y) {
+    // Cells out of bounds are never passable (negative ones wrap around).
+    if (x >= grid->size || y >= grid->size) {
+        return 0;
+    }
+    return (grid->bits[y * grid->stride + x / GRID_WORD_BITS] >> (x % GRID_WORD_BITS)) & 1u;
+}
+
 /** Checks if a block is passable, using local coordinates */
-inline static int isPassable(unsigned int x, unsigned int y) {
-    return gIsPassable(toGlobal(x), toGlobal(y));
-}
-
-/** Tests if a neighbor should be skipped due to it already having a better score */
-static int shouldSkip(unsigned int x, unsigned int y, float gscore) {
-    // Try to find the neighbor.
-    for (unsigned int i = 0; i < gOpenSetCount; ++i) {
-        if (gOpenSet[i].x == x && gOpenSet[i].y == y) {
-            // Neighbor is already in open list.
-            if (gOpenSet[i].gscore <= gscore) {
-                // Skip it, it has a better score.
-                return 1;
-            }
-            // Otherwise we remove it from the list so that it may be
-            // re-inserted.
-            --gOpenSetCount;
-            memmove(&gOpenSet[i], &gOpenSet[i + 1], (gOpenSetCount - i) * sizeof (PathNode));
-            return 0;
-        }
+inline static int isPassable(AStarContext* context, unsigned int x, unsigned int y) {
+    if (context->grid) {
+        return testGrid(context->grid, x, y);
     }
-    return 0;
+    return context->passable(context->userdata, toGlobal(x), toGlobal(y));
 }
 
 #if ASTAR_JPS
 
+/** Tests if a cell can be moved onto in a jump, using local coordinates */
+inline static int canJumpTo(AStarContext* context, int x, int y, int dx, int dy) {
+    // Don't go out of bounds.
+    if (x < 0 || x >= context->gridSize ||
+        y < 0 || y >= context->gridSize) {
+        return 0;
+    }
+
+    // If we already handled this one, skip it.
+    if (isClosed(context, x, y)) {
+        return 0;
+    }
+
+    // Only continue if this block is passable and the two diagonal ones are.
+    // Otherwise we hit an obstacle and thus failed.
+    return isPassable(context, x, y) &&
+            (isPassable(context, x, y - dy) || isPassable(context, x - dx, y));
+}
+
 /**
- * Performs a jump point search.
+ * Performs a jump point search. Steps one cell at a time, so this is used
+ * when there's no grid to scan (see jumpGridSearch).
  * 
  * @param jx the x coordinate we jumped to, if successful.
  * @param jx the y coordinate we jumped to, if successful.
@@ -206,91 +771,454 @@ static int shouldSkip(unsigned int x, unsigned int y, float gscore) {
  * @param gy goal y coordinate (so we don't jump past it).
  * @return whether the jump was successful or not.
  */
-static int jumpPointSearch(int* jx, int* jy, int dx, int dy,
+static int jumpPointSearch(AStarContext* context, int* jx, int* jy, int dx, int dy,
                            int sx, int sy, unsigned int gx, unsigned int gy) {
-    // Don't go out of bounds.
-    if (sx < 0 || sx >= gGridSize ||
-        sy < 0 || sy >= gGridSize) {
-        return 0;
-    }
+    for (; canJumpTo(context, sx, sy, dx, dy); sx += dx, sy += dy) {
+        // We have potential to succeed, so save our local coordinates.
+        if (jx) {
+            *jx = sx;
+        }
+        if (jy) {
+            *jy = sy;
+        }
 
-    // If we already handled this one, skip it.
-    if (BS_Test(gClosedSetLookup, sy * gGridSize + sx)) {
-        return 0;
-    }
+        // Have we reached the goal?
+        if ((unsigned int) sx == gx && (unsigned int) sy == gy) {
+            return 1;
+        }
 
-    // Only continue if this block is passable and the two diagonal ones are.
-    // Otherwise we hit an obstacle and thus failed.
-    if (!isPassable(sx, sy) ||
-        (!isPassable(sx, sy - dy) && !isPassable(sx - dx, sy))) {
-        return 0;
-    }
+        // Do we have to evaluate neighbors here and end our jump?
+        if (
+            // If we move along the x axis...
+            ((dx &&
+            // ... and there's an obstacle above, blocking a passable tile...
+            ((!isPassable(context, sx, sy - 1) && isPassable(context, sx + dx, sy - 1)) ||
+            // ... or below us, blocking a passable tile...
+            (!isPassable(context, sx, sy + 1) && isPassable(context, sx + dx, sy + 1)))) ||
+            // ... or we're moving along the y axis...
+            (dy &&
+            // ... and there's an obstacle to the left, blocking a passable tile...
+            ((!isPassable(context, sx - 1, sy) && isPassable(context, sx - 1, sy + dy)) ||
+            // ... or to the right of us, blocking a passable tile...
+            (!isPassable(context, sx + 1, sy) && isPassable(context, sx + 1, sy + dy)))))) {
+            // ... then we have to inspect this tile, so we end our jump.
+            return 1;
+        }
 
-    // We have potential to succeed, so save our local coordinates.
-    if (jx) {
-        *jx = sx;
-    }
-    if (jy) {
-        *jy = sy;
+        // Moving diagonally? Then try the straight ones, which don't branch
+        // any further, so this never nests more than once.
+        if (dx && dy &&
+            (jumpPointSearch(context, NULL, NULL, dx, 0, sx + dx, sy, gx, gy) ||
+             jumpPointSearch(context, NULL, NULL, 0, dy, sx, sy + dy, gx, gy))) {
+            return 1;
+        }
+
+        // Not invalidated yet, remember this position and move on ahead.
     }
 
-    // Have we reached the goal?
-    if ((unsigned int) sx == gx && (unsigned int) sy == gy) {
+    // Hit an obstacle (or closed cell) and thus failed.
+    return 0;
+}
+
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Jump tables (JPS+)
+///////////////////////////////////////////////////////////////////////////////
+
+/** Gets the index of a direction in the jump table entry of a cell */
+inline static unsigned int directionIndex(int dx, int dy) {
+    const unsigned int index = (dy + 1) * 3 + (dx + 1);
+    // Skip the center, which isn't a direction.
+    return index > 4 ? index - 1 : index;
+}
+
+/** Gets the jump table value of a cell, in the specified direction */
+inline static short getJump(const AStarGrid* grid, unsigned int x, unsigned int y, int dx, int dy) {
+    return grid->jumps[(y * grid->size + x) * JUMP_DIRECTIONS + directionIndex(dx, dy)];
+}
+
+/** Tests if we may move onto a cell in the specified direction */
+inline static int canStep(const AStarGrid* grid, unsigned int x, unsigned int y, int dx, int dy) {
+    // Only if this block is passable and the two diagonal ones are.
+    return testGrid(grid, x, y) &&
+            (testGrid(grid, x, y - dy) || testGrid(grid, x - dx, y));
+}
+
+/** Tests if a cell has forced neighbors, due to obstacles next to it */
+inline static int isForced(const AStarGrid* grid, unsigned int x, unsigned int y, int dx, int dy) {
+    return (dx &&
+            ((!testGrid(grid, x, y - 1) && testGrid(grid, x + dx, y - 1)) ||
+            (!testGrid(grid, x, y + 1) && testGrid(grid, x + dx, y + 1)))) ||
+            (dy &&
+            ((!testGrid(grid, x - 1, y) && testGrid(grid, x - 1, y + dy)) ||
+            (!testGrid(grid, x + 1, y) && testGrid(grid, x + 1, y + dy))));
+}
+
+/** Tests if a cell ends a jump in the specified direction, see jumpPointSearch */
+static int isJumpPoint(const AStarGrid* grid, unsigned int x, unsigned int y, int dx, int dy) {
+    if (isForced(grid, x, y, dx, dy)) {
         return 1;
     }
 
-    // Do we have to evaluate neighbors here and end our jump?
-    if (
-        // If we move along the x axis...
-        ((dx &&
-        // ... and there's an obstacle above, blocking a passable tile...
-        ((!isPassable(sx, sy - 1) && isPassable(sx + dx, sy - 1)) ||
-        // ... or below us, blocking a passable tile...
-        (!isPassable(sx, sy + 1) && isPassable(sx + dx, sy + 1)))) ||
-        // ... or we're moving along the y axis...
-        (dy &&
-        // ... and there's an obstacle to the left, blocking a passable tile...
-        ((!isPassable(sx - 1, sy) && isPassable(sx - 1, sy + dy)) ||
-        // ... or to the right of us, blocking a passable tile...
-        (!isPassable(sx + 1, sy) && isPassable(sx + 1, sy + dy)))))) {
-        // ... then we have to inspect this tile, so we end our jump.
+    // When moving diagonally, also if one of the straight jumps succeeds.
+    return dx && dy && (getJump(grid, x, y, dx, 0) > 0 || getJump(grid, x, y, 0, dy) > 0);
+}
+
+/**
+ * Computes the jump table value of a cell. The value of the next cell in the
+ * specified direction (and for diagonals also the straight values of that
+ * cell) must be up-to-date.
+ * @return the distance to the next jump point if positive, otherwise the
+ *         negated number of cells we can move before hitting an obstacle.
+ */
+static short computeJump(const AStarGrid* grid, unsigned int x, unsigned int y, int dx, int dy) {
+    const unsigned int nx = x + dx;
+    const unsigned int ny = y + dy;
+    short next;
+
+    if (!canStep(grid, nx, ny, dx, dy)) {
+        return 0;
+    }
+    if (isJumpPoint(grid, nx, ny, dx, dy)) {
         return 1;
     }
+    next = getJump(grid, nx, ny, dx, dy);
+    return next > 0 ? next + 1 : next - 1;
+}
 
-    // Moving diagonally?
-    if (dx && dy) {
-        // Yes, then try the straight ones first.
-        if (jumpPointSearch(NULL, NULL, dx, 0, sx + dx, sy, gx, gy)) {
-            return 1;
+/** Remembers a cell whose diagonal jumps have to be repaired */
+static void markJumpDirty(AStarGrid* grid, unsigned int cell) {
+    if (grid->dirtyCount >= grid->dirtyCapacity) {
+        grid->dirtyCapacity = grid->dirtyCapacity * 2 + 16;
+        if (!(grid->dirty = realloc(grid->dirty, grid->dirtyCapacity * sizeof (unsigned int)))) {
+            fprintf(stderr, "Out of memory while resizing A* jump repair list.\n");
+            exit(EXIT_FAILURE);
         }
-        if (jumpPointSearch(NULL, NULL, 0, dy, sx, sy + dy, gx, gy)) {
-            return 1;
+    }
+    grid->dirty[grid->dirtyCount++] = cell;
+}
+
+/**
+ * Recomputes the jump table values of a row (if moving along the x axis) or a
+ * column (if moving along the y axis), starting at the far end. Cells whose
+ * value changed are marked dirty if requested.
+ */
+static void updateJumpLine(AStarGrid* grid, unsigned int line, int dx, int dy, int track) {
+    const unsigned int direction = directionIndex(dx, dy);
+    for (unsigned int i = 0; i < grid->size; ++i) {
+        // Start at the end the direction is pointing to.
+        const unsigned int along = (dx > 0 || dy > 0) ? grid->size - 1 - i : i;
+        const unsigned int x = dx ? along : line;
+        const unsigned int y = dx ? line : along;
+        const unsigned int cell = y * grid->size + x;
+        const short value = computeJump(grid, x, y, dx, dy);
+        if (grid->jumps[cell * JUMP_DIRECTIONS + direction] != value) {
+            grid->jumps[cell * JUMP_DIRECTIONS + direction] = value;
+            if (track) {
+                markJumpDirty(grid, cell);
+            }
         }
     }
+}
+
+/** Builds the jump tables of a grid from scratch */
+static void buildJumps(AStarGrid* grid) {
+    // Straight ones first, diagonals depend on them.
+    for (unsigned int line = 0; line < grid->size; ++line) {
+        updateJumpLine(grid, line, 1, 0, 0);
+        updateJumpLine(grid, line, -1, 0, 0);
+        updateJumpLine(grid, line, 0, 1, 0);
+        updateJumpLine(grid, line, 0, -1, 0);
+    }
 
-    // Not invalidated yet, remember this position and move on ahead.
-    return jumpPointSearch(jx, jy, dx, dy, sx + dx, sy + dy, gx, gy);
+    // Then diagonals, starting at the corner the direction is pointing to.
+    for (int dy = -1; dy <= 1; dy += 2) {
+        for (int dx = -1; dx <= 1; dx += 2) {
+            const unsigned int direction = directionIndex(dx, dy);
+            for (unsigned int i = 0; i < grid->size; ++i) {
+                const unsigned int y = dy > 0 ? grid->size - 1 - i : i;
+                for (unsigned int j = 0; j < grid->size; ++j) {
+                    const unsigned int x = dx > 0 ? grid->size - 1 - j : j;
+                    grid->jumps[(y * grid->size + x) * JUMP_DIRECTIONS + direction] =
+                            computeJump(grid, x, y, dx, dy);
+                }
+            }
+        }
+    }
 }
 
-#endif
+/** Orders cells by index, which is also by row */
+static int compareCells(const void* a, const void* b) {
+    const unsigned int ca = *(const unsigned int*) a;
+    const unsigned int cb = *(const unsigned int*) b;
+    return (ca > cb) - (ca < cb);
+}
 
-/** Tests whether two nodes are visible to each other */
-static int isInLineOfSight(const PathNode* a, const PathNode* b) {
+/**
+ * Repairs the jump tables after the cells in the specified (inclusive) range
+ * changed. Straight values are rebuilt for the affected rows and columns, and
+ * diagonal ones are walked back from each cell that changed, until they
+ * stop changing.
+ */
+static void repairJumps(AStarGrid* grid, unsigned int x0, unsigned int y0,
+                        unsigned int x1, unsigned int y1) {
+    // Jump points depend on direct neighbors, so grow the range by one.
+    x0 = x0 > 0 ? x0 - 1 : 0;
+    y0 = y0 > 0 ? y0 - 1 : 0;
+    x1 = x1 + 1 < grid->size ? x1 + 1 : grid->size - 1;
+    y1 = y1 + 1 < grid->size ? y1 + 1 : grid->size - 1;
+
+    grid->dirtyCount = 0;
+
+    // Rebuild straight values of the affected rows and columns.
+    for (unsigned int y = y0; y <= y1; ++y) {
+        updateJumpLine(grid, y, 1, 0, 1);
+        updateJumpLine(grid, y, -1, 0, 1);
+    }
+    for (unsigned int x = x0; x <= x1; ++x) {
+        updateJumpLine(grid, x, 0, 1, 1);
+        updateJumpLine(grid, x, 0, -1, 1);
+    }
+
+    // Cells in the range may have changed if they're passable or forced.
+    for (unsigned int y = y0; y <= y1; ++y) {
+        for (unsigned int x = x0; x <= x1; ++x) {
+            markJumpDirty(grid, y * grid->size + x);
+        }
+    }
+
+    // Sort dirty cells by row, so we can handle them from the far end of each
+    // diagonal direction, like when building the tables.
+    qsort(grid->dirty, grid->dirtyCount, sizeof (unsigned int), compareCells);
+
+    for (int dy = -1; dy <= 1; dy += 2) {
+        for (int dx = -1; dx <= 1; dx += 2) {
+            const unsigned int direction = directionIndex(dx, dy);
+            for (unsigned int i = 0; i < grid->dirtyCount; ++i) {
+                const unsigned int cell = grid->dirty[dy > 0 ? grid->dirtyCount - 1 - i : i];
+                // Walk back from the dirty cell until values stop changing.
+                unsigned int x = cell % grid->size - dx;
+                unsigned int y = cell / grid->size - dy;
+                while (x < grid->size && y < grid->size) {
+                    short* jump = &grid->jumps[(y * grid->size + x) * JUMP_DIRECTIONS + direction];
+                    const short value = computeJump(grid, x, y, dx, dy);
+                    if (*jump == value) {
+                        break;
+                    }
+                    *jump = value;
+                    x -= dx;
+                    y -= dy;
+                }
+            }
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Block-based jumps (JPS+BB)
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Reads a word worth of cells of a line (row or column) of a bitmap, starting
+ * at the specified offset along the line. Bit i is set if cell offset + i is
+ * passable, cells out of bounds (including negative ones) read as blocked.
+ */
+static unsigned int readLine(const unsigned int* bits, const AStarGrid* grid,
+                             unsigned int line, int offset) {
+    // Split into word and bit offset, rounding towards negative infinity.
+    const int word = offset >= 0 ? offset / (int) GRID_WORD_BITS :
+            -(((int) GRID_WORD_BITS - 1 - offset) / (int) GRID_WORD_BITS);
+    const unsigned int shift = (unsigned int) (offset - word * (int) GRID_WORD_BITS);
+    const unsigned int* row;
+    unsigned int result = 0;
+
+    if (line >= grid->size) {
+        return 0;
+    }
+    row = &bits[line * grid->stride];
+    if (word >= 0 && (unsigned int) word < grid->stride) {
+        result = row[word] >> shift;
+    }
+    if (shift && word + 1 >= 0 && (unsigned int) (word + 1) < grid->stride) {
+        result |= row[word + 1] << (GRID_WORD_BITS - shift);
+    }
+    return result;
+}
+
+/** Gets the index of the lowest set bit of a non-zero word */
+inline static unsigned int lowestBit(unsigned int word) {
+#ifdef __GNUC__
+    return (unsigned int) __builtin_ctz(word);
+#else
+    unsigned int index = 0;
+    while (!(word & 1u)) {
+        word >>= 1;
+        ++index;
+    }
+    return index;
+#endif
+}
+
+/** Gets the index of the highest set bit of a non-zero word */
+inline static unsigned int highestBit(unsigned int word) {
+#ifdef __GNUC__
+    return GRID_WORD_BITS - 1 - (unsigned int) __builtin_clz(word);
+#else
+    unsigned int index = GRID_WORD_BITS - 1;
+    while (!(word >> index)) {
+        --index;
+    }
+    return index;
+#endif
+}
+
+/**
+ * Scans a line of a bitmap for the end of a straight jump, a word at a time.
+ * A jump ends at the first blocked cell, or at the first cell where a
+ * neighboring line opens up right after being blocked (a forced neighbor).
+ * @param bits the bitmap to scan, rows for horizontal and columns for
+ *        vertical jumps.
+ * @param line the line we're moving along.
+ * @param from the position along the line we're jumping from.
+ * @param step the direction we're moving in along the line (1 or -1).
+ * @return the same as a jump table entry, see computeJump.
+ */
+static int scanLine(const unsigned int* bits, const AStarGrid* grid,
+                    unsigned int line, int from, int step) {
+    if (step > 0) {
+        for (int offset = from + 1;; offset += GRID_WORD_BITS) {
+            const unsigned int passable = readLine(bits, grid, line, offset);
+            const unsigned int stop = ~passable |
+                    (~readLine(bits, grid, line - 1, offset) & readLine(bits, grid, line - 1, offset + 1)) |
+                    (~readLine(bits, grid, line + 1, offset) & readLine(bits, grid, line + 1, offset + 1));
+            if (stop) {
+                const unsigned int index = lowestBit(stop);
+                const int distance = offset + (int) index - from;
+                return (passable >> index) & 1u ? distance : 1 - distance;
+            }
+        }
+    } else {
+        // Going backwards, the last bit of a word is the cell we look at first.
+        for (int offset = from - (int) GRID_WORD_BITS;; offset -= GRID_WORD_BITS) {
+            const unsigned int passable = readLine(bits, grid, line, offset);
+            const unsigned int stop = ~passable |
+                    (~readLine(bits, grid, line - 1, offset) & readLine(bits, grid, line - 1, offset - 1)) |
+                    (~readLine(bits, grid, line + 1, offset) & readLine(bits, grid, line + 1, offset - 1));
+            if (stop) {
+                const unsigned int index = highestBit(stop);
+                const int distance = from - offset - (int) index;
+                return (passable >> index) & 1u ? distance : 1 - distance;
+            }
+        }
+    }
+}
+
+/**
+ * Computes the jump table value of a cell by scanning the grid, for grids
+ * without jump tables. Straight jumps scan whole words of cells at a time,
+ * diagonal ones step cell by cell, scanning straight at each step.
+ */
+static int scanJump(const AStarGrid* grid, unsigned int x, unsigned int y, int dx, int dy) {
+    int steps = 1;
+
+    if (!dy) {
+        return scanLine(grid->bits, grid, y, (int) x, dx);
+    }
+    if (!dx) {
+        return scanLine(grid->columns, grid, x, (int) y, dy);
+    }
+
+    for (x += dx, y += dy;; x += dx, y += dy, ++steps) {
+        if (!canStep(grid, x, y, dx, dy)) {
+            return 1 - steps;
+        }
+        if (isForced(grid, x, y, dx, dy) ||
+            scanLine(grid->bits, grid, y, (int) x, dx) > 0 ||
+            scanLine(grid->columns, grid, x, (int) y, dy) > 0) {
+            return steps;
+        }
+    }
+}
+
+/** Gets the jump table value of a cell, scanning for it if there are no tables */
+inline static int lookupJump(const AStarGrid* grid, unsigned int x, unsigned int y, int dx, int dy) {
+    return grid->jumps ? getJump(grid, x, y, dx, dy) : scanJump(grid, x, y, dx, dy);
+}
+
+/**
+ * Performs a jump on a passability grid, using its jump tables if it has any,
+ * scanning its bitmaps otherwise. Works like jumpPointSearch, except that it
+ * starts at the cell we're jumping from, and doesn't stop at closed cells.
+ */
+static int jumpGridSearch(const AStarGrid* grid, int* jx, int* jy, int dx, int dy,
+                          unsigned int sx, unsigned int sy, unsigned int gx, unsigned int gy) {
+    const int jump = lookupJump(grid, sx, sy, dx, dy);
+    // Number of cells we can move before the jump ends or we hit an obstacle.
+    const int reach = jump > 0 ? jump : -jump;
+    // Distance to the goal along both axii, in movement direction.
+    const int tx = dx ? ((int) gx - (int) sx) * dx : 0;
+    const int ty = dy ? ((int) gy - (int) sy) * dy : 0;
+
+    if (!dy) {
+        // Moving along the x axis, check if we pass the goal.
+        if (gy == sy && tx > 0 && tx <= reach) {
+            *jx = gx;
+            *jy = gy;
+            return 1;
+        }
+    } else if (!dx) {
+        // Moving along the y axis, check if we pass the goal.
+        if (gx == sx && ty > 0 && ty <= reach) {
+            *jx = gx;
+            *jy = gy;
+            return 1;
+        }
+    } else if (tx > 0 && ty > 0) {
+        // Moving diagonally towards the goal, check if we pass the row or
+        // column of the goal, and can reach it from there straight away.
+        const int t = tx < ty ? tx : ty;
+        if (t <= reach) {
+            const unsigned int cx = sx + t * dx;
+            const unsigned int cy = sy + t * dy;
+            const int rest = tx > ty ? tx - t : ty - t;
+            if (!rest ||
+                (tx > ty && abs(lookupJump(grid, cx, cy, dx, 0)) >= rest) ||
+                (tx < ty && abs(lookupJump(grid, cx, cy, 0, dy)) >= rest)) {
+                *jx = cx;
+                *jy = cy;
+                return 1;
+            }
+        }
+    }
+
+    // Otherwise we end up at the next jump point, if there is one.
+    if (jump > 0) {
+        *jx = sx + jump * dx;
+        *jy = sy + jump * dy;
+        return 1;
+    }
+    return 0;
+}
+
+/** Tests whether two cells are visible to each other */
+static int isInLineOfSight(AStarContext* context, unsigned int ax, unsigned int ay,
+                           unsigned int bx, unsigned int by) {
     // We essentially draw a line from a to b and check if all the pixels we'd
     // set would be on passable tiles. Algorithm from wikipedia:
     // https://en.wikipedia.org/wiki/Bresenham%27s_line_algorithm#Simplification
-    const int dx = abs(b->x - a->x);
-    const int dy = abs(b->y - a->y);
-    const int sx = (a->x < b->x) ? 1 : -1;
-    const int sy = (a->y < b->y) ? 1 : -1;
+    const int dx = abs((int) bx - (int) ax);
+    const int dy = abs((int) by - (int) ay);
+    const int sx = (ax < bx) ? 1 : -1;
+    const int sy = (ay < by) ? 1 : -1;
 
     int err = dx - dy;
-    unsigned int x = a->x, y = a->y;
+    unsigned int x = ax, y = ay;
     while (1) {
-        if (!isPassable(x, y)) {
+        if (!isPassable(context, x, y)) {
             return 0;
         }
-        if (x == b->x && y == b->y) {
+        if (x == bx && y == by) {
             return 1;
         }
         {
@@ -314,7 +1242,7 @@ static int isInLineOfSight(const PathNode* a, const PathNode* b) {
  * each other's line of sight; where line of sight is determined by passability
  * of in-between blocks.
  */
-static unsigned int prunePath(PathNode* tail) {
+static unsigned int prunePath(AStarContext* context, PathNode* tail) {
     // The capacity to what we actually need if we use the full path.
     unsigned int depth = tail->steps;
 
@@ -325,14 +1253,14 @@ static unsigned int prunePath(PathNode* tail) {
     // nodes that can "see" each other.
     n1 = tail;
     if (n1->came_from) {
-        n0 = &gClosedSet[n1->came_from - 1];
+        n0 = &context->nodes[n1->came_from - 1];
         while (n0->came_from) {
             n2 = n1;
             n1 = n0;
-            n0 = &gClosedSet[n0->came_from - 1]; // = n(-1)
+            n0 = &context->nodes[n0->came_from - 1]; // = n(-1)
 
             // See if we can skip the middle one.
-            if (isInLineOfSight(n0, n2)) {
+            if (isInLineOfSight(context, n0->x, n0->y, n2->x, n2->y)) {
                 // Yes, take out the middle-man.
                 n2->came_from = n1->came_from;
                 n1 = n2;
@@ -353,7 +1281,7 @@ static unsigned int prunePath(PathNode* tail) {
  * Computes the actual length (in map space) of a path ending in the specified
  * tail node, with the specified start and goal positions.
  */
-static float computeLength(const PathNode* tail, const vec2* start, const vec2* goal) {
+static float computeLength(AStarContext* context, const PathNode* tail, const vec2* start, const vec2* goal) {
     // Accumulate length of the path.
     float length = 0;
 
@@ -364,7 +1292,7 @@ static float computeLength(const PathNode* tail, const vec2* start, const vec2*
         float ly = goal->d.y;
 
         // Skip last node, as it'll be replaced with the goal coordinates.
-        const PathNode* n = &gClosedSet[tail->came_from - 1];
+        const PathNode* n = &context->nodes[tail->came_from - 1];
 
         // Run until we get to the start node (which we'll replace with the
         // start coordinates).
@@ -379,7 +1307,7 @@ static float computeLength(const PathNode* tail, const vec2* start, const vec2*
             // Store this position as the last one and move on to the next node.
             lx = nx;
             ly = ny;
-            n = &gClosedSet[n->came_from - 1];
+            n = &context->nodes[n->came_from - 1];
         }
         // For the last node, use the start coordinates.
         {
@@ -396,13 +1324,13 @@ static float computeLength(const PathNode* tail, const vec2* start, const vec2*
  * Converts the path ending in the specified tail node to a buffer of the
  * specified length.
  */
-static unsigned int writePath(vec2* path, unsigned int depth,
+static unsigned int writePath(AStarContext* context, vec2* path, unsigned int depth,
                               const PathNode* tail, unsigned int realDepth,
                               const vec2* start, const vec2* goal) {
     // Follow the path until only as many nodes as we can fit into the
     // specified buffer remain.
     while (realDepth >= depth) {
-        tail = &gClosedSet[tail->came_from - 1];
+        tail = &context->nodes[tail->came_from - 1];
         --realDepth;
     }
 
@@ -414,11 +1342,11 @@ static unsigned int writePath(vec2* path, unsigned int depth,
     path[realDepth - 1].d.x = goal->d.x;
     path[realDepth - 1].d.y = goal->d.y;
     // And skip it, too.
-    tail = &gClosedSet[tail->came_from - 1];
+    tail = &context->nodes[tail->came_from - 1];
 
     // Push the remaining nodes' coordinates (in reverse walk order to
     // make it forward work order).
-    for (int i = realDepth - 2; i > 0; --i, tail = &gClosedSet[tail->came_from - 1]) {
+    for (int i = realDepth - 2; i > 0; --i, tail = &context->nodes[tail->came_from - 1]) {
         vec2* waypoint = &path[i];
         waypoint->d.x = toGlobal(tail->x);
         waypoint->d.y = toGlobal(tail->y);
@@ -427,6 +1355,37 @@ static unsigned int writePath(vec2* path, unsigned int depth,
     return realDepth;
 }
 
+/**
+ * Writes out result data for the path found by the last search, which ends in
+ * the context's tail node and was pruned already.
+ * @param path the buffer to write the path to.
+ * @param depth the length of the buffer, set to the used length.
+ * @param length the actual length of the found path, in map space.
+ */
+static void writeResult(AStarContext* context, vec2* path, unsigned int* depth, float* length) {
+    const PathNode* tail = &context->nodes[context->tail - 1];
+
+    // Compute actual length of the path. We can't use the gscore because
+    // we might have pruned some of the path, which might alter the distance
+    // quite a bit.
+    if (length) {
+        *length = computeLength(context, tail, &context->start, &context->goal);
+    }
+
+    // Make sure we can write something back.
+    if (depth) {
+        if (*depth > 1) {
+            // Long enough for something path-y, write as much as we need or
+            // can, whichever is less.
+            *depth = writePath(context, path, *depth, tail, context->tailDepth,
+                               &context->start, &context->goal);
+        } else {
+            // Not enough space for a path.
+            *depth = 0;
+        }
+    }
+}
+
 /**
  * Tests if we have reached our goal and writes out result data if yes.
  * @param path the buffer to write the path to.
@@ -435,37 +1394,19 @@ static unsigned int writePath(vec2* path, unsigned int depth,
  * @param node the current node.
  * @param gx the goal x coordinate in A* space.
  * @param gy the goal y coordinate in A* space.
- * @param start the start coordinates in map space.
- * @param goal the goal coordinates in map space.
  * @return whether the goal was reached or not.
  */
-static int isGoal(vec2* path, unsigned int* depth, float* length,
-                  PathNode* node, unsigned int gx, unsigned int gy,
-                  const vec2* start, const vec2* goal) {
+static int isGoal(AStarContext* context, vec2* path, unsigned int* depth, float* length,
+                  PathNode* node, unsigned int gx, unsigned int gy) {
     // Test whether node coordinates are goal coordinates.
     if (node->x == gx && node->y == gy) {
         // Prune the path based on line of sight (i.e. skip nodes that are only
-        // making the path longer than necessary).
-        unsigned int realDepth = prunePath(node);
-
-        // Compute actual length of the path. We can't use the gscore because
-        // we might have pruned some of the path, which might alter the distance
-        // quite a bit.
-        if (length) {
-            *length = computeLength(node, start, goal);
-        }
+        // making the path longer than necessary), and remember it, so that it
+        // can be written again.
+        context->tailDepth = prunePath(context, node);
+        context->tail = node - context->nodes + 1;
 
-        // Make sure we can write something back.
-        if (depth) {
-            if (*depth > 1) {
-                // Long enough for something path-y, write as much as we need or
-                // can, whichever is less.
-                *depth = writePath(path, *depth, node, realDepth, start, goal);
-            } else {
-                // Not enough space for a path.
-                *depth = 0;
-            }
-        }
+        writeResult(context, path, depth, length);
 
         // Return success.
         return 1;
@@ -475,180 +1416,2705 @@ static int isGoal(vec2* path, unsigned int* depth, float* length,
     return 0;
 }
 
-///////////////////////////////////////////////////////////////////////////////
-// Header implementation
-///////////////////////////////////////////////////////////////////////////////
+/**
+ * Prunes a path in the waypoint list the same way prunePath does, keeping its
+ * first and last waypoint. The waypoints we didn't skip so far are kept as a
+ * stack, and only the top entry can be skipped, so this works in place.
+ * @return the number of remaining waypoints.
+ */
+static unsigned int pruneWaypoints(AStarContext* context, unsigned int count) {
+    Waypoint* waypoints = context->waypoints;
+    unsigned int kept = 1;
 
-int AStar(const vec2* start, const vec2* goal,
-          int(*passable)(float x, float y), unsigned int bounds,
-          vec2* path, unsigned int* depth, float* length) {
-    unsigned int gx, gy, begin_x, begin_y, end_x, end_y, neighbor_x, neighbor_y;
-    int x, y;
-    float gscore, fscore;
-    PathNode *current, *node;
+    if (count < 3) {
+        return count;
+    }
 
-    assert(start);
-    assert(goal);
+    for (unsigned int i = 1; i < count - 1; ++i) {
+        waypoints[kept++] = waypoints[i];
+        // See if we can skip the one we just added.
+        if (isInLineOfSight(context, waypoints[i + 1].x, waypoints[i + 1].y,
+                            waypoints[kept - 2].x, waypoints[kept - 2].y)) {
+            --kept;
+        }
+    }
+    waypoints[kept++] = waypoints[count - 1];
 
+    return kept;
+}
 
-    // We need a passability method.
-    if (!passable) {
+/**
+ * Computes the actual length (in map space) of a path in the waypoint list,
+ * replacing its first and last waypoint with the specified positions.
+ */
+static float computeWaypointLength(const AStarContext* context, unsigned int count,
+                                   const vec2* first, const vec2* last) {
+    float length = 0, lx, ly;
+
+    // Paths in a single cell have no length in between.
+    if (count < 2) {
         return 0;
     }
 
-    // Check if the start and target position are valid (passable).
-    if (!passable(start->v[0], start->v[1]) ||
-        !passable(goal->v[0], goal->v[1])) {
-        return 0;
+    lx = first->d.x;
+    ly = first->d.y;
+    for (unsigned int i = 1; i < count - 1; ++i) {
+        const float nx = toGlobal(context->waypoints[i].x);
+        const float ny = toGlobal(context->waypoints[i].y);
+        const float dx = nx - lx;
+        const float dy = ny - ly;
+        length += sqrtf(dx * dx + dy * dy);
+        lx = nx;
+        ly = ny;
+    }
+    {
+        const float dx = last->d.x - lx;
+        const float dy = last->d.y - ly;
+        length += sqrtf(dx * dx + dy * dy);
     }
 
-    // Remember passability check method.
-    gIsPassable = passable;
+    return length;
+}
 
-    // Set grid bounds.
-    gGridSize = bounds * ASTAR_GRANULARITY;
+///////////////////////////////////////////////////////////////////////////////
+// Components
+///////////////////////////////////////////////////////////////////////////////
 
-    // Ensure size of lookup table is sufficient.
-    if (gGridSize > gGridCapacity) {
-        gGridCapacity = gGridSize;
-        BS_Delete(gClosedSetLookup);
-        gClosedSetLookup = BS_New(gGridCapacity * gGridCapacity);
+/*
+ * Blocks that are connected by passable blocks share a component, which is
+ * tracked via union-find over block labels. Making a block passable unites
+ * the components of its neighbors, which is cheap. Blocking a block may split
+ * its component, so we flood from each of its neighbors in lockstep until all
+ * but one flood met another or ran out of blocks. Floods that ran out found a
+ * component that was cut off, and only those get new labels, so the work is
+ * bounded by the size of the smaller parts.
+ *
+ * Diagonal steps need one of the two orthogonal cells to be passable, via
+ * which the cells are connected anyway, so four-connectivity is sufficient.
+ */
+
+/** Gets the root label of the component a label belongs to */
+static unsigned int findComponent(const AStarGrid* grid, unsigned int label) {
+    // No path compression, so that queries don't write (ranks keep it short).
+    while (grid->parents[label] != label) {
+        label = grid->parents[label];
     }
+    return label;
+}
 
-    // Reset number of entries used in the open and closed set.
-    gOpenSetCount = 0;
-    gClosedSetCount = 0;
+/** Gets the root label of the component of a cell, zero if it's blocked */
+inline static unsigned int getComponent(const AStarGrid* grid, unsigned int x, unsigned int y) {
+    const unsigned int blocks = grid->size / ASTAR_GRANULARITY;
+    const unsigned int label = grid->labels[(y / ASTAR_GRANULARITY) * blocks + x / ASTAR_GRANULARITY];
+    return label ? findComponent(grid, label) : 0;
+}
 
-    // Clear closed set bitset representation.
-    BS_Reset(gClosedSetLookup, gGridSize * gGridSize);
+/** Creates a new component label */
+static unsigned int newComponent(AStarGrid* grid) {
+    if (grid->labelCount >= grid->labelCapacity) {
+        grid->labelCapacity = grid->labelCapacity * 2 + 2;
+        if (!(grid->parents = realloc(grid->parents, grid->labelCapacity * sizeof (unsigned int))) ||
+            !(grid->ranks = realloc(grid->ranks, grid->labelCapacity * sizeof (unsigned char)))) {
+            fprintf(stderr, "Out of memory while resizing A* component labels.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    grid->parents[grid->labelCount] = grid->labelCount;
+    grid->ranks[grid->labelCount] = 0;
+    return grid->labelCount++;
+}
 
-    // Get goal in local coordinates.
-    gx = toLocal(goal->v[0]);
-    gy = toLocal(goal->v[1]);
+/** Merges the components two labels belong to */
+static void uniteComponents(AStarGrid* grid, unsigned int a, unsigned int b) {
+    a = findComponent(grid, a);
+    b = findComponent(grid, b);
+    if (a == b) {
+        return;
+    }
 
-    // Initialize the first open node to the one we're starting from.
-    current = newOpenNode(0);
-    current->x = toLocal(start->v[0]);
-    current->y = toLocal(start->v[1]);
-    current->gscore = 0.0f;
-    current->fscore = 0.0f;
-    current->came_from = 0;
-    current->steps = 1;
+    // Attach the shallower tree to the deeper one.
+    if (grid->ranks[a] < grid->ranks[b]) {
+        grid->parents[a] = b;
+    } else {
+        grid->parents[b] = a;
+        if (grid->ranks[a] == grid->ranks[b]) {
+            ++grid->ranks[a];
+        }
+    }
+}
 
-    // Do the actual search.
-    while (gOpenSetCount > 0) {
-        // Copy first (best) open entry to closed list.
-        current = popOpenNodeToClosedSet();
+/** Gets the passable neighbors of a block, returns their number */
+static unsigned int getNeighborBlocks(const AStarGrid* grid, unsigned int index, unsigned int* neighbors) {
+    const unsigned int blocks = grid->size / ASTAR_GRANULARITY;
+    const unsigned int x = index % blocks, y = index / blocks;
+    unsigned int count = 0;
+    if (x > 0 && grid->labels[index - 1]) {
+        neighbors[count++] = index - 1;
+    }
+    if (x + 1 < blocks && grid->labels[index + 1]) {
+        neighbors[count++] = index + 1;
+    }
+    if (y > 0 && grid->labels[index - blocks]) {
+        neighbors[count++] = index - blocks;
+    }
+    if (y + 1 < blocks && grid->labels[index + blocks]) {
+        neighbors[count++] = index + blocks;
+    }
+    return count;
+}
 
-        // Check if we're there yet.
-        if (isGoal(path, depth, length, current, gx, gy, start, goal)) {
-            return 1;
+/** Adds a block to a flood */
+static void pushFlood(Flood* flood, unsigned int block) {
+    if (flood->count >= flood->capacity) {
+        flood->capacity = flood->capacity * 2 + 16;
+        if (!(flood->blocks = realloc(flood->blocks, flood->capacity * sizeof (unsigned int)))) {
+            fprintf(stderr, "Out of memory while resizing A* component flood.\n");
+            exit(EXIT_FAILURE);
         }
+    }
+    flood->blocks[flood->count++] = block;
+}
 
-        // Check our neighbors. Determine which neighbors we actually need to
-        // check based on the direction we came from. Per default enable all.
-        begin_x = clamp(current->x - 1);
-        begin_y = clamp(current->y - 1);
-        end_x = clamp(current->x + 1);
-        end_y = clamp(current->y + 1);
-
-        // Check if we have a direction, i.e. we came from somewhere. The
-        // exception is the start node, where we'll have to check all neighbors.
-        if (current->came_from) {
-            // Compute the direction as an integer of {-1, 0, 1} for both axii.
-            const int dx = current->x - gClosedSet[current->came_from - 1].x,
-                    dy = current->y - gClosedSet[current->came_from - 1].y;
-
-            // If we're only moving to the right we don't have to check left. If
-            // we're also moving vertically, though, we need to check for an
-            // obstacle (forced neighbors), which we do via the passable check.
-            // This works analogous for all other movement directions.
-            if (dx >= 0 && isPassable(current->x - 1, current->y)) {
-                // Don't have to check to the left.
-                begin_x = current->x;
-            } else if (dx <= 0 && isPassable(current->x + 1, current->y)) {
-                // Don't have to check to the right.
-                end_x = current->x;
-            }
-            if (dy >= 0 && isPassable(current->x, current->y - 1)) {
-                // Don't have to check up.
-                begin_y = current->y;
-            } else if (dy <= 0 && isPassable(current->x, current->y + 1)) {
-                // Don't have to check down.
-                end_y = current->y;
-            }
-        }
-
-        // Now work through all our selected neighbors.
-        for (neighbor_x = begin_x; neighbor_x <= end_x; ++neighbor_x) {
-            for (neighbor_y = begin_y; neighbor_y <= end_y; ++neighbor_y) {
-                // Skip self.
-                if (neighbor_x == current->x && neighbor_y == current->y) {
-                    continue;
-                }
+/** Gets the flood representing the group a flood was merged into */
+static unsigned int findFloodGroup(const unsigned int* groups, unsigned int flood) {
+    while (groups[flood] != flood) {
+        flood = groups[flood];
+    }
+    return flood;
+}
 
-                // The actual node to be inspected.
-                x = neighbor_x, y = neighbor_y;
+/** Labels a block that became passable, joining its neighbors' components */
+static void joinBlock(AStarGrid* grid, unsigned int index) {
+    unsigned int neighbors[4];
+    const unsigned int count = getNeighborBlocks(grid, index, neighbors);
 
-#if ASTAR_JPS
-                // Try this direction using jump point search.
-                if (!jumpPointSearch(&x, &y, x - current->x, y - current->y, x, y, gx, gy)) {
-                    // Failed, try next neighbor.
-                    continue;
-                }
+    if (!count) {
+        // Isolated, new component.
+        grid->labels[index] = newComponent(grid);
+        return;
+    }
+
+    grid->labels[index] = grid->labels[neighbors[0]];
+    for (unsigned int i = 1; i < count; ++i) {
+        uniteComponents(grid, grid->labels[index], grid->labels[neighbors[i]]);
+    }
+}
+
+/** Removes the label of a block that became blocked, and splits its component if necessary */
+static void splitBlock(AStarGrid* grid, unsigned int index) {
+    unsigned int neighbors[4], groups[4];
+    unsigned int count, base;
+
+    grid->labels[index] = 0;
+
+    // Can't split if at most one side is passable.
+    if ((count = getNeighborBlocks(grid, index, neighbors)) < 2) {
+        return;
+    }
+
+    // Get a fresh stamp per flood, so we don't have to clear marks.
+    if (grid->mark > UINT_MAX - 4) {
+        memset(grid->marks, 0, (grid->size / ASTAR_GRANULARITY) * (grid->size / ASTAR_GRANULARITY) * sizeof (unsigned int));
+        grid->mark = 0;
+    }
+    base = grid->mark + 1;
+    grid->mark += 4;
+
+    for (unsigned int i = 0; i < count; ++i) {
+        grid->floods[i].head = 0;
+        grid->floods[i].count = 0;
+        pushFlood(&grid->floods[i], neighbors[i]);
+        grid->marks[neighbors[i]] = base + i;
+        groups[i] = i;
+    }
 
-                // We might have jumped to the goal, check for that.
-                if (isGoal(path, depth, length, current, gx, gy, start, goal)) {
-                    return 1;
+    for (;;) {
+        unsigned int groupCount = 0, activeCount = 0;
+
+        // Stop once all floods met, or all but one group ran out of blocks.
+        for (unsigned int i = 0; i < count; ++i) {
+            if (findFloodGroup(groups, i) == i) {
+                ++groupCount;
+                for (unsigned int j = 0; j < count; ++j) {
+                    if (findFloodGroup(groups, j) == i && grid->floods[j].head < grid->floods[j].count) {
+                        ++activeCount;
+                        break;
+                    }
                 }
-#else
-                // If we already handled this one, skip it.
-                if (BS_Test(gClosedSetLookup, y * gGridSize + x)) {
-                    continue;
+            }
+        }
+        if (groupCount < 2) {
+            // Still connected, nothing changes.
+            return;
+        }
+        if (activeCount < 2) {
+            break;
+        }
+
+        // Expand each flood by one block.
+        for (unsigned int i = 0; i < count; ++i) {
+            Flood* flood = &grid->floods[i];
+            unsigned int adjacent[4], adjacentCount;
+            if (flood->head >= flood->count) {
+                continue;
+            }
+            adjacentCount = getNeighborBlocks(grid, flood->blocks[flood->head++], adjacent);
+            for (unsigned int j = 0; j < adjacentCount; ++j) {
+                const unsigned int mark = grid->marks[adjacent[j]];
+                if (mark >= base && mark < base + count) {
+                    // Reached by some flood already, merge if it's another.
+                    const unsigned int a = findFloodGroup(groups, i);
+                    const unsigned int b = findFloodGroup(groups, mark - base);
+                    if (a != b) {
+                        groups[b] = a;
+                    }
+                } else {
+                    grid->marks[adjacent[j]] = base + i;
+                    pushFlood(flood, adjacent[j]);
                 }
+            }
+        }
+    }
 
-                // Only if this block is passable and the two diagonal ones are.
-                if (!isPassable(x, y) ||
-                    (!isPassable(x, current->y) && !isPassable(current->x, y))) {
-                    continue;
+    // Each group that ran out of blocks is a component of its own. One group
+    // keeps the old label, preferably the one still flooding, because that
+    // one may be arbitrarily large.
+    {
+        unsigned int keep = count;
+        for (unsigned int i = 0; i < count; ++i) {
+            if (grid->floods[i].head < grid->floods[i].count) {
+                keep = findFloodGroup(groups, i);
+            }
+        }
+        if (keep == count) {
+            keep = findFloodGroup(groups, 0);
+        }
+        for (unsigned int i = 0; i < count; ++i) {
+            if (findFloodGroup(groups, i) == i && i != keep) {
+                const unsigned int label = newComponent(grid);
+                for (unsigned int j = 0; j < count; ++j) {
+                    if (findFloodGroup(groups, j) == i) {
+                        for (unsigned int k = 0; k < grid->floods[j].count; ++k) {
+                            grid->labels[grid->floods[j].blocks[k]] = label;
+                        }
+                    }
                 }
-#endif
+            }
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Hierarchy
+///////////////////////////////////////////////////////////////////////////////
 
-                // Determine score - score to current node plus that to this
-                // neighbor. This is the actual traveled distance (Euclidean
-                // distance -- we do an actual computation here, because we
-                // might have skipped some tiles).
-                gscore = current->gscore +
-                        h(x, y, current->x, current->y);
+/** Gets the index of the cluster containing the specified cell */
+inline static unsigned int clusterAt(const AStarHierarchy* hierarchy, unsigned int x, unsigned int y) {
+    return (y / CLUSTER_CELLS) * hierarchy->size + x / CLUSTER_CELLS;
+}
 
-                // See if we can find that neighbor in the open set and should
-                // skip it, because there already exists a better path to it.
-                if (shouldSkip(x, y, gscore)) {
-                    continue;
-                }
+/** Gets the cell bounds of a cluster; the upper bounds are exclusive */
+static void getClusterBounds(const AStarHierarchy* hierarchy, unsigned int index,
+                             unsigned int* x0, unsigned int* y0,
+                             unsigned int* x1, unsigned int* y1) {
+    *x0 = (index % hierarchy->size) * CLUSTER_CELLS;
+    *y0 = (index / hierarchy->size) * CLUSTER_CELLS;
+    *x1 = *x0 + CLUSTER_CELLS;
+    *y1 = *y0 + CLUSTER_CELLS;
+    // Clusters at the far edges may be cut off by the grid bounds.
+    if (*x1 > hierarchy->grid->size) {
+        *x1 = hierarchy->grid->size;
+    }
+    if (*y1 > hierarchy->grid->size) {
+        *y1 = hierarchy->grid->size;
+    }
+}
+
+/** Finds the index of the entrance at the specified cell, or NO_LINK */
+static unsigned int findEntrance(const Cluster* cluster, unsigned int cell) {
+    for (unsigned int i = 0; i < cluster->count; ++i) {
+        if (cluster->entrances[i] == cell) {
+            return i;
+        }
+    }
+    return NO_LINK;
+}
+
+/** Adds an entrance to a cluster, or a second link if it already exists */
+static void addEntrance(Cluster* cluster, unsigned int cell, unsigned int link) {
+    const unsigned int index = findEntrance(cluster, cell);
 
-                // Compute the heuristic cost for a path with this waypoint.
-                // The factor in the end is used for tie breaking.
-                fscore = (gscore + f(x, y, gx, gy)) * 1.001f;
+    // Cells in corners may lead to two clusters.
+    if (index != NO_LINK) {
+        cluster->links[index * 2 + 1] = link;
+        return;
+    }
+
+    // Ensure we have the capacity to add the entrance.
+    if (cluster->count >= cluster->capacity) {
+        cluster->capacity = cluster->capacity * 2 + 4;
+        if (!(cluster->entrances = realloc(cluster->entrances, cluster->capacity * sizeof (unsigned int))) ||
+            !(cluster->links = realloc(cluster->links, cluster->capacity * 2 * sizeof (unsigned int)))) {
+            fprintf(stderr, "Out of memory while resizing A* cluster entrances.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
 
-                // Create new entry.
-                node = newOpenNode(fscore);
+    cluster->entrances[cluster->count] = cell;
+    cluster->links[cluster->count * 2] = link;
+    cluster->links[cluster->count * 2 + 1] = NO_LINK;
+    ++cluster->count;
+}
 
-                // Store position of that node. Used for "contains" checks.
-                node->x = x;
-                node->y = y;
+/**
+ * Adds entrances along one border of a cluster. Runs of cells that are open
+ * on both sides of the border get one entrance in the middle, or one at each
+ * end if they are long. The neighboring cluster scans the same border in the
+ * same direction, so both sides agree on where the entrances are.
+ * @param x the first cell of the border inside the cluster.
+ * @param y the first cell of the border inside the cluster.
+ * @param ax step along the border in x direction.
+ * @param ay step along the border in y direction.
+ * @param nx offset to the cell on the other side of the border in x direction.
+ * @param ny offset to the cell on the other side of the border in y direction.
+ * @param length the number of cells along the border.
+ */
+static void scanBorder(const AStarGrid* grid, Cluster* cluster,
+                       unsigned int x, unsigned int y, unsigned int ax, unsigned int ay,
+                       int nx, int ny, unsigned int length) {
+    unsigned int run = 0;
+    for (unsigned int i = 0; i <= length; ++i) {
+        const unsigned int cx = x + ax * i;
+        const unsigned int cy = y + ay * i;
 
-                // Remember where we came from and how deep the path is.
-                node->came_from = gClosedSetCount;
-                node->steps = current->steps + 1;
+        // Cells outside the grid are never passable, so there are no
+        // entrances along the map's edges.
+        if (i < length && testGrid(grid, cx, cy) && testGrid(grid, cx + nx, cy + ny)) {
+            ++run;
+            continue;
+        }
 
-                // Also keep the scores, g for continuous computation, f for
-                // sorting.
-                node->gscore = gscore;
-                node->fscore = fscore;
+        // End of a run, place its entrances.
+        if (run) {
+            const unsigned int first = i - run;
+            const unsigned int last = i - 1;
+            if (run < CLUSTER_LONG_ENTRANCE) {
+                const unsigned int middle = first + run / 2;
+                addEntrance(cluster, (y + ay * middle) * grid->size + x + ax * middle,
+                            (y + ay * middle + ny) * grid->size + x + ax * middle + nx);
+            } else {
+                addEntrance(cluster, (y + ay * first) * grid->size + x + ax * first,
+                            (y + ay * first + ny) * grid->size + x + ax * first + nx);
+                addEntrance(cluster, (y + ay * last) * grid->size + x + ax * last,
+                            (y + ay * last + ny) * grid->size + x + ax * last + nx);
             }
+            run = 0;
         }
     }
+}
 
-    return 0;
+/** Updates a node reached via another one, if the new score is better */
+static void relaxNode(AStarContext* context, unsigned int fromIndex,
+                      unsigned int x, unsigned int y, float gscore, float fscore) {
+    PathNode* node;
+
+    // Skip it if it's closed or known with a better score.
+    if ((node = getNode(context, x, y))) {
+        if (node->heapIndex == NODE_CLOSED || node->gscore <= gscore) {
+            return;
+        }
+    } else {
+        ensureNodeCapacity(context, 1);
+        node = newNode(context, x, y);
+    }
+
+    node->came_from = fromIndex + 1;
+    node->steps = context->nodes[fromIndex].steps + 1;
+    node->gscore = gscore;
+    node->fscore = fscore;
+
+    if (node->heapIndex == NODE_CLOSED) {
+        pushOpenNode(context, node);
+    } else {
+        siftUp(context, node->heapIndex);
+    }
+}
+
+/**
+ * Relaxes all neighbors of a node for a plain Dijkstra search, i.e. with the
+ * fscore being the gscore, staying inside the specified bounds. The upper
+ * bounds are exclusive.
+ */
+static void relaxNeighbors(AStarContext* context, unsigned int currentIndex,
+                           unsigned int cx, unsigned int cy, float cg,
+                           unsigned int x0, unsigned int y0,
+                           unsigned int x1, unsigned int y1) {
+    for (int dy = -1; dy <= 1; ++dy) {
+        for (int dx = -1; dx <= 1; ++dx) {
+            const unsigned int x = cx + dx;
+            const unsigned int y = cy + dy;
+
+            // Skip self, and stay inside the bounds (negative coordinates
+            // wrap around).
+            if ((!dx && !dy) || x < x0 || x >= x1 || y < y0 || y >= y1) {
+                continue;
+            }
+
+            // Only if this block is passable and the two diagonal ones are.
+            if (!isPassable(context, x, y) ||
+                (!isPassable(context, x, cy) && !isPassable(context, cx, y))) {
+                continue;
+            }
+
+            {
+                const float gscore = cg + ((dx && dy) ? SQRT2 : 1.0f);
+                relaxNode(context, currentIndex, x, y, gscore, gscore);
+            }
+        }
+    }
+}
+
+/** Starts a plain Dijkstra search from a cell, see continueEntranceDistances */
+static void beginEntranceDistances(AStarContext* context, unsigned int sx, unsigned int sy) {
+    PathNode* node;
+
+    beginSearch(context);
+    ensureNodeCapacity(context, 1);
+    node = newNode(context, sx, sy);
+    node->gscore = 0.0f;
+    node->fscore = 0.0f;
+    node->came_from = 0;
+    node->steps = 1;
+    pushOpenNode(context, node);
+}
+
+/**
+ * Continues a search started via beginEntranceDistances inside a cluster,
+ * until all of its entrances starting at the specified index are closed.
+ * If budgeted, stops early once the context's budget is used up.
+ * @return 1 when done, 0 if out of budget.
+ */
+static int continueEntranceDistances(AStarContext* context, const AStarHierarchy* hierarchy,
+                                     unsigned int index, unsigned int first, int budgeted) {
+    const Cluster* cluster = &hierarchy->clusters[index];
+    const unsigned int size = hierarchy->grid->size;
+    unsigned int x0, y0, x1, y1, remaining = 0;
+
+    // Count the entrances we're still interested in, which are all of them
+    // unless we're continuing.
+    for (unsigned int i = first; i < cluster->count; ++i) {
+        if (!isClosed(context, cluster->entrances[i] % size, cluster->entrances[i] / size)) {
+            ++remaining;
+        }
+    }
+    if (!remaining) {
+        return 1;
+    }
+
+    getClusterBounds(hierarchy, index, &x0, &y0, &x1, &y1);
+
+    while (context->openSetCount > 0) {
+        const PathNode* current;
+        unsigned int currentIndex, cx, cy, entrance;
+        float cg;
+
+        if (budgeted && context->limited) {
+            if (!context->budget) {
+                return 0;
+            }
+            --context->budget;
+        }
+
+        // Copy what we need, relaxing may move the node list. Count these
+        // like any other expansion, hierarchical searches charge them.
+        current = popOpenNodeToClosedSet(context);
+        currentIndex = current - context->nodes;
+        cx = current->x;
+        cy = current->y;
+        cg = current->gscore;
+        entrance = findEntrance(cluster, cy * size + cx);
+
+        ++context->expanded;
+
+        if (entrance != NO_LINK && entrance >= first && --remaining == 0) {
+            break;
+        }
+
+        relaxNeighbors(context, currentIndex, cx, cy, cg, x0, y0, x1, y1);
+    }
+    return 1;
+}
+
+/**
+ * Reads back the distances found by continueEntranceDistances, which are
+ * final for closed nodes. Entrances that can't be reached get a negative
+ * distance.
+ */
+static void readEntranceDistances(AStarContext* context, const AStarHierarchy* hierarchy,
+                                  unsigned int index, unsigned int first, float* distances) {
+    const Cluster* cluster = &hierarchy->clusters[index];
+    const unsigned int size = hierarchy->grid->size;
+
+    for (unsigned int i = first; i < cluster->count; ++i) {
+        const PathNode* node = getNode(context, cluster->entrances[i] % size, cluster->entrances[i] / size);
+        distances[i] = (node && node->heapIndex == NODE_CLOSED) ? node->gscore : -1.0f;
+    }
+}
+
+/**
+ * Computes distances from a cell to the entrances of a cluster, starting at
+ * the specified entrance index, moving only inside that cluster. Entrances
+ * that can't be reached get a negative distance. The context's grid must be
+ * set up already.
+ */
+static void computeEntranceDistances(AStarContext* context, const AStarHierarchy* hierarchy,
+                                     unsigned int index, unsigned int sx, unsigned int sy,
+                                     unsigned int first, float* distances) {
+    // Nothing to do if there are no entrances we're interested in.
+    if (first >= hierarchy->clusters[index].count) {
+        return;
+    }
+
+    // Plain Dijkstra, until all entrances we're interested in are closed.
+    beginEntranceDistances(context, sx, sy);
+    continueEntranceDistances(context, hierarchy, index, first, 0);
+    readEntranceDistances(context, hierarchy, index, first, distances);
+}
+
+/** Rebuilds entrances and distances of a cluster from the grid */
+static void rebuildCluster(AStarContext* context, AStarHierarchy* hierarchy, unsigned int index) {
+    Cluster* cluster = &hierarchy->clusters[index];
+    const AStarGrid* grid = hierarchy->grid;
+    unsigned int x0, y0, x1, y1;
+
+    getClusterBounds(hierarchy, index, &x0, &y0, &x1, &y1);
+
+    // Find entrances along all four borders.
+    cluster->count = 0;
+    scanBorder(grid, cluster, x0, y0, 1, 0, 0, -1, x1 - x0);
+    scanBorder(grid, cluster, x0, y1 - 1, 1, 0, 0, 1, x1 - x0);
+    scanBorder(grid, cluster, x0, y0, 0, 1, -1, 0, y1 - y0);
+    scanBorder(grid, cluster, x1 - 1, y0, 0, 1, 1, 0, y1 - y0);
+
+    // Compute distances between all pairs of entrances. Distances are
+    // symmetric, so each search only needs to find the entrances after the
+    // one it starts from.
+    free(cluster->distances);
+    cluster->distances = NULL;
+    if (cluster->count) {
+        const unsigned int count = cluster->count;
+        if (!(cluster->distances = malloc(count * count * sizeof (float)))) {
+            fprintf(stderr, "Out of memory while allocating A* cluster distances.\n");
+            exit(EXIT_FAILURE);
+        }
+        for (unsigned int i = 0; i < count; ++i) {
+            cluster->distances[i * count + i] = 0.0f;
+            computeEntranceDistances(context, hierarchy, index,
+                                     cluster->entrances[i] % grid->size,
+                                     cluster->entrances[i] / grid->size,
+                                     i + 1, &cluster->distances[i * count]);
+            for (unsigned int j = i + 1; j < count; ++j) {
+                cluster->distances[j * count + i] = cluster->distances[i * count + j];
+            }
+        }
+    }
+
+    hierarchy->dirty[index] = 0;
+}
+
+/**
+ * Gets the context for the searches inside clusters of a hierarchical search,
+ * set up to search the same way as the hierarchical one, with what's left of
+ * its budget.
+ */
+static AStarContext* getLocalContext(AStarContext* context) {
+    AStarContext* local = context->local;
+    if (!local) {
+        local = context->local = AS_NewContext();
+    }
+    local->bidirectional = context->bidirectional;
+    local->landmarks = context->landmarks;
+    local->policy = context->policy;
+    local->factor = context->factor;
+    local->budget = context->budget;
+    local->limited = context->limited;
+    return local;
+}
+
+/**
+ * Counts expansions made in the local context against the budget of a
+ * hierarchical search. The local context only gets what's left of that budget,
+ * so this runs it down to zero at most.
+ */
+static void chargeLocalExpansions(AStarContext* context, unsigned long expanded) {
+    const unsigned long count = context->local->expanded - expanded;
+    context->expanded += count;
+    if (context->limited) {
+        context->budget = count < context->budget ? context->budget - count : 0;
+    }
+}
+
+/** Gets the position of a waypoint of the abstract path stored in the context */
+static vec2 getWaypointPosition(const AStarContext* context, unsigned int index) {
+    vec2 position;
+
+    // Use the actual start and goal for the first and last one.
+    if (index == 0) {
+        return context->start;
+    }
+    if (index == context->waypointCount - 1) {
+        return context->goal;
+    }
+    position.d.x = toGlobal(context->waypoints[index].x);
+    position.d.y = toGlobal(context->waypoints[index].y);
+    return position;
+}
+
+/**
+ * Turns the abstract path stored in the context into a path on the grid,
+ * with a local search for each part of the path inside a cluster, until the
+ * refined path has at least the specified number of nodes or is complete.
+ * What was refined is kept in the context, so this continues where the last
+ * call stopped, e.g. when it ran out of budget.
+ * @return 1 if done, 0 if a part couldn't be refined, ASTAR_PENDING if the
+ * budget was used up.
+ */
+static int refinePath(AStarContext* context, unsigned int depth) {
+    const AStarHierarchy* hierarchy = context->hierarchy;
+    const Waypoint* waypoints = context->waypoints;
+
+    while (context->refineIndex < context->waypointCount && context->refinedCount < depth) {
+        const unsigned int i = context->refineIndex;
+        const vec2 from = getWaypointPosition(context, i - 1);
+        const vec2 to = getWaypointPosition(context, i);
+
+        if (clusterAt(hierarchy, waypoints[i - 1].x, waypoints[i - 1].y) ==
+            clusterAt(hierarchy, waypoints[i].x, waypoints[i].y)) {
+            // Inside a cluster, search between the two. This overwrites the
+            // last refined node with the same position.
+            AStarContext* local;
+            unsigned long expanded;
+            unsigned int segmentDepth;
+            float segmentLength = 0;
+            int result;
+
+            if (context->limited && !context->budget) {
+                return ASTAR_PENDING;
+            }
+
+            local = getLocalContext(context);
+            expanded = local->expanded;
+            ensureRefinedCapacity(context, context->refinedCount + 1);
+            segmentDepth = context->refinedCapacity - context->refinedCount + 1;
+            if (context->refineSuspended) {
+                result = AS_ResumeSearch(local, &context->refined[context->refinedCount - 1],
+                                         &segmentDepth, &segmentLength);
+            } else {
+                result = AS_SearchGrid(local, &from, &to, hierarchy->grid,
+                                       &context->refined[context->refinedCount - 1],
+                                       &segmentDepth, &segmentLength);
+            }
+
+            // If the part didn't fit, write it again with more room.
+            while (result > 0 && context->refinedCount + segmentDepth >= context->refinedCapacity) {
+                ensureRefinedCapacity(context, context->refinedCapacity * 2);
+                segmentDepth = context->refinedCapacity - context->refinedCount + 1;
+                result = AS_WriteSearchPath(local, &context->refined[context->refinedCount - 1],
+                                            &segmentDepth, &segmentLength);
+            }
+            chargeLocalExpansions(context, expanded);
+
+            context->refineSuspended = result == ASTAR_PENDING;
+            if (result <= 0) {
+                return result;
+            }
+            context->refinedCount += segmentDepth - 1;
+            context->refinedLength += segmentLength;
+        } else {
+            // Crossing into a neighboring cluster, that's a single step.
+            const float dx = to.d.x - from.d.x;
+            const float dy = to.d.y - from.d.y;
+            ensureRefinedCapacity(context, context->refinedCount + 1);
+            context->refined[context->refinedCount++] = to;
+            context->refinedLength += sqrtf(dx * dx + dy * dy);
+        }
+
+        ++context->refineIndex;
+    }
+    return 1;
+}
+
+/**
+ * Writes out result data for the abstract path found by a hierarchical search,
+ * refining as much of it as fits into the buffer first.
+ */
+static int writeHierarchyResult(AStarContext* context, vec2* path, unsigned int* depth, float* length) {
+    const Waypoint* waypoints = context->waypoints;
+    const unsigned int count = context->waypointCount;
+    unsigned int written;
+    int result;
+
+    // Make sure we can write something back. If not, we're only interested
+    // in the length, so use the abstract one.
+    if (!depth || *depth <= 1) {
+        if (depth) {
+            *depth = 0;
+        }
+        if (length) {
+            *length = waypoints[count - 1].gscore / ASTAR_GRANULARITY;
+        }
+        return 1;
+    }
+
+    if ((result = refinePath(context, *depth)) <= 0) {
+        context->suspended = result == ASTAR_PENDING;
+        return result;
+    }
+
+    // If the buffer is full end in the goal, like a truncated regular search,
+    // and estimate the rest of the length from the abstract path.
+    written = context->refinedCount;
+    if (written > *depth || (written == *depth && context->refineIndex < count)) {
+        written = *depth;
+        memcpy(path, context->refined, (written - 1) * sizeof (vec2));
+        path[written - 1] = context->goal;
+    } else {
+        memcpy(path, context->refined, written * sizeof (vec2));
+    }
+
+    *depth = written;
+    if (length) {
+        *length = context->refinedLength +
+                (waypoints[count - 1].gscore - waypoints[context->refineIndex - 1].gscore) / ASTAR_GRANULARITY;
+    }
+    return 1;
+}
+
+/**
+ * Starts a search on the abstract graph of a hierarchy. The start and goal
+ * are connected to the entrances of their clusters first, which takes a local
+ * search each, see connectHierarchySearch.
+ */
+static void beginHierarchySearch(AStarContext* context, const AStarHierarchy* hierarchy,
+                                 const vec2* start, const vec2* goal) {
+    const unsigned int sx = toLocal(start->v[0]);
+    const unsigned int sy = toLocal(start->v[1]);
+    const unsigned int gx = toLocal(goal->v[0]);
+    const unsigned int gy = toLocal(goal->v[1]);
+    const unsigned int startCount = hierarchy->clusters[clusterAt(hierarchy, sx, sy)].count;
+    const unsigned int goalCount = hierarchy->clusters[clusterAt(hierarchy, gx, gy)].count;
+    AStarContext* local = getLocalContext(context);
+    PathNode* node;
+
+    // Make room for the distances from start and goal to the entrances of
+    // their clusters, and begin with the start's.
+    if (startCount + goalCount > context->entranceCostCapacity) {
+        context->entranceCostCapacity = startCount + goalCount;
+        if (!(context->entranceCosts = realloc(context->entranceCosts, context->entranceCostCapacity * sizeof (float)))) {
+            fprintf(stderr, "Out of memory while resizing A* entrance costs.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    local->grid = hierarchy->grid;
+    local->passable = NULL;
+    local->userdata = NULL;
+    local->gridSize = hierarchy->grid->size;
+    beginEntranceDistances(local, sx, sy);
+
+    // The abstract graph consists of the start, the goal and all cluster
+    // entrances. Remember where we're going in case the search gets
+    // suspended.
+    beginSearch(context);
+    context->hierarchy = hierarchy;
+    context->stage = STAGE_START;
+    context->start = *start;
+    context->goal = *goal;
+    context->meeting = 0;
+
+    ensureNodeCapacity(context, 1);
+    node = newNode(context, sx, sy);
+    node->gscore = 0.0f;
+    node->fscore = 0.0f;
+    node->came_from = 0;
+    node->steps = 1;
+    pushOpenNode(context, node);
+}
+
+/**
+ * Gets the distances from start and goal of a hierarchical search to the
+ * entrances of their clusters, with a local search each.
+ * @return 1 if done, 0 if the budget was used up.
+ */
+static int connectHierarchySearch(AStarContext* context) {
+    const AStarHierarchy* hierarchy = context->hierarchy;
+    const unsigned int sx = toLocal(context->start.v[0]);
+    const unsigned int sy = toLocal(context->start.v[1]);
+    const unsigned int gx = toLocal(context->goal.v[0]);
+    const unsigned int gy = toLocal(context->goal.v[1]);
+    const unsigned int startCluster = clusterAt(hierarchy, sx, sy);
+    const unsigned int goalCluster = clusterAt(hierarchy, gx, gy);
+
+    while (context->stage < STAGE_ABSTRACT) {
+        const int atGoal = context->stage == STAGE_GOAL;
+        const unsigned int index = atGoal ? goalCluster : startCluster;
+        AStarContext* local;
+        unsigned long expanded;
+        int done;
+
+        if (context->limited && !context->budget) {
+            return 0;
+        }
+
+        local = getLocalContext(context);
+        expanded = local->expanded;
+        done = continueEntranceDistances(local, hierarchy, index, 0, 1);
+        chargeLocalExpansions(context, expanded);
+        if (!done) {
+            return 0;
+        }
+
+        readEntranceDistances(local, hierarchy, index, 0, context->entranceCosts +
+                              (atGoal ? hierarchy->clusters[startCluster].count : 0));
+        if (!atGoal) {
+            beginEntranceDistances(local, gx, gy);
+        }
+        ++context->stage;
+    }
+    return 1;
+}
+
+/**
+ * Runs a search on the abstract graph of a hierarchy until it's done or out of
+ * budget, like continueSearch, then refines the result. Connecting the start
+ * and goal to the graph and refining are suspended the same way.
+ */
+static int continueHierarchySearch(AStarContext* context, vec2* path, unsigned int* depth, float* length) {
+    const AStarHierarchy* hierarchy = context->hierarchy;
+    const unsigned int size = hierarchy->grid->size;
+    const unsigned int sx = toLocal(context->start.v[0]);
+    const unsigned int sy = toLocal(context->start.v[1]);
+    const unsigned int gx = toLocal(context->goal.v[0]);
+    const unsigned int gy = toLocal(context->goal.v[1]);
+    const unsigned int goalCluster = clusterAt(hierarchy, gx, gy);
+    const Cluster* from = &hierarchy->clusters[clusterAt(hierarchy, sx, sy)];
+    const float* startCosts = context->entranceCosts;
+    const float* goalCosts = context->entranceCosts + from->count;
+    PathNode* node;
+    unsigned int count;
+    int found = 0;
+
+    context->suspended = 0;
+    if (context->stage == STAGE_REFINE) {
+        return writeHierarchyResult(context, path, depth, length);
+    }
+    if (!connectHierarchySearch(context)) {
+        context->suspended = 1;
+        return ASTAR_PENDING;
+    }
+
+    while (context->openSetCount > 0) {
+        const PathNode* current;
+        unsigned int currentIndex, cx, cy, index, entrance;
+        const Cluster* cluster;
+        float cg;
+
+        // Stop here if we're out of budget, see continueSearch.
+        if (context->limited) {
+            if (!context->budget) {
+                context->suspended = 1;
+                return ASTAR_PENDING;
+            }
+            --context->budget;
+        }
+
+        // Copy what we need, relaxing may move the node list.
+        current = popNextNodeToClosedSet(context);
+        currentIndex = current - context->nodes;
+        cx = current->x;
+        cy = current->y;
+        cg = current->gscore;
+        index = clusterAt(hierarchy, cx, cy);
+        cluster = &hierarchy->clusters[index];
+        entrance = findEntrance(cluster, cy * size + cx);
+
+        // Check if we're there yet.
+        if (cx == gx && cy == gy) {
+            found = 1;
+            break;
+        }
+
+        // The start connects to the entrances of its cluster.
+        if (!current->came_from) {
+            for (unsigned int j = 0; j < from->count; ++j) {
+                if (startCosts[j] >= 0) {
+                    const unsigned int x = from->entrances[j] % size;
+                    const unsigned int y = from->entrances[j] / size;
+                    const float gscore = cg + startCosts[j];
+                    relaxNode(context, currentIndex, x, y, gscore,
+                              score(context, gscore, x, y, gx, gy));
+                }
+            }
+        }
+
+        if (entrance != NO_LINK) {
+            // Entrances connect to the other entrances of their cluster...
+            for (unsigned int j = 0; j < cluster->count; ++j) {
+                const float distance = cluster->distances[entrance * cluster->count + j];
+                if (j != entrance && distance >= 0) {
+                    const unsigned int x = cluster->entrances[j] % size;
+                    const unsigned int y = cluster->entrances[j] / size;
+                    const float gscore = cg + distance;
+                    relaxNode(context, currentIndex, x, y, gscore,
+                              score(context, gscore, x, y, gx, gy));
+                }
+            }
+
+            // ... to their counterparts in neighboring clusters...
+            for (unsigned int j = 0; j < 2; ++j) {
+                const unsigned int link = cluster->links[entrance * 2 + j];
+                if (link != NO_LINK) {
+                    const unsigned int x = link % size;
+                    const unsigned int y = link / size;
+                    const float gscore = cg + 1.0f;
+                    relaxNode(context, currentIndex, x, y, gscore,
+                              score(context, gscore, x, y, gx, gy));
+                }
+            }
+
+            // ... and to the goal, if it's in the same cluster.
+            if (index == goalCluster && goalCosts[entrance] >= 0) {
+                const float gscore = cg + goalCosts[entrance];
+                relaxNode(context, currentIndex, gx, gy, gscore, score(context, gscore, gx, gy, gx, gy));
+            }
+        }
+    }
+
+    if (!found) {
+        return 0;
+    }
+
+    // Copy the abstract path, so it can be refined further if the buffer was
+    // too small.
+    node = getNode(context, gx, gy);
+    count = node->steps;
+    ensureWaypointCapacity(context, count);
+    for (unsigned int i = count; i > 0; --i) {
+        context->waypoints[i - 1].x = node->x;
+        context->waypoints[i - 1].y = node->y;
+        context->waypoints[i - 1].gscore = node->gscore;
+        node = &context->nodes[node->came_from - 1];
+    }
+    context->waypointCount = count;
+
+    // Refine it starting at the start, see refinePath.
+    ensureRefinedCapacity(context, 1);
+    context->refined[0] = context->start;
+    context->refinedCount = 1;
+    context->refineIndex = 1;
+    context->refinedLength = 0;
+    context->refineSuspended = 0;
+    context->stage = STAGE_REFINE;
+
+    return writeHierarchyResult(context, path, depth, length);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Nearest targets
+///////////////////////////////////////////////////////////////////////////////
+
+/** Orders targets by cell, and by index for targets in the same cell */
+static int compareTargets(const void* a, const void* b) {
+    const Target* ta = a;
+    const Target* tb = b;
+    if (ta->cell != tb->cell) {
+        return ta->cell < tb->cell ? -1 : 1;
+    }
+    return ta->index < tb->index ? -1 : (ta->index > tb->index);
+}
+
+/** Finds the first target in the specified cell; the cell must have one */
+static const Target* findTarget(const AStarContext* context, unsigned int count, unsigned int cell) {
+    unsigned int low = 0, high = count;
+    while (low < high) {
+        const unsigned int middle = (low + high) / 2;
+        if (context->targets[middle].cell < cell) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return &context->targets[low];
+}
+
+/**
+ * Estimates the distance from a cell to the closest target. This is the
+ * smallest diagonal distance to any of them, i.e. the length of the path
+ * if there were no obstacles, so it never overestimates and targets are
+ * still reached in the order of their actual distance.
+ */
+static float estimateNearest(const AStarContext* context, unsigned int count,
+                             unsigned int x, unsigned int y) {
+    float best = FLT_MAX;
+    for (unsigned int i = 0; i < count; ++i) {
+        const float distance = octile(x, y, context->targets[i].x, context->targets[i].y);
+        if (distance < best) {
+            best = distance;
+        }
+    }
+
+    // Weighted searches get to the targets quicker, but maybe not in order.
+    if (context->policy == ASTAR_POLICY_WEIGHTED) {
+        return best * context->factor;
+    }
+    return best;
+}
+
+/**
+ * Computes the length of the path ending in the specified node the same way
+ * a regular search does, i.e. after pruning it, but without modifying the
+ * nodes, so that the search can continue afterwards. The pruned path is
+ * built in the waypoint list.
+ */
+static float computePrunedLength(AStarContext* context, unsigned int tailIndex,
+                                 const vec2* start, const vec2* goal) {
+    const PathNode* node = &context->nodes[tailIndex];
+    unsigned int count = 0;
+
+    // Copy the path, from the tail to the start.
+    ensureWaypointCapacity(context, node->steps);
+    while (1) {
+        context->waypoints[count].x = node->x;
+        context->waypoints[count].y = node->y;
+        ++count;
+        if (!node->came_from) {
+            break;
+        }
+        node = &context->nodes[node->came_from - 1];
+    }
+
+    count = pruneWaypoints(context, count);
+    return computeWaypointLength(context, count, goal, start);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Distance fields
+///////////////////////////////////////////////////////////////////////////////
+
+/** Tests whether a field's distances are up-to-date for the specified grid */
+inline static int isFieldValid(const AStarField* field, const AStarGrid* grid) {
+    return field->distances && field->grid == grid && field->version == grid->version;
+}
+
+/**
+ * Tests whether a field can be repaired for the changes of its grid since it
+ * was last updated, i.e. whether these are all remembered, and only made
+ * blocks passable. Distances only get shorter then.
+ */
+static int isFieldRepairable(const AStarField* field, const AStarGrid* grid) {
+    unsigned int version = grid->version;
+    unsigned int i = grid->changeCount;
+
+    if (!field->distances || field->grid != grid || field->size != grid->size) {
+        return 0;
+    }
+
+    // Walk back through the changes until we get to the field's version.
+    while (version != field->version) {
+        const GridChange* change;
+        if (!i || grid->changeCount - i >= GRID_CHANGE_LOG) {
+            // Not remembered anymore.
+            return 0;
+        }
+        change = &grid->changes[--i % GRID_CHANGE_LOG];
+        if (change->version != version || !change->passable) {
+            return 0;
+        }
+        version = change->previous;
+    }
+    return 1;
+}
+
+/** Makes sure the list of invalidated cells can hold another entry */
+static void ensureInvalidCapacity(AStarField* field) {
+    if (field->invalidCount >= field->invalidCapacity) {
+        field->invalidCapacity = field->invalidCapacity * 2 + 16;
+        if (!(field->invalid = realloc(field->invalid, field->invalidCapacity * sizeof (unsigned int)))) {
+            fprintf(stderr, "Out of memory while resizing A* field cell list.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/** Opens a cell with the specified distance, if that's better than its current one */
+static void seedField(AStarContext* context, AStarField* field,
+                      unsigned int x, unsigned int y, float distance, unsigned int source) {
+    const unsigned int cell = y * field->size + x;
+    PathNode* node;
+
+    if (distance >= field->distances[cell]) {
+        return;
+    }
+    field->distances[cell] = distance;
+    field->sources[cell] = source;
+
+    if (!(node = getNode(context, x, y))) {
+        ensureNodeCapacity(context, 1);
+        node = newNode(context, x, y);
+    }
+    node->gscore = distance;
+    node->fscore = distance;
+    node->came_from = 0;
+    node->steps = 1;
+    if (node->heapIndex == NODE_CLOSED) {
+        pushOpenNode(context, node);
+    } else {
+        siftUp(context, node->heapIndex);
+    }
+}
+
+/**
+ * Runs Dijkstra from the opened cells, updating all cells that get closer to
+ * a target than they were. Each cell inherits the target of the cell it was
+ * reached from.
+ */
+static void propagateField(AStarContext* context, AStarField* field) {
+    const unsigned int size = field->size;
+
+    while (context->openSetCount > 0) {
+        // Copy what we need, relaxing may move the node list.
+        const PathNode* current = popOpenNodeToClosedSet(context);
+        const unsigned int currentIndex = current - context->nodes;
+        const unsigned int cx = current->x;
+        const unsigned int cy = current->y;
+        const float cg = current->gscore;
+        const unsigned int source = field->sources[cy * size + cx];
+
+        for (int dy = -1; dy <= 1; ++dy) {
+            for (int dx = -1; dx <= 1; ++dx) {
+                const unsigned int x = cx + dx;
+                const unsigned int y = cy + dy;
+
+                // Skip self, out of bounds cells are never passable.
+                if (!dx && !dy) {
+                    continue;
+                }
+
+                // Only if this block is passable and the two diagonal ones are.
+                if (!isPassable(context, x, y) ||
+                    (!isPassable(context, x, cy) && !isPassable(context, cx, y))) {
+                    continue;
+                }
+
+                {
+                    const unsigned int cell = y * size + x;
+                    const float distance = cg + ((dx && dy) ? SQRT2 : 1.0f);
+                    if (distance < field->distances[cell]) {
+                        field->distances[cell] = distance;
+                        field->sources[cell] = source;
+                        relaxNode(context, currentIndex, x, y, distance, distance);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/** Opens a cell with the best distance it can be reached with from its neighbors */
+static void seedFieldFromNeighbors(AStarContext* context, AStarField* field,
+                                   unsigned int cx, unsigned int cy) {
+    const unsigned int size = field->size;
+
+    if (!isPassable(context, cx, cy)) {
+        return;
+    }
+
+    for (int dy = -1; dy <= 1; ++dy) {
+        for (int dx = -1; dx <= 1; ++dx) {
+            const unsigned int x = cx + dx;
+            const unsigned int y = cy + dy;
+
+            // Same movement rules as when propagating, in reverse.
+            if ((!dx && !dy) || !isPassable(context, x, y) ||
+                (!isPassable(context, x, cy) && !isPassable(context, cx, y)) ||
+                field->sources[y * size + x] == NO_LINK) {
+                continue;
+            }
+
+            seedField(context, field, cx, cy,
+                      field->distances[y * size + x] + ((dx && dy) ? SQRT2 : 1.0f),
+                      field->sources[y * size + x]);
+        }
+    }
+}
+
+/** Opens a target's cell, if it is in bounds and passable */
+static void seedFieldTarget(AStarContext* context, AStarField* field, unsigned int index) {
+    FieldTarget* target = &field->targets[index];
+    target->seeded = 1;
+    if (target->position.v[0] >= 0 && target->position.v[1] >= 0 &&
+        testGrid(field->grid, toLocal(target->position.v[0]), toLocal(target->position.v[1]))) {
+        seedField(context, field, toLocal(target->position.v[0]), toLocal(target->position.v[1]), 0.0f, index);
+    }
+}
+
+/** Drops removed targets from the target list, filling in the remap table */
+static void compactFieldTargets(AStarField* field) {
+    unsigned int count = 0;
+    for (unsigned int i = 0; i < field->targetCount; ++i) {
+        if (field->targets[i].removed) {
+            field->remap[i] = NO_LINK;
+        } else {
+            field->remap[i] = count;
+            field->targets[count++] = field->targets[i];
+        }
+    }
+    field->targetCount = count;
+}
+
+/** Computes all distances from scratch */
+static void rebuildField(AStarContext* context, AStarField* field, const AStarGrid* grid) {
+    const unsigned int cellCount = grid->size * grid->size;
+
+    // Ensure size of the distance tables is sufficient.
+    if (!field->distances || field->size != grid->size) {
+        free(field->distances);
+        free(field->sources);
+        field->size = grid->size;
+        if (!(field->distances = malloc(cellCount * sizeof (float))) ||
+            !(field->sources = malloc(cellCount * sizeof (unsigned int)))) {
+            fprintf(stderr, "Out of memory while allocating A* field distances.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    field->grid = grid;
+    field->version = grid->version;
+
+    for (unsigned int i = 0; i < cellCount; ++i) {
+        field->distances[i] = FLT_MAX;
+        field->sources[i] = NO_LINK;
+    }
+
+    compactFieldTargets(field);
+
+    beginSearch(context);
+    for (unsigned int i = 0; i < field->targetCount; ++i) {
+        seedFieldTarget(context, field, i);
+    }
+    propagateField(context, field);
+}
+
+/**
+ * Applies added and removed targets, as well as blocks that became passable,
+ * to the distances. Cells that lost their target are reset, and then filled
+ * in again from their neighbors. See isFieldRepairable.
+ */
+static void patchField(AStarContext* context, AStarField* field, const AStarGrid* grid) {
+    const unsigned int size = field->size;
+    const unsigned int cellCount = size * size;
+    const unsigned int oldCount = field->targetCount;
+
+    compactFieldTargets(field);
+
+    // Reset cells whose target was removed, and update the others' indices.
+    field->invalidCount = 0;
+    if (field->targetCount < oldCount) {
+        for (unsigned int i = 0; i < cellCount; ++i) {
+            const unsigned int source = field->sources[i];
+            if (source == NO_LINK) {
+                continue;
+            }
+            if ((field->sources[i] = field->remap[source]) == NO_LINK) {
+                field->distances[i] = FLT_MAX;
+                ensureInvalidCapacity(field);
+                field->invalid[field->invalidCount++] = i;
+            }
+        }
+    }
+
+    beginSearch(context);
+
+    // Targets sharing a cell with a removed one lost their cell, too.
+    if (field->invalidCount) {
+        for (unsigned int i = 0; i < field->targetCount; ++i) {
+            const FieldTarget* target = &field->targets[i];
+            unsigned int x, y;
+            if (!target->seeded || target->position.v[0] < 0 || target->position.v[1] < 0) {
+                continue;
+            }
+            x = toLocal(target->position.v[0]);
+            y = toLocal(target->position.v[1]);
+            if (x < size && y < size && field->sources[y * size + x] == NO_LINK) {
+                seedFieldTarget(context, field, i);
+            }
+        }
+    }
+
+    // Reset cells can be reached from their neighbors that still have a target.
+    for (unsigned int i = 0; i < field->invalidCount; ++i) {
+        seedFieldFromNeighbors(context, field, field->invalid[i] % size, field->invalid[i] / size);
+    }
+
+    // Blocks that became passable can be reached from their neighbors, and
+    // may also open up diagonal moves between their neighbors.
+    for (unsigned int i = grid->changeCount, version = grid->version; version != field->version; ) {
+        const GridChange* change = &grid->changes[--i % GRID_CHANGE_LOG];
+        const unsigned int x0 = change->x * ASTAR_GRANULARITY;
+        const unsigned int y0 = change->y * ASTAR_GRANULARITY;
+        for (unsigned int y = y0 - 1; y != y0 + ASTAR_GRANULARITY + 1; ++y) {
+            for (unsigned int x = x0 - 1; x != x0 + ASTAR_GRANULARITY + 1; ++x) {
+                seedFieldFromNeighbors(context, field, x, y);
+            }
+        }
+
+        // Targets in the block couldn't be reached before.
+        for (unsigned int j = 0; j < field->targetCount; ++j) {
+            const FieldTarget* target = &field->targets[j];
+            if (target->seeded && target->position.v[0] >= 0 && target->position.v[1] >= 0 &&
+                (unsigned int) target->position.v[0] == change->x &&
+                (unsigned int) target->position.v[1] == change->y) {
+                seedFieldTarget(context, field, j);
+            }
+        }
+
+        version = change->previous;
+    }
+    field->version = grid->version;
+
+    // And new targets are reached from themselves.
+    for (unsigned int i = 0; i < field->targetCount; ++i) {
+        if (!field->targets[i].seeded) {
+            seedFieldTarget(context, field, i);
+        }
+    }
+
+    propagateField(context, field);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Landmarks
+///////////////////////////////////////////////////////////////////////////////
+
+/** Tests whether a landmark's distances can be used for the specified grid */
+inline static int isLandmarkValid(const AStarField* field, const AStarGrid* grid) {
+    return isFieldValid(field, grid) && field->targetCount;
+}
+
+/**
+ * Picks the passable cell farthest from the other usable landmarks, i.e. the
+ * one with the longest distance to the nearest of them. Cells none of them
+ * can reach count as the farthest, so landmarks spread over all components.
+ * Without other landmarks this is the cell farthest from the center.
+ * @return the cell, as y * size + x, or NO_LINK if no cell is passable.
+ */
+static unsigned int findLandmarkCell(const AStarLandmarks* landmarks, unsigned int index,
+                                     const AStarGrid* grid) {
+    const unsigned int size = grid->size;
+    unsigned int result = NO_LINK, others = 0;
+    float best = -1.0f;
+
+    for (unsigned int i = 0; i < landmarks->count; ++i) {
+        if (i != index && isLandmarkValid(&landmarks->fields[i], grid)) {
+            ++others;
+        }
+    }
+
+    for (unsigned int y = 0; y < size; ++y) {
+        for (unsigned int x = 0; x < size; ++x) {
+            float nearest = FLT_MAX;
+            if (!testGrid(grid, x, y)) {
+                continue;
+            }
+            if (others) {
+                for (unsigned int i = 0; i < landmarks->count; ++i) {
+                    const AStarField* field = &landmarks->fields[i];
+                    if (i != index && isLandmarkValid(field, grid) &&
+                        field->distances[y * size + x] < nearest) {
+                        nearest = field->distances[y * size + x];
+                    }
+                }
+            } else {
+                nearest = h(x, y, size / 2, size / 2);
+            }
+            if (nearest > best) {
+                best = nearest;
+                result = y * size + x;
+            }
+        }
+    }
+
+    return result;
+}
+
+/** Moves a landmark away from the others, and computes its distances */
+static void rebuildLandmark(AStarContext* context, AStarLandmarks* landmarks, unsigned int index,
+                            const AStarGrid* grid) {
+    AStarField* field = &landmarks->fields[index];
+    const unsigned int cell = findLandmarkCell(landmarks, index, grid);
+
+    AS_RemoveFieldTarget(field, NULL);
+    if (cell != NO_LINK) {
+        vec2 position;
+        position.d.x = toGlobal(cell % grid->size);
+        position.d.y = toGlobal(cell / grid->size);
+        AS_AddFieldTarget(field, &position, NULL);
+    }
+    rebuildField(context, field, grid);
+    field->changed = 0;
+}
+
+/** Gets the landmarks usable for a search to the specified goal */
+static void beginLandmarks(AStarContext* context, unsigned int gx, unsigned int gy) {
+    const AStarLandmarks* landmarks = context->landmarks;
+
+    context->landmarkCount = 0;
+    if (!landmarks || !context->grid) {
+        return;
+    }
+
+    // Ensure size of the landmark lists is sufficient.
+    if (landmarks->count > context->landmarkCapacity) {
+        context->landmarkCapacity = landmarks->count;
+        if (!(context->landmarkDistances = realloc(context->landmarkDistances, context->landmarkCapacity * sizeof (float*))) ||
+            !(context->landmarkGoals = realloc(context->landmarkGoals, context->landmarkCapacity * sizeof (float)))) {
+            fprintf(stderr, "Out of memory while resizing A* landmark lists.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Skip landmarks that are out of date or can't reach the goal.
+    for (unsigned int i = 0; i < landmarks->count; ++i) {
+        const AStarField* field = &landmarks->fields[i];
+        if (isLandmarkValid(field, context->grid) &&
+            field->distances[gy * field->size + gx] < FLT_MAX) {
+            context->landmarkDistances[context->landmarkCount] = field->distances;
+            context->landmarkGoals[context->landmarkCount] = field->distances[gy * field->size + gx];
+            ++context->landmarkCount;
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Header implementation
+///////////////////////////////////////////////////////////////////////////////
+
+AStarContext* AS_NewContext(void) {
+    AStarContext* context;
+    if (!(context = calloc(1, sizeof (AStarContext)))) {
+        fprintf(stderr, "Out of memory while allocating A* context.\n");
+        exit(EXIT_FAILURE);
+    }
+    context->bidirectional = ASTAR_BIDIRECTIONAL;
+    return context;
+}
+
+void AS_DeleteContext(AStarContext* context) {
+    if (context) {
+        free(context->cells);
+        free(context->nodes);
+        free(context->openSet);
+        free(context->entranceCosts);
+        free(context->waypoints);
+        free(context->refined);
+        free(context->targets);
+        BS_Delete(context->targetCells);
+        free(context->landmarkDistances);
+        free(context->landmarkGoals);
+        AS_DeleteContext(context->reverse);
+        AS_DeleteContext(context->local);
+        free(context);
+    }
+}
+
+void AS_SetSearchBudget(AStarContext* context, unsigned int budget) {
+    assert(context);
+
+    context->budget = budget;
+    context->limited = budget > 0;
+}
+
+unsigned int AS_GetSearchBudget(const AStarContext* context) {
+    assert(context);
+
+    return context->limited ? context->budget : 0;
+}
+
+void AS_SetSearchBidirectional(AStarContext* context, int enabled) {
+    assert(context);
+
+    context->bidirectional = enabled != 0;
+}
+
+int AS_IsSearchBidirectional(const AStarContext* context) {
+    assert(context);
+
+    return context->bidirectional;
+}
+
+void AS_SetSearchLandmarks(AStarContext* context, const AStarLandmarks* landmarks) {
+    assert(context);
+
+    context->landmarks = landmarks;
+}
+
+void AS_SetSearchPolicy(AStarContext* context, AStarPolicy policy, float factor) {
+    assert(context);
+    assert(policy >= ASTAR_POLICY_DEFAULT && policy < ASTAR_POLICY_COUNT);
+    assert(policy != ASTAR_POLICY_WEIGHTED || factor >= 1.0f);
+    assert(policy != ASTAR_POLICY_FOCAL || factor >= 0.0f);
+
+    context->policy = policy;
+    context->factor = factor;
+}
+
+AStarPolicy AS_GetSearchPolicy(const AStarContext* context, float* factor) {
+    assert(context);
+
+    if (factor) {
+        *factor = context->factor;
+    }
+    return context->policy;
+}
+
+unsigned long AS_GetSearchExpansions(const AStarContext* context) {
+    assert(context);
+
+    return context->expanded;
+}
+
+AStarGrid* AS_NewGrid(unsigned int bounds) {
+    AStarGrid* grid;
+    if (!(grid = calloc(1, sizeof (AStarGrid)))) {
+        fprintf(stderr, "Out of memory while allocating A* grid.\n");
+        exit(EXIT_FAILURE);
+    }
+    grid->size = bounds * ASTAR_GRANULARITY;
+    grid->stride = (grid->size + GRID_WORD_BITS - 1) / GRID_WORD_BITS;
+    grid->version = ++gGridVersion;
+    if (grid->size && (!(grid->bits = calloc(grid->size * grid->stride, sizeof (unsigned int))) ||
+                       !(grid->columns = calloc(grid->size * grid->stride, sizeof (unsigned int))) ||
+                       !(grid->labels = calloc(bounds * bounds, sizeof (unsigned int))) ||
+                       !(grid->marks = calloc(bounds * bounds, sizeof (unsigned int))))) {
+        fprintf(stderr, "Out of memory while allocating A* grid data.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Label zero marks blocked blocks.
+    grid->labelCount = 1;
+    return grid;
+}
+
+void AS_DeleteGrid(AStarGrid* grid) {
+    if (grid) {
+        free(grid->bits);
+        free(grid->columns);
+        free(grid->jumps);
+        free(grid->dirty);
+        free(grid->labels);
+        free(grid->parents);
+        free(grid->ranks);
+        free(grid->marks);
+        for (unsigned int i = 0; i < 4; ++i) {
+            free(grid->floods[i].blocks);
+        }
+        free(grid);
+    }
+}
+
+int AS_SetGridJumpTables(AStarGrid* grid, int enabled) {
+    assert(grid);
+
+    if (!enabled || grid->size > SHRT_MAX) {
+        // Disabled, or jump distances might not fit.
+        free(grid->jumps);
+        grid->jumps = NULL;
+        return 0;
+    }
+
+    if (!grid->jumps && grid->size) {
+        if (!(grid->jumps = calloc(grid->size * grid->size * JUMP_DIRECTIONS, sizeof (short)))) {
+            fprintf(stderr, "Out of memory while allocating A* jump tables.\n");
+            exit(EXIT_FAILURE);
+        }
+        buildJumps(grid);
+    }
+    return 1;
+}
+
+void AS_SetGridPassable(AStarGrid* grid, unsigned int x, unsigned int y, int passable) {
+    int changed = 0;
+
+    assert(grid);
+    assert(x * ASTAR_GRANULARITY < grid->size);
+    assert(y * ASTAR_GRANULARITY < grid->size);
+
+    // Each block covers a square of cells in the grid.
+    for (unsigned int ly = y * ASTAR_GRANULARITY; ly < (y + 1) * ASTAR_GRANULARITY; ++ly) {
+        for (unsigned int lx = x * ASTAR_GRANULARITY; lx < (x + 1) * ASTAR_GRANULARITY; ++lx) {
+            unsigned int* word = &grid->bits[ly * grid->stride + lx / GRID_WORD_BITS];
+            unsigned int* column = &grid->columns[lx * grid->stride + ly / GRID_WORD_BITS];
+            const unsigned int mask = 1u << (lx % GRID_WORD_BITS);
+            const unsigned int columnMask = 1u << (ly % GRID_WORD_BITS);
+            const unsigned int old = *word;
+            if (passable) {
+                *word |= mask;
+                *column |= columnMask;
+            } else {
+                *word &= ~mask;
+                *column &= ~columnMask;
+            }
+            changed = changed || *word != old;
+        }
+    }
+
+    // Nothing else to do if the block's passability didn't actually change.
+    if (!changed) {
+        return;
+    }
+
+    // Remember the change, so fields can be repaired instead of rebuilt.
+    {
+        GridChange* change = &grid->changes[grid->changeCount++ % GRID_CHANGE_LOG];
+        change->x = x;
+        change->y = y;
+        change->passable = passable;
+        change->previous = grid->version;
+        change->version = grid->version = ++gGridVersion;
+    }
+
+    // Keep components up to date.
+    if (passable) {
+        joinBlock(grid, y * (grid->size / ASTAR_GRANULARITY) + x);
+    } else {
+        splitBlock(grid, y * (grid->size / ASTAR_GRANULARITY) + x);
+    }
+
+    // Fix up jump tables, if we have them.
+    if (grid->jumps) {
+        repairJumps(grid, x * ASTAR_GRANULARITY, y * ASTAR_GRANULARITY,
+                    (x + 1) * ASTAR_GRANULARITY - 1, (y + 1) * ASTAR_GRANULARITY - 1);
+    }
+}
+
+int AS_IsGridConnected(const AStarGrid* grid, const vec2* start, const vec2* goal) {
+    assert(grid);
+    assert(start);
+    assert(goal);
+
+    // Check the sign first, because truncation rounds to zero.
+    if (start->v[0] < 0 || start->v[1] < 0 || goal->v[0] < 0 || goal->v[1] < 0 ||
+        !testGrid(grid, toLocal(start->v[0]), toLocal(start->v[1])) ||
+        !testGrid(grid, toLocal(goal->v[0]), toLocal(goal->v[1]))) {
+        return 0;
+    }
+
+    return getComponent(grid, toLocal(start->v[0]), toLocal(start->v[1])) ==
+            getComponent(grid, toLocal(goal->v[0]), toLocal(goal->v[1]));
+}
+
+unsigned int AS_GetGridComponent(const AStarGrid* grid, const vec2* position) {
+    assert(grid);
+    assert(position);
+
+    // Check the sign first, because truncation rounds to zero.
+    if (position->v[0] < 0 || position->v[1] < 0 ||
+        !testGrid(grid, toLocal(position->v[0]), toLocal(position->v[1]))) {
+        return 0;
+    }
+
+    return getComponent(grid, toLocal(position->v[0]), toLocal(position->v[1]));
+}
+
+unsigned int AS_GetGridVersion(const AStarGrid* grid) {
+    assert(grid);
+
+    return grid->version;
+}
+
+int AS_IsGridLineClear(const AStarGrid* grid, const vec2* from, const vec2* to) {
+    AStarContext context = {0};
+
+    assert(grid);
+    assert(from);
+    assert(to);
+
+    // Check the sign first, because truncation rounds to zero.
+    if (from->v[0] < 0 || from->v[1] < 0 || to->v[0] < 0 || to->v[1] < 0) {
+        return 0;
+    }
+
+    // Line of sight checks only read the grid. The cells crossed depend on
+    // the direction, and paths are pruned in either one, so try both.
+    context.grid = grid;
+    context.gridSize = grid->size;
+    return isInLineOfSight(&context, toLocal(from->v[0]), toLocal(from->v[1]),
+                           toLocal(to->v[0]), toLocal(to->v[1])) ||
+            isInLineOfSight(&context, toLocal(to->v[0]), toLocal(to->v[1]),
+                            toLocal(from->v[0]), toLocal(from->v[1]));
+}
+
+/**
+ * Adds the neighbors of a node that was just moved to the closed set to the
+ * open set, or updates them if we found a shorter way to them. In
+ * bidirectional searches this also remembers the shortest path over a cell
+ * the search in the other direction reached, too.
+ * @param currentIndex the index of the node to expand.
+ * @param gx the goal x coordinate in A* space.
+ * @param gy the goal y coordinate in A* space.
+ * @param other the context searching in the other direction, if any.
+ * @param backwards whether this context is the one searching backwards.
+ */
+static void expandNode(AStarContext* context, unsigned int currentIndex,
+                       unsigned int gx, unsigned int gy,
+                       AStarContext* other, int backwards) {
+    unsigned int begin_x, begin_y, end_x, end_y, neighbor_x, neighbor_y;
+    int x, y;
+    float gscore, fscore;
+    PathNode *current = &context->nodes[currentIndex], *node;
+
+    // Check our neighbors. Determine which neighbors we actually need to
+    // check based on the direction we came from. Per default enable all.
+    begin_x = clamp(context, current->x - 1);
+    begin_y = clamp(context, current->y - 1);
+    end_x = clamp(context, current->x + 1);
+    end_y = clamp(context, current->y + 1);
+
+    // Check if we have a direction, i.e. we came from somewhere. The
+    // exception is the start node, where we'll have to check all neighbors.
+    if (current->came_from) {
+        // Compute the direction as an integer of {-1, 0, 1} for both axii.
+        const int dx = current->x - context->nodes[current->came_from - 1].x,
+                dy = current->y - context->nodes[current->came_from - 1].y;
+
+        // If we're only moving to the right we don't have to check left. If
+        // we're also moving vertically, though, we need to check for an
+        // obstacle (forced neighbors), which we do via the passable check.
+        // This works analogous for all other movement directions.
+        if (dx >= 0 && isPassable(context, current->x - 1, current->y)) {
+            // Don't have to check to the left.
+            begin_x = current->x;
+        } else if (dx <= 0 && isPassable(context, current->x + 1, current->y)) {
+            // Don't have to check to the right.
+            end_x = current->x;
+        }
+        if (dy >= 0 && isPassable(context, current->x, current->y - 1)) {
+            // Don't have to check up.
+            begin_y = current->y;
+        } else if (dy <= 0 && isPassable(context, current->x, current->y + 1)) {
+            // Don't have to check down.
+            end_y = current->y;
+        }
+    }
+
+    // Make sure adding neighbors won't move the node list in memory,
+    // which would invalidate our current node pointer.
+    ensureNodeCapacity(context, 8);
+    current = &context->nodes[currentIndex];
+
+    // Now work through all our selected neighbors.
+    for (neighbor_x = begin_x; neighbor_x <= end_x; ++neighbor_x) {
+        for (neighbor_y = begin_y; neighbor_y <= end_y; ++neighbor_y) {
+            // Skip self.
+            if (neighbor_x == current->x && neighbor_y == current->y) {
+                continue;
+            }
+
+            // The actual node to be inspected.
+            x = neighbor_x, y = neighbor_y;
+
+#if ASTAR_JPS
+            // Try this direction using jump point search, with table
+            // lookups or block scans if we have a grid.
+            if (context->grid) {
+                if (!jumpGridSearch(context->grid, &x, &y, x - current->x, y - current->y,
+                                    current->x, current->y, gx, gy)) {
+                    // Failed, try next neighbor.
+                    continue;
+                }
+            } else if (!jumpPointSearch(context, &x, &y, x - current->x, y - current->y, x, y, gx, gy)) {
+                // Failed, try next neighbor.
+                continue;
+            }
+#else
+            // If we already handled this one, skip it.
+            if (isClosed(context, x, y)) {
+                continue;
+            }
+
+            // Only if this block is passable and the two diagonal ones are.
+            if (!isPassable(context, x, y) ||
+                (!isPassable(context, x, current->y) && !isPassable(context, current->x, y))) {
+                continue;
+            }
+#endif
+
+            // Determine score - score to current node plus that to this
+            // neighbor. This is the actual traveled distance (Euclidean
+            // distance -- we do an actual computation here, because we
+            // might have skipped some tiles).
+            gscore = current->gscore +
+                    h(x, y, current->x, current->y);
+
+            // Compute the heuristic cost for a path with this waypoint.
+            fscore = score(context, gscore, x, y, gx, gy);
+
+            // See if we already know that neighbor. If it's in the open
+            // set with a better score skip it, otherwise update it in
+            // place (decrease-key). Create it if we don't know it yet.
+            if ((node = getNode(context, x, y))) {
+                if (node->heapIndex == NODE_CLOSED || node->gscore <= gscore) {
+                    // Skip it, it has a better score.
+                    continue;
+                }
+            } else {
+                node = newNode(context, x, y);
+            }
+
+            // Remember where we came from and how deep the path is.
+            node->came_from = currentIndex + 1;
+            node->steps = current->steps + 1;
+
+            // Also keep the scores, g for continuous computation, f for
+            // sorting.
+            node->gscore = gscore;
+            node->fscore = fscore;
+
+            // Insert into open set, or restore heap order if it already
+            // was in there.
+            if (node->heapIndex == NODE_CLOSED) {
+                pushOpenNode(context, node);
+            } else {
+                siftUp(context, node->heapIndex);
+            }
+
+            // If the other direction got here, too, we have a path.
+            if (other) {
+                const PathNode* meet = getNode(other, x, y);
+                AStarContext* forward = backwards ? other : context;
+                if (meet && gscore + meet->gscore < forward->meetCost) {
+                    forward->meetCost = gscore + meet->gscore;
+                    forward->meetNode = backwards ? (unsigned int) (meet - other->nodes) : (unsigned int) (node - context->nodes);
+                    forward->meetReverseNode = backwards ? (unsigned int) (node - context->nodes) : (unsigned int) (meet - other->nodes);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Builds the path over the cell where the searches from both ends met, by
+ * appending the nodes of the backwards search to those of the forward one,
+ * and writes it out like a regular search would.
+ */
+static int joinPaths(AStarContext* context, vec2* path, unsigned int* depth, float* length) {
+    const AStarContext* reverse = context->reverse;
+    const PathNode* node = &reverse->nodes[context->meetReverseNode];
+    unsigned int tailIndex = context->meetNode;
+
+    // Follow the backwards search to the goal, linking each of its nodes to
+    // the one before it on the way there.
+    ensureNodeCapacity(context, node->steps);
+    while (node->came_from) {
+        PathNode* tail;
+        node = &reverse->nodes[node->came_from - 1];
+        tail = newNode(context, node->x, node->y);
+        tail->came_from = tailIndex + 1;
+        tail->steps = context->nodes[tailIndex].steps + 1;
+        tailIndex = tail - context->nodes;
+    }
+
+    // This prunes the joined path like any other.
+    return isGoal(context, path, depth, length, &context->nodes[tailIndex],
+                  toLocal(context->goal.v[0]), toLocal(context->goal.v[1]));
+}
+
+/** Continues a search from both ends, see AS_SetSearchBidirectional */
+static int continueBidirectionalSearch(AStarContext* context, vec2* path, unsigned int* depth, float* length) {
+    AStarContext* reverse = context->reverse;
+    const unsigned int sx = toLocal(context->start.v[0]);
+    const unsigned int sy = toLocal(context->start.v[1]);
+    const unsigned int gx = toLocal(context->goal.v[0]);
+    const unsigned int gy = toLocal(context->goal.v[1]);
+
+    context->suspended = 0;
+    while (context->openSetCount > 0 && reverse->openSetCount > 0) {
+        PathNode* current;
+
+        // Any shorter path has to pass through the open sets of both sides,
+        // so we're done once either side can't find anything shorter than
+        // the best path over a cell both sides reached so far.
+        if (context->nodes[context->openSet[0]].fscore >= context->meetCost ||
+            reverse->nodes[reverse->openSet[0]].fscore >= context->meetCost) {
+            break;
+        }
+
+        // Stop here if we're out of budget, see continueSearch.
+        if (context->limited) {
+            if (!context->budget) {
+                context->suspended = 1;
+                return ASTAR_PENDING;
+            }
+            --context->budget;
+        }
+
+        // Expand the side with fewer open nodes, which is the one that is
+        // spreading out less.
+        if (context->openSetCount <= reverse->openSetCount) {
+            current = popNextNodeToClosedSet(context);
+            expandNode(context, current - context->nodes, gx, gy, reverse, 0);
+        } else {
+            ++context->expanded;
+            current = popNextNodeToClosedSet(reverse);
+            expandNode(reverse, current - reverse->nodes, sx, sy, context, 1);
+        }
+    }
+
+    // Either we found a path over some cell, or one side ran out of nodes
+    // without ever reaching one of the other side.
+    if (context->meetCost < FLT_MAX) {
+        return joinPaths(context, path, depth, length);
+    }
+    return 0;
+}
+
+/** Runs a search until it's done or out of budget, keeping its state */
+static int continueSearch(AStarContext* context, vec2* path, unsigned int* depth, float* length) {
+    const vec2* goal = &context->goal;
+    unsigned int gx, gy;
+    PathNode* current;
+
+    if (context->meeting) {
+        return continueBidirectionalSearch(context, path, depth, length);
+    }
+
+    // Get goal in local coordinates.
+    gx = toLocal(goal->v[0]);
+    gy = toLocal(goal->v[1]);
+
+    // Do the actual search.
+    context->suspended = 0;
+    while (context->openSetCount > 0) {
+        // Stop here if we're out of budget, the open and closed sets stay
+        // as they are, so we can pick up where we left off.
+        if (context->limited) {
+            if (!context->budget) {
+                context->suspended = 1;
+                return ASTAR_PENDING;
+            }
+            --context->budget;
+        }
+
+        // Move the next open entry to the closed set, which is the best one
+        // unless this is a focal search.
+        current = popNextNodeToClosedSet(context);
+
+        // Check if we're there yet.
+        if (isGoal(context, path, depth, length, current, gx, gy)) {
+            return 1;
+        }
+
+        expandNode(context, current - context->nodes, gx, gy, NULL, 0);
+    }
+
+    return 0;
+}
+
+/** Runs a search after the passability source has been set up */
+static int search(AStarContext* context, const vec2* start, const vec2* goal,
+                  vec2* path, unsigned int* depth, float* length) {
+    PathNode* node;
+
+    // Prepare the node sets for the search, and remember where we're going
+    // in case the search gets suspended.
+    beginSearch(context);
+    beginLandmarks(context, toLocal(goal->v[0]), toLocal(goal->v[1]));
+    context->start = *start;
+    context->goal = *goal;
+
+    // Initialize the first open node to the one we're starting from.
+    ensureNodeCapacity(context, 1);
+    node = newNode(context, toLocal(start->v[0]), toLocal(start->v[1]));
+    node->gscore = 0.0f;
+    node->fscore = 0.0f;
+    node->came_from = 0;
+    node->steps = 1;
+    pushOpenNode(context, node);
+
+    // Set up the search from the other end, using the same passability.
+    context->meeting = context->bidirectional;
+    if (context->meeting) {
+        AStarContext* reverse = context->reverse;
+        if (!reverse) {
+            reverse = context->reverse = AS_NewContext();
+        }
+        reverse->grid = context->grid;
+        reverse->passable = context->passable;
+        reverse->userdata = context->userdata;
+        reverse->gridSize = context->gridSize;
+        reverse->landmarks = context->landmarks;
+        reverse->policy = context->policy;
+        reverse->factor = context->factor;
+        beginSearch(reverse);
+        beginLandmarks(reverse, toLocal(start->v[0]), toLocal(start->v[1]));
+
+        ensureNodeCapacity(reverse, 1);
+        node = newNode(reverse, toLocal(goal->v[0]), toLocal(goal->v[1]));
+        node->gscore = 0.0f;
+        node->fscore = 0.0f;
+        node->came_from = 0;
+        node->steps = 1;
+        pushOpenNode(reverse, node);
+
+        // Start and goal may share a cell, then we're done right away.
+        context->meetCost = FLT_MAX;
+        if (getNode(context, node->x, node->y)) {
+            context->meetCost = 0.0f;
+            context->meetNode = 0;
+            context->meetReverseNode = 0;
+        }
+    }
+
+    return continueSearch(context, path, depth, length);
+}
+
+int AS_Search(AStarContext* context, const vec2* start, const vec2* goal,
+              AStarPassableCallback passable, const void* userdata,
+              unsigned int bounds, vec2* path, unsigned int* depth, float* length) {
+    assert(context);
+    assert(start);
+    assert(goal);
+
+    // We need a passability method.
+    if (!passable) {
+        return 0;
+    }
+
+    // Check if the start and target position are valid (passable).
+    if (!passable(userdata, start->v[0], start->v[1]) ||
+        !passable(userdata, goal->v[0], goal->v[1])) {
+        return 0;
+    }
+
+    // Remember passability check method.
+    context->grid = NULL;
+    context->passable = passable;
+    context->userdata = userdata;
+
+    // Set grid bounds.
+    context->gridSize = bounds * ASTAR_GRANULARITY;
+
+    return search(context, start, goal, path, depth, length);
+}
+
+int AS_SearchGrid(AStarContext* context, const vec2* start, const vec2* goal,
+                  const AStarGrid* grid, vec2* path, unsigned int* depth, float* length) {
+    assert(context);
+    assert(start);
+    assert(goal);
+    assert(grid);
+
+    // Check if the start and target position are valid (in bounds and
+    // passable). Check the sign first, because truncation rounds to zero.
+    if (start->v[0] < 0 || start->v[1] < 0 || goal->v[0] < 0 || goal->v[1] < 0 ||
+        !testGrid(grid, toLocal(start->v[0]), toLocal(start->v[1])) ||
+        !testGrid(grid, toLocal(goal->v[0]), toLocal(goal->v[1]))) {
+        return 0;
+    }
+
+    // Don't bother searching if the goal can't be reached.
+    if (getComponent(grid, toLocal(start->v[0]), toLocal(start->v[1])) !=
+        getComponent(grid, toLocal(goal->v[0]), toLocal(goal->v[1]))) {
+        return 0;
+    }
+
+    // Read passability directly from the grid.
+    context->grid = grid;
+    context->passable = NULL;
+    context->userdata = NULL;
+
+    // Set grid bounds.
+    context->gridSize = grid->size;
+
+    return search(context, start, goal, path, depth, length);
+}
+
+AStarHierarchy* AS_NewHierarchy(const AStarGrid* grid) {
+    AStarHierarchy* hierarchy;
+
+    assert(grid);
+
+    if (!(hierarchy = calloc(1, sizeof (AStarHierarchy)))) {
+        fprintf(stderr, "Out of memory while allocating A* hierarchy.\n");
+        exit(EXIT_FAILURE);
+    }
+    hierarchy->grid = grid;
+    hierarchy->size = (grid->size + CLUSTER_CELLS - 1) / CLUSTER_CELLS;
+    if (hierarchy->size) {
+        const unsigned int count = hierarchy->size * hierarchy->size;
+        if (!(hierarchy->clusters = calloc(count, sizeof (Cluster))) ||
+            !(hierarchy->dirty = malloc(count * sizeof (char)))) {
+            fprintf(stderr, "Out of memory while allocating A* clusters.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        // Everything has to be built on the first update.
+        memset(hierarchy->dirty, 1, count * sizeof (char));
+        hierarchy->dirtyCount = count;
+    }
+    return hierarchy;
+}
+
+void AS_DeleteHierarchy(AStarHierarchy* hierarchy) {
+    if (hierarchy) {
+        for (unsigned int i = 0; i < hierarchy->size * hierarchy->size; ++i) {
+            free(hierarchy->clusters[i].entrances);
+            free(hierarchy->clusters[i].links);
+            free(hierarchy->clusters[i].distances);
+        }
+        free(hierarchy->clusters);
+        free(hierarchy->dirty);
+        free(hierarchy);
+    }
+}
+
+void AS_MarkHierarchyDirty(AStarHierarchy* hierarchy, unsigned int x, unsigned int y) {
+    // Cells covered by the block, grown by one because entrances depend on
+    // the cells on both sides of a cluster border.
+    const unsigned int last = hierarchy->grid->size - 1;
+    const unsigned int x0 = x * ASTAR_GRANULARITY > 0 ? x * ASTAR_GRANULARITY - 1 : 0;
+    const unsigned int y0 = y * ASTAR_GRANULARITY > 0 ? y * ASTAR_GRANULARITY - 1 : 0;
+    const unsigned int x1 = (x + 1) * ASTAR_GRANULARITY < last ? (x + 1) * ASTAR_GRANULARITY : last;
+    const unsigned int y1 = (y + 1) * ASTAR_GRANULARITY < last ? (y + 1) * ASTAR_GRANULARITY : last;
+
+    assert(hierarchy);
+    assert(x * ASTAR_GRANULARITY < hierarchy->grid->size);
+    assert(y * ASTAR_GRANULARITY < hierarchy->grid->size);
+
+    for (unsigned int cy = y0 / CLUSTER_CELLS; cy <= y1 / CLUSTER_CELLS; ++cy) {
+        for (unsigned int cx = x0 / CLUSTER_CELLS; cx <= x1 / CLUSTER_CELLS; ++cx) {
+            const unsigned int index = cy * hierarchy->size + cx;
+            if (!hierarchy->dirty[index]) {
+                hierarchy->dirty[index] = 1;
+                ++hierarchy->dirtyCount;
+            }
+        }
+    }
+}
+
+void AS_UpdateHierarchy(AStarContext* context, AStarHierarchy* hierarchy) {
+    assert(context);
+    assert(hierarchy);
+
+    if (!hierarchy->dirtyCount) {
+        return;
+    }
+
+    // Read passability directly from the grid.
+    context->grid = hierarchy->grid;
+    context->passable = NULL;
+    context->userdata = NULL;
+    context->gridSize = hierarchy->grid->size;
+
+    for (unsigned int i = 0; i < hierarchy->size * hierarchy->size; ++i) {
+        if (hierarchy->dirty[i]) {
+            rebuildCluster(context, hierarchy, i);
+        }
+    }
+    hierarchy->dirtyCount = 0;
+}
+
+int AS_SearchHierarchy(AStarContext* context, const AStarHierarchy* hierarchy,
+                       const vec2* start, const vec2* goal,
+                       vec2* path, unsigned int* depth, float* length) {
+    const AStarGrid* grid;
+    float dx, dy;
+
+    assert(context);
+    assert(hierarchy);
+    assert(start);
+    assert(goal);
+
+    grid = hierarchy->grid;
+
+    // Check if the start and target position are valid (in bounds and
+    // passable). Check the sign first, because truncation rounds to zero.
+    if (start->v[0] < 0 || start->v[1] < 0 || goal->v[0] < 0 || goal->v[1] < 0 ||
+        !testGrid(grid, toLocal(start->v[0]), toLocal(start->v[1])) ||
+        !testGrid(grid, toLocal(goal->v[0]), toLocal(goal->v[1]))) {
+        return 0;
+    }
+
+    // Don't bother searching if the goal can't be reached.
+    if (getComponent(grid, toLocal(start->v[0]), toLocal(start->v[1])) !=
+        getComponent(grid, toLocal(goal->v[0]), toLocal(goal->v[1]))) {
+        return 0;
+    }
+
+    // Use a regular search for short distances, where it's faster than
+    // entering and refining the abstract graph, and if the hierarchy is out
+    // of date. This also covers neighboring clusters.
+    dx = goal->v[0] - start->v[0];
+    dy = goal->v[1] - start->v[1];
+    if (hierarchy->dirtyCount ||
+        dx * dx + dy * dy < ASTAR_HIERARCHY_DISTANCE * ASTAR_HIERARCHY_DISTANCE) {
+        return AS_SearchGrid(context, start, goal, grid, path, depth, length);
+    }
+
+    // Read passability directly from the grid.
+    context->grid = grid;
+    context->passable = NULL;
+    context->userdata = NULL;
+    context->gridSize = grid->size;
+
+    beginHierarchySearch(context, hierarchy, start, goal);
+    beginLandmarks(context, toLocal(goal->v[0]), toLocal(goal->v[1]));
+    return continueHierarchySearch(context, path, depth, length);
+}
+
+int AS_ResumeSearch(AStarContext* context, vec2* path, unsigned int* depth, float* length) {
+    assert(context);
+
+    if (!context->suspended) {
+        return 0;
+    }
+
+    // Landmarks may have been updated or moved in the meantime.
+    beginLandmarks(context, toLocal(context->goal.v[0]), toLocal(context->goal.v[1]));
+    if (context->hierarchy) {
+        return continueHierarchySearch(context, path, depth, length);
+    }
+    if (context->meeting) {
+        beginLandmarks(context->reverse, toLocal(context->start.v[0]), toLocal(context->start.v[1]));
+    }
+
+    return continueSearch(context, path, depth, length);
+}
+
+int AS_WriteSearchPath(AStarContext* context, vec2* path, unsigned int* depth, float* length) {
+    assert(context);
+
+    if (context->suspended) {
+        return 0;
+    }
+    if (context->hierarchy) {
+        return context->waypointCount ? writeHierarchyResult(context, path, depth, length) : 0;
+    }
+    if (!context->tail) {
+        return 0;
+    }
+
+    writeResult(context, path, depth, length);
+    return 1;
+}
+
+unsigned int AS_SearchNearest(AStarContext* context, const AStarGrid* grid, const vec2* start,
+                              const vec2* targets, unsigned int targetCount,
+                              AStarAcceptCallback accept, const void* userdata,
+                              unsigned int* results, float* lengths, unsigned int count) {
+    unsigned int size, component, remaining = 0, found = 0;
+    PathNode* node;
+
+    assert(context);
+    assert(grid);
+    assert(start);
+    assert(targets || !targetCount);
+    assert(results || !count);
+
+    // Check if the start position is valid (in bounds and passable). Check
+    // the sign first, because truncation rounds to zero.
+    if (!count || !targetCount || start->v[0] < 0 || start->v[1] < 0 ||
+        !testGrid(grid, toLocal(start->v[0]), toLocal(start->v[1]))) {
+        return 0;
+    }
+
+    // Read passability directly from the grid.
+    context->grid = grid;
+    context->passable = NULL;
+    context->userdata = NULL;
+    context->gridSize = size = grid->size;
+
+    // Ensure we have the capacity to store the targets and mark their cells.
+    if (targetCount > context->targetCapacity) {
+        context->targetCapacity = targetCount;
+        if (!(context->targets = realloc(context->targets, context->targetCapacity * sizeof (Target)))) {
+            fprintf(stderr, "Out of memory while resizing A* target list.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (size * size > context->targetCellCapacity) {
+        context->targetCellCapacity = size * size;
+        BS_Delete(context->targetCells);
+        if (!(context->targetCells = BS_New(context->targetCellCapacity))) {
+            fprintf(stderr, "Out of memory while resizing A* target cells.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Collect the targets that can be reached at all, i.e. that are in bounds
+    // and in the same component as the start, so that we can stop as soon as
+    // we saw all of them instead of flooding the whole component.
+    component = getComponent(grid, toLocal(start->v[0]), toLocal(start->v[1]));
+    for (unsigned int i = 0; i < targetCount; ++i) {
+        const vec2* target = &targets[i];
+        if (target->v[0] >= 0 && target->v[1] >= 0 &&
+            toLocal(target->v[0]) < size && toLocal(target->v[1]) < size &&
+            getComponent(grid, toLocal(target->v[0]), toLocal(target->v[1])) == component) {
+            Target* entry = &context->targets[remaining++];
+            entry->x = toLocal(target->v[0]);
+            entry->y = toLocal(target->v[1]);
+            entry->cell = entry->y * size + entry->x;
+            entry->index = i;
+            BS_Set(context->targetCells, entry->cell);
+        }
+    }
+    if (!remaining) {
+        return 0;
+    }
+    qsort(context->targets, remaining, sizeof (Target), compareTargets);
+    targetCount = remaining;
+
+    // A* from the start towards the closest target, so targets are reached
+    // in the order of their distance, until we have enough or there are no
+    // more targets.
+    beginSearch(context);
+    ensureNodeCapacity(context, 1);
+    node = newNode(context, toLocal(start->v[0]), toLocal(start->v[1]));
+    node->gscore = 0.0f;
+    node->fscore = estimateNearest(context, targetCount, node->x, node->y);
+    node->came_from = 0;
+    node->steps = 1;
+    pushOpenNode(context, node);
+
+    while (context->openSetCount > 0 && remaining > 0 && found < count) {
+        // Copy what we need, relaxing may move the node list.
+        const PathNode* current = popOpenNodeToClosedSet(context);
+        const unsigned int currentIndex = current - context->nodes;
+        const unsigned int cx = current->x;
+        const unsigned int cy = current->y;
+        const float cg = current->gscore;
+        const unsigned int cell = cy * size + cx;
+
+        ++context->expanded;
+
+        if (BS_Test(context->targetCells, cell)) {
+            const Target* target = findTarget(context, targetCount, cell);
+            const Target* end = context->targets + targetCount;
+            for (; target != end && target->cell == cell && found < count; ++target) {
+                const float length = computePrunedLength(context, currentIndex, start, &targets[target->index]);
+                --remaining;
+                if (!accept || accept(userdata, target->index, length)) {
+                    results[found] = target->index;
+                    if (lengths) {
+                        lengths[found] = length;
+                    }
+                    ++found;
+                }
+            }
+        }
+
+        for (int dy = -1; dy <= 1; ++dy) {
+            for (int dx = -1; dx <= 1; ++dx) {
+                const unsigned int x = cx + dx;
+                const unsigned int y = cy + dy;
+
+                // Skip self, out of bounds cells are never passable.
+                if (!dx && !dy) {
+                    continue;
+                }
+
+                // Only if this block is passable and the two diagonal ones are.
+                if (!isPassable(context, x, y) ||
+                    (!isPassable(context, x, cy) && !isPassable(context, cx, y))) {
+                    continue;
+                }
+
+                // Only estimate for nodes we didn't see yet, the estimate
+                // doesn't change for known ones.
+                node = getNode(context, x, y);
+                if (!node || node->heapIndex != NODE_CLOSED) {
+                    const float gscore = cg + ((dx && dy) ? SQRT2 : 1.0f);
+                    const float estimate = node
+                            ? node->fscore - node->gscore
+                            : estimateNearest(context, targetCount, x, y);
+                    relaxNode(context, currentIndex, x, y, gscore, gscore + estimate);
+                }
+            }
+        }
+    }
+
+    // Clear the target marks for the next search.
+    for (unsigned int i = 0; i < targetCount; ++i) {
+        BS_Unset(context->targetCells, context->targets[i].cell);
+    }
+
+    return found;
+}
+
+AStarField* AS_NewField(void) {
+    AStarField* field;
+    if (!(field = calloc(1, sizeof (AStarField)))) {
+        fprintf(stderr, "Out of memory while allocating A* field.\n");
+        exit(EXIT_FAILURE);
+    }
+    return field;
+}
+
+void AS_DeleteField(AStarField* field) {
+    if (field) {
+        free(field->distances);
+        free(field->sources);
+        free(field->targets);
+        free(field->remap);
+        free(field->invalid);
+        free(field);
+    }
+}
+
+void AS_AddFieldTarget(AStarField* field, const vec2* position, void* data) {
+    FieldTarget* target;
+
+    assert(field);
+    assert(position);
+
+    // Ensure we have the capacity to add the target.
+    if (field->targetCount >= field->targetCapacity) {
+        field->targetCapacity = field->targetCapacity * 2 + 8;
+        if (!(field->targets = realloc(field->targets, field->targetCapacity * sizeof (FieldTarget))) ||
+            !(field->remap = realloc(field->remap, field->targetCapacity * sizeof (unsigned int)))) {
+            fprintf(stderr, "Out of memory while resizing A* field targets.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    target = &field->targets[field->targetCount++];
+    target->position = *position;
+    target->data = data;
+    target->removed = 0;
+    target->seeded = 0;
+    field->changed = 1;
+}
+
+void AS_RemoveFieldTarget(AStarField* field, const void* data) {
+    assert(field);
+
+    for (unsigned int i = 0; i < field->targetCount; ++i) {
+        FieldTarget* target = &field->targets[i];
+        if (target->data == data && !target->removed) {
+            target->removed = 1;
+            field->changed = 1;
+            return;
+        }
+    }
+}
+
+void AS_UpdateField(AStarContext* context, AStarField* field, const AStarGrid* grid) {
+    assert(context);
+    assert(field);
+    assert(grid);
+
+    // Read passability directly from the grid.
+    context->grid = grid;
+    context->passable = NULL;
+    context->userdata = NULL;
+    context->gridSize = grid->size;
+
+    if (isFieldValid(field, grid) ? field->changed : isFieldRepairable(field, grid)) {
+        // Only targets changed, or blocks became passable, repair what that
+        // affected.
+        patchField(context, field, grid);
+    } else if (!isFieldValid(field, grid)) {
+        // Blocks became impassable, start over.
+        rebuildField(context, field, grid);
+    }
+    field->changed = 0;
+}
+
+AStarLandmarks* AS_NewLandmarks(unsigned int count) {
+    AStarLandmarks* landmarks;
+    if (!(landmarks = calloc(1, sizeof (AStarLandmarks))) ||
+        !(landmarks->fields = calloc(count ? count : 1, sizeof (AStarField)))) {
+        fprintf(stderr, "Out of memory while allocating A* landmarks.\n");
+        exit(EXIT_FAILURE);
+    }
+    landmarks->count = count;
+    return landmarks;
+}
+
+void AS_DeleteLandmarks(AStarLandmarks* landmarks) {
+    if (landmarks) {
+        for (unsigned int i = 0; i < landmarks->count; ++i) {
+            AStarField* field = &landmarks->fields[i];
+            free(field->distances);
+            free(field->sources);
+            free(field->targets);
+            free(field->remap);
+            free(field->invalid);
+        }
+        free(landmarks->fields);
+        free(landmarks);
+    }
+}
+
+void AS_UpdateLandmarks(AStarContext* context, AStarLandmarks* landmarks, const AStarGrid* grid) {
+    int rebuilt = 0;
+
+    assert(context);
+    assert(landmarks);
+    assert(grid);
+
+    // Read passability directly from the grid.
+    context->grid = grid;
+    context->passable = NULL;
+    context->userdata = NULL;
+    context->gridSize = grid->size;
+
+    for (unsigned int i = 0; i < landmarks->count; ++i) {
+        AStarField* field = &landmarks->fields[i];
+        if (isLandmarkValid(field, grid)) {
+            continue;
+        }
+        if (field->targetCount && isFieldRepairable(field, grid)) {
+            // Blocks only became passable, distances only get shorter.
+            patchField(context, field, grid);
+        } else if (!rebuilt || !landmarks->placed) {
+            // Blocks became impassable, or there was no passable cell to
+            // place the landmark on. Rebuilding is expensive, so only do one
+            // per update, except for placing all of them the first time.
+            rebuildLandmark(context, landmarks, i, grid);
+            rebuilt = 1;
+        }
+    }
+    landmarks->placed = 1;
+}
+
+int AS_SearchField(AStarContext* context, const AStarField* field, const AStarGrid* grid,
+                   const vec2* start, vec2* path, unsigned int* depth, float* length,
+                   void** data) {
+    unsigned int x, y, count = 0, realDepth;
+    const FieldTarget* target;
+    float distance;
+
+    assert(context);
+    assert(field);
+    assert(grid);
+    assert(start);
+
+    // Check if the distances are up-to-date, and if the start position is
+    // valid (in bounds and reachable). Check the sign first, because
+    // truncation rounds to zero.
+    if (!isFieldValid(field, grid) || start->v[0] < 0 || start->v[1] < 0 ||
+        !testGrid(grid, toLocal(start->v[0]), toLocal(start->v[1]))) {
+        return 0;
+    }
+    x = toLocal(start->v[0]);
+    y = toLocal(start->v[1]);
+    if (field->sources[y * field->size + x] == NO_LINK) {
+        return 0;
+    }
+    distance = field->distances[y * field->size + x];
+
+    // Read passability directly from the grid.
+    context->grid = grid;
+    context->passable = NULL;
+    context->userdata = NULL;
+    context->gridSize = grid->size;
+
+    // Walk downhill until we're at a target. Each step gets strictly closer,
+    // so the path is at most as long as the distance, in cells.
+    ensureWaypointCapacity(context, (unsigned int) distance + 2);
+    while (1) {
+        unsigned int nextX = x, nextY = y;
+
+        context->waypoints[count].x = x;
+        context->waypoints[count].y = y;
+        ++count;
+        if (distance <= 0.0f) {
+            break;
+        }
+
+        for (int dy = -1; dy <= 1; ++dy) {
+            for (int dx = -1; dx <= 1; ++dx) {
+                const unsigned int nx = x + dx;
+                const unsigned int ny = y + dy;
+
+                // Only if this block is passable and the two diagonal ones are.
+                if ((!dx && !dy) || !isPassable(context, nx, ny) ||
+                    (!isPassable(context, nx, y) && !isPassable(context, x, ny))) {
+                    continue;
+                }
+
+                if (field->distances[ny * field->size + nx] < distance) {
+                    distance = field->distances[ny * field->size + nx];
+                    nextX = nx;
+                    nextY = ny;
+                }
+            }
+        }
+
+        // Can't happen for up-to-date distances, but don't loop forever.
+        if (nextX == x && nextY == y) {
+            return 0;
+        }
+        x = nextX;
+        y = nextY;
+    }
+    target = &field->targets[field->sources[y * field->size + x]];
+
+    // Clean up the path the same way regular searches do.
+    count = pruneWaypoints(context, count);
+
+    if (length) {
+        *length = computeWaypointLength(context, count, start, &target->position);
+    }
+
+    if (depth) {
+        if (*depth > 1) {
+            // Same as writePath: force a minimum length of two for start and
+            // end, and if the path is too long end it early at the goal.
+            realDepth = count < 2 ? 2 : count;
+            if (realDepth >= *depth) {
+                realDepth = *depth - 1;
+            }
+            path[0] = *start;
+            for (unsigned int i = 1; i < realDepth - 1; ++i) {
+                path[i].d.x = toGlobal(context->waypoints[i].x);
+                path[i].d.y = toGlobal(context->waypoints[i].y);
+            }
+            path[realDepth - 1] = target->position;
+            *depth = realDepth;
+        } else {
+            // Not enough space for a path.
+            *depth = 0;
+        }
+    }
+
+    if (data) {
+        *data = target->data;
+    }
+
+    return 1;
+}
+
+/** Forwards passability checks to a callback without user data */
+static int legacyPassable(const void* userdata, float x, float y) {
+    return ((const LegacyPassable*) userdata)->passable(x, y);
+}
+
+int AStar(const vec2* start, const vec2* goal,
+          int(*passable)(float x, float y), unsigned int bounds,
+          vec2* path, unsigned int* depth, float* length) {
+    LegacyPassable adapter;
+
+    // We need a passability method.
+    if (!passable) {
+        return 0;
+    }
+    adapter.passable = passable;
+
+    // Lazily create the shared context.
+    if (!gDefaultContext) {
+        gDefaultContext = AS_NewContext();
+    }
+
+    return AS_Search(gDefaultContext, start, goal, legacyPassable, &adapter,
+                     bounds, path, depth, length);
 }
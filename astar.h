@@ -29,12 +29,587 @@
 #define ASTAR_JPS 1
 #endif
 
+/**
+ * Number of children per node in the heap used for the open set. Wider heaps
+ * are shallower, which makes inserts and decrease-key cheaper, at the cost of
+ * more comparisons when removing the best node.
+ */
+#ifndef ASTAR_HEAP_ARITY
+#define ASTAR_HEAP_ARITY 4
+#endif
+
+/**
+ * Size of the clusters used for hierarchical searches, in blocks. Searches
+ * between clusters that aren't neighbors run on the graph of connections
+ * between clusters first, and then only refine the parts of the path that
+ * are actually needed.
+ */
+#ifndef ASTAR_CLUSTER_SIZE
+#define ASTAR_CLUSTER_SIZE 16
+#endif
+
+/**
+ * Distance between start and goal from which hierarchical searches actually
+ * use the hierarchy, in blocks. Below this, a regular search with jump tables
+ * and landmarks is faster and finds shorter paths (see bench/).
+ */
+#ifndef ASTAR_HIERARCHY_DISTANCE
+#define ASTAR_HIERARCHY_DISTANCE 384
+#endif
+
+/**
+ * Whether new contexts search from both ends at once by default, see
+ * AS_SetSearchBidirectional. This also applies to AStar().
+ */
+#ifndef ASTAR_BIDIRECTIONAL
+#define ASTAR_BIDIRECTIONAL 0
+#endif
+
+/**
+ * Number of the best open nodes focal searches pick the next node from, see
+ * ASTAR_POLICY_FOCAL. These are taken from the top of the open set's heap, so
+ * this should cover its first few levels.
+ */
+#ifndef ASTAR_FOCAL_WIDTH
+#define ASTAR_FOCAL_WIDTH (1 + ASTAR_HEAP_ARITY + ASTAR_HEAP_ARITY * ASTAR_HEAP_ARITY)
+#endif
+
+/**
+ * Returned by searches that ran out of their budget of node expansions before
+ * they were done. They can be continued later on, see AS_SetSearchBudget.
+ */
+#define ASTAR_PENDING (-1)
+
 #ifdef	__cplusplus
 extern "C" {
 #endif
 
+    ///////////////////////////////////////////////////////////////////////////
+    // Types
+    ///////////////////////////////////////////////////////////////////////////
+
+    /**
+     * Search state for A* path searches. Each context owns the buffers used
+     * during a search, and keeps them around to be re-used by later searches.
+     * A context may only be used by one thread at a time, but any number of
+     * contexts may be used concurrently.
+     */
+    typedef struct AStarContext AStarContext;
+
+    /**
+     * How searches trade path quality for speed, see AS_SetSearchPolicy.
+     */
+    typedef enum {
+        /**
+         * Inflated heuristic (sqrt(2) times the larger axis distance). Fast,
+         * but without a bound on how much longer than the shortest one paths
+         * may be.
+         */
+        ASTAR_POLICY_DEFAULT,
+
+        /** Octile distance heuristic, finds the shortest paths */
+        ASTAR_POLICY_OPTIMAL,
+
+        /**
+         * Weighted A*, the octile distance is multiplied by a weight w, and
+         * paths are about at most w times as long as the shortest one (not
+         * strictly, because closed nodes are never reopened).
+         */
+        ASTAR_POLICY_WEIGHTED,
+
+        /**
+         * Focal search, the next node is the one closest to the goal among the
+         * open nodes scoring at most 1 + epsilon times the best one, and
+         * paths are about at most 1 + epsilon times as long as the shortest
+         * one. This usually expands more nodes than a weighted search with
+         * the same bound, though.
+         */
+        ASTAR_POLICY_FOCAL,
+
+        /** Number of policies */
+        ASTAR_POLICY_COUNT
+    } AStarPolicy;
+
+    /**
+     * Packed passability information for a square map, one bit per A* cell.
+     * Searching a grid reads bits directly instead of calling back for each
+     * cell, so grids should be kept around and updated as the map changes.
+     */
+    typedef struct AStarGrid AStarGrid;
+
+    /**
+     * Abstract graph over a passability grid, for long distance searches.
+     * The grid is split into clusters, and the graph connects the entrances
+     * between neighboring clusters. Clusters are rebuilt lazily as the grid
+     * changes.
+     */
+    typedef struct AStarHierarchy AStarHierarchy;
+
+    /**
+     * Distances from every cell of a grid to the nearest of a set of targets.
+     * Many units looking for the nearest target can share one field, and
+     * follow it downhill instead of each searching on their own. Fields are
+     * repaired as targets come and go, and rebuilt when their grid changes.
+     */
+    typedef struct AStarField AStarField;
+
+    /**
+     * Distances from a few landmark cells to every cell of a grid. Searches on
+     * the grid use them for a lower bound on the remaining distance via the
+     * triangle inequality (ALT), which is much closer to the actual distance
+     * than the plain heuristic on winding maps, so fewer nodes get expanded.
+     */
+    typedef struct AStarLandmarks AStarLandmarks;
+
+    /**
+     * Callback used to check whether a cell is passable.
+     * @param userdata the user data passed to the search.
+     * @param x the x coordinate to check, in world space.
+     * @param y the y coordinate to check, in world space.
+     * @return whether the position is passable (non-zero) or not (0).
+     */
+    typedef int(*AStarPassableCallback)(const void* userdata, float x, float y);
+
+    /**
+     * Callback used to decide whether to take a target reached in a search for
+     * the nearest targets, or to keep searching for the next one.
+     * @param userdata the user data passed to the search.
+     * @param target the index of the reached target in the target list.
+     * @param length the length of the path to the target, in map space.
+     * @return whether to take the target (non-zero) or not (0).
+     */
+    typedef int(*AStarAcceptCallback)(const void* userdata, unsigned int target, float length);
+
+    ///////////////////////////////////////////////////////////////////////////
+    // Contexts
+    ///////////////////////////////////////////////////////////////////////////
+
+    /**
+     * Allocate a new, empty search context.
+     * @return the new context.
+     */
+    AStarContext* AS_NewContext(void);
+
+    /**
+     * Free the memory occupied by the specified context.
+     * @param context the context to free.
+     */
+    void AS_DeleteContext(AStarContext* context);
+
+    /**
+     * Limit the number of nodes the following searches in a context may
+     * expand. Once a search used up the budget it is suspended, returning
+     * ASTAR_PENDING, and keeps its open and closed sets in the context, so that
+     * it can be resumed via AS_ResumeSearch, usually in a later frame with a
+     * fresh budget. Starting another search in the context drops a suspended
+     * one. Hierarchical searches are suspended the same way, including the
+     * searches inside single clusters that connect them to the abstract graph
+     * and refine the path found there, so they never exceed the budget.
+     * @param context the context to set the budget for.
+     * @param budget the number of nodes that may be expanded, 0 for no limit.
+     */
+    void AS_SetSearchBudget(AStarContext* context, unsigned int budget);
+
+    /**
+     * Get the part of the budget of a context that wasn't used up, yet.
+     * @param context the context to get the budget for.
+     * @return the number of nodes searches may still expand, 0 if unlimited.
+     */
+    unsigned int AS_GetSearchBudget(const AStarContext* context);
+
+    /**
+     * Enable or disable bidirectional searches in a context. These search
+     * from the start and the goal at the same time, always expanding the side
+     * with fewer open nodes, until either side can't find anything shorter
+     * than the best path over a cell both sides reached. This expands far
+     * fewer nodes when the goal sits in a dead end opening away from the
+     * start, which a forward search floods around first. With ASTAR_JPS the
+     * two sides mostly meet at the start or goal only, so there it rarely
+     * pays off. Paths may end up slightly longer, due to the inflated
+     * heuristic. Only affects regular and grid searches, including those
+     * hierarchical searches fall back to for short distances.
+     * @param context the context to configure.
+     * @param enabled whether to search from both ends (non-zero) or not (0).
+     */
+    void AS_SetSearchBidirectional(AStarContext* context, int enabled);
+
+    /**
+     * Get whether searches in a context run from both ends.
+     * @param context the context to check.
+     * @return 1 if searches are bidirectional, 0 if they are not.
+     */
+    int AS_IsSearchBidirectional(const AStarContext* context);
+
+    /**
+     * Set the landmarks used to improve the heuristic in a context. They're
+     * used by grid and hierarchical searches on the grid they were updated
+     * for, and ignored in other searches. The landmarks must not be updated
+     * during a search.
+     * @param context the context to configure.
+     * @param landmarks the landmarks to use, or null to use none.
+     */
+    void AS_SetSearchLandmarks(AStarContext* context, const AStarLandmarks* landmarks);
+
+    /**
+     * Set the policy used by searches in a context. This applies to regular,
+     * grid and hierarchical searches. Searches for the nearest targets only
+     * use the weight of weighted searches, and are optimal otherwise.
+     * @param context the context to configure.
+     * @param policy the policy to use.
+     * @param factor the weight w for weighted searches (at least one), or
+     * epsilon for focal searches (at least zero). Ignored otherwise.
+     */
+    void AS_SetSearchPolicy(AStarContext* context, AStarPolicy policy, float factor);
+
+    /**
+     * Get the policy used by searches in a context.
+     * @param context the context to check.
+     * @param factor used to return the weight or epsilon, if not null.
+     * @return the policy of the context.
+     */
+    AStarPolicy AS_GetSearchPolicy(const AStarContext* context, float* factor);
+
+    /**
+     * Get the number of nodes expanded by all searches in a context so far,
+     * including the searches refining hierarchical ones, and searches that
+     * were suspended and resumed. Compare the values before and after a
+     * search to get the number of nodes that search expanded.
+     * @param context the context to check.
+     * @return the number of nodes expanded in the context.
+     */
+    unsigned long AS_GetSearchExpansions(const AStarContext* context);
+
+    ///////////////////////////////////////////////////////////////////////////
+    // Grids
+    ///////////////////////////////////////////////////////////////////////////
+
+    /**
+     * Allocate a new passability grid, with all cells blocked.
+     * @param bounds the size of the map the grid represents.
+     * @return the new grid.
+     */
+    AStarGrid* AS_NewGrid(unsigned int bounds);
+
+    /**
+     * Free the memory occupied by the specified grid.
+     * @param grid the grid to free.
+     */
+    void AS_DeleteGrid(AStarGrid* grid);
+
+    /**
+     * Set whether a block in a grid is passable. This updates all A* cells
+     * covered by that block.
+     * @param grid the grid to update.
+     * @param x the x coordinate of the block, in map space.
+     * @param y the y coordinate of the block, in map space.
+     * @param passable whether the block is passable (non-zero) or not (0).
+     */
+    void AS_SetGridPassable(AStarGrid* grid, unsigned int x, unsigned int y, int passable);
+
+    /**
+     * Check whether a goal can be reached from a start position at all, i.e.
+     * whether both are passable and in the same connected component. Grids
+     * keep their components up to date as blocks change, so this is cheap.
+     * Searches on grids use this to fail early for unreachable goals.
+     * @param grid the grid to check.
+     * @param start the starting position.
+     * @param goal the goal position.
+     * @return 1 if the goal is reachable, 0 if it is not.
+     */
+    int AS_IsGridConnected(const AStarGrid* grid, const vec2* start, const vec2* goal);
+
+    /**
+     * Get the connected component a position is in. Two positions are
+     * connected if they're in the same component, so this allows checking
+     * many positions against each other without comparing each pair. The
+     * ids only stay valid until the grid changes.
+     * @param grid the grid to check.
+     * @param position the position to get the component of.
+     * @return the id of the component, 0 if the position is out of bounds or
+     * not passable.
+     */
+    unsigned int AS_GetGridComponent(const AStarGrid* grid, const vec2* position);
+
+    /**
+     * Get the version of a grid, which changes whenever the passability of a
+     * block in it changes, and is unique over all grids.
+     * @param grid the grid to check.
+     * @return the current version of the grid.
+     */
+    unsigned int AS_GetGridVersion(const AStarGrid* grid);
+
+    /**
+     * Check whether the straight line between two positions only crosses
+     * passable cells, the same way found paths are pruned. This is used to
+     * check whether a path is still valid after the grid changed.
+     * @param grid the grid to check.
+     * @param from the position the line starts at.
+     * @param to the position the line ends at.
+     * @return 1 if the line is clear, 0 if it is not.
+     */
+    int AS_IsGridLineClear(const AStarGrid* grid, const vec2* from, const vec2* to);
+
+    /**
+     * Enable or disable precomputed jump tables (JPS+) for a grid. With jump
+     * tables, searches on the grid look up jump distances instead of scanning
+     * for jump points. Tables take 16 bytes per cell and are repaired for the
+     * affected rows and columns whenever a block changes, so enable them after
+     * filling the grid. Grids larger than SHRT_MAX cells can't use tables.
+     * @param grid the grid to enable or disable jump tables for.
+     * @param enabled whether to use jump tables (non-zero) or not (0).
+     * @return whether the grid now uses jump tables (1) or not (0).
+     */
+    int AS_SetGridJumpTables(AStarGrid* grid, int enabled);
+
+    ///////////////////////////////////////////////////////////////////////////
+    // Hierarchies
+    ///////////////////////////////////////////////////////////////////////////
+
+    /**
+     * Allocate a new hierarchy for the specified grid. All clusters will be
+     * built on the first update.
+     * @param grid the grid to build the hierarchy for.
+     * @return the new hierarchy.
+     */
+    AStarHierarchy* AS_NewHierarchy(const AStarGrid* grid);
+
+    /**
+     * Free the memory occupied by the specified hierarchy.
+     * @param hierarchy the hierarchy to free.
+     */
+    void AS_DeleteHierarchy(AStarHierarchy* hierarchy);
+
+    /**
+     * Mark the clusters affected by a change of a block in the grid as dirty.
+     * Call this whenever the passability of a block in the grid changes.
+     * @param hierarchy the hierarchy to update.
+     * @param x the x coordinate of the block, in map space.
+     * @param y the y coordinate of the block, in map space.
+     */
+    void AS_MarkHierarchyDirty(AStarHierarchy* hierarchy, unsigned int x, unsigned int y);
+
+    /**
+     * Rebuild all dirty clusters of a hierarchy. Searches on a hierarchy with
+     * dirty clusters fall back to regular searches.
+     * @param context the context to use for searches while rebuilding.
+     * @param hierarchy the hierarchy to update.
+     */
+    void AS_UpdateHierarchy(AStarContext* context, AStarHierarchy* hierarchy);
+
+    ///////////////////////////////////////////////////////////////////////////
+    // Fields
+    ///////////////////////////////////////////////////////////////////////////
+
+    /**
+     * Allocate a new distance field without any targets. Distances are
+     * computed on the first update.
+     * @return the new field.
+     */
+    AStarField* AS_NewField(void);
+
+    /**
+     * Free the memory occupied by the specified field.
+     * @param field the field to free.
+     */
+    void AS_DeleteField(AStarField* field);
+
+    /**
+     * Add a target to a field. Takes effect on the next update.
+     * @param field the field to add the target to.
+     * @param position the position of the target.
+     * @param data user data identifying the target.
+     */
+    void AS_AddFieldTarget(AStarField* field, const vec2* position, void* data);
+
+    /**
+     * Remove a target from a field. Takes effect on the next update.
+     * @param field the field to remove the target from.
+     * @param data the user data the target was added with.
+     */
+    void AS_RemoveFieldTarget(AStarField* field, const void* data);
+
+    /**
+     * Bring the distances of a field up-to-date. If only targets changed since
+     * the last update, this only recomputes the distances they affected. If
+     * the grid changed, all distances are computed from scratch.
+     * @param context the context to use for searches while updating.
+     * @param field the field to update.
+     * @param grid the grid the distances are computed on.
+     */
+    void AS_UpdateField(AStarContext* context, AStarField* field, const AStarGrid* grid);
+
+    ///////////////////////////////////////////////////////////////////////////
+    // Landmarks
+    ///////////////////////////////////////////////////////////////////////////
+
+    /**
+     * Allocate a new set of landmarks. They are placed and their distances
+     * computed on the first update.
+     * @param count the number of landmarks to use.
+     * @return the new landmarks.
+     */
+    AStarLandmarks* AS_NewLandmarks(unsigned int count);
+
+    /**
+     * Free the memory occupied by the specified landmarks.
+     * @param landmarks the landmarks to free.
+     */
+    void AS_DeleteLandmarks(AStarLandmarks* landmarks);
+
+    /**
+     * Bring the distances of landmarks up-to-date with a grid. Blocks that
+     * became passable are repaired for all landmarks. Landmarks that have to
+     * be computed from scratch, because blocks became impassable, are moved
+     * to the cell farthest from the other landmarks and rebuilt, but only one
+     * per update. Until then searches just don't use them.
+     * @param context the context to use for searches while updating.
+     * @param landmarks the landmarks to update.
+     * @param grid the grid the distances are computed on.
+     */
+    void AS_UpdateLandmarks(AStarContext* context, AStarLandmarks* landmarks, const AStarGrid* grid);
+
+    ///////////////////////////////////////////////////////////////////////////
+    // Searching
+    ///////////////////////////////////////////////////////////////////////////
+
+    /**
+     * Performs an A* path search using JPS, using the specified context for
+     * all temporary data. This is safe to call from multiple threads, as long
+     * as each thread uses its own context and the passability callback is.
+     * @param context the context to perform the search in.
+     * @param start the starting position of the search.
+     * @param goal the goal position of the search.
+     * @param passable a method used to check if a cell is passable.
+     * @param userdata passed to the passability check.
+     * @param bounds determines world bounds, to know when to stop.
+     * @param path used to return the found path, if not null.
+     * @param depth the number of path nodes that can be returned via path, if not null.
+     * @param length the length of the found path, if not null.
+     * @return 1 if a path was found, 0 if there was no path to the target,
+     * ASTAR_PENDING if the search ran out of budget (see AS_SetSearchBudget).
+     */
+    int AS_Search(AStarContext* context, const vec2* start, const vec2* goal,
+            AStarPassableCallback passable, const void* userdata,
+            unsigned int bounds, vec2* path, unsigned int* depth, float* length);
+
+    /**
+     * Performs an A* path search using JPS on a passability grid, using the
+     * specified context for all temporary data. This is safe to call from
+     * multiple threads, as long as each thread uses its own context and the
+     * grid is not modified during the search.
+     * @param context the context to perform the search in.
+     * @param start the starting position of the search.
+     * @param goal the goal position of the search.
+     * @param grid the passability grid to search, which also defines bounds.
+     * @param path used to return the found path, if not null.
+     * @param depth the number of path nodes that can be returned via path, if not null.
+     * @param length the length of the found path, if not null.
+     * @return 1 if a path was found, 0 if there was no path to the target,
+     * ASTAR_PENDING if the search ran out of budget (see AS_SetSearchBudget).
+     */
+    int AS_SearchGrid(AStarContext* context, const vec2* start, const vec2* goal,
+            const AStarGrid* grid, vec2* path, unsigned int* depth, float* length);
+
+    /**
+     * Continues a search that was suspended because it ran out of budget,
+     * using the current budget of the context. The grid, and the hierarchy
+     * for hierarchical searches, must not have changed in the meantime; check
+     * AS_GetGridVersion and start the search over if it did.
+     * @param context the context of the suspended search.
+     * @param path used to return the found path, if not null.
+     * @param depth the number of path nodes that can be returned via path, if not null.
+     * @param length the length of the found path, if not null.
+     * @return 1 if a path was found, 0 if there was no path to the target or
+     * no suspended search, ASTAR_PENDING if it ran out of budget again.
+     */
+    int AS_ResumeSearch(AStarContext* context, vec2* path, unsigned int* depth, float* length);
+
+    /**
+     * Writes the path found by the last search in a context again, e.g. into
+     * a larger buffer if it was cut short, without searching again. For
+     * hierarchical searches this refines more of the abstract path if the
+     * buffer is larger, which is charged to the budget and gets suspended
+     * like the search itself. Starting another search in the context drops
+     * the path, and the grid must not have changed since.
+     * @param context the context of the search.
+     * @param path used to return the found path, if not null.
+     * @param depth the number of path nodes that can be returned via path, if not null.
+     * @param length the length of the found path, if not null.
+     * @return 1 if the last search found a path, 0 if it didn't or it's still
+     * suspended, ASTAR_PENDING if refining ran out of budget (continue via
+     * AS_ResumeSearch).
+     */
+    int AS_WriteSearchPath(AStarContext* context, vec2* path, unsigned int* depth, float* length);
+
+    /**
+     * Performs a hierarchical path search. For long distances, this searches
+     * the abstract graph first and then refines it with local searches until
+     * the path buffer is full. The remaining length is estimated from the
+     * abstract graph, as is the whole length if no path is requested. Start
+     * and goal closer than ASTAR_HIERARCHY_DISTANCE use a regular search.
+     * Thread safety is the same as for AS_SearchGrid; the hierarchy must not
+     * be updated during the search.
+     * @param context the context to perform the search in.
+     * @param hierarchy the hierarchy to search, which also defines the grid.
+     * @param start the starting position of the search.
+     * @param goal the goal position of the search.
+     * @param path used to return the found path, if not null.
+     * @param depth the number of path nodes that can be returned via path, if not null.
+     * @param length the length of the found path, if not null.
+     * @return 1 if a path was found, 0 if there was no path to the target,
+     * ASTAR_PENDING if the search ran out of budget (see AS_SetSearchBudget).
+     */
+    int AS_SearchHierarchy(AStarContext* context, const AStarHierarchy* hierarchy,
+            const vec2* start, const vec2* goal,
+            vec2* path, unsigned int* depth, float* length);
+
+    /**
+     * Finds the nearest targets reachable from a start position, using a
+     * single search expanding outwards from the start, instead of one search
+     * per target. Targets are reached in the order of their distance, and are
+     * passed to the accept callback, if any, which decides whether to take
+     * them. The search stops once enough targets were taken. Thread safety is
+     * the same as for AS_SearchGrid.
+     * @param context the context to perform the search in.
+     * @param grid the passability grid to search, which also defines bounds.
+     * @param start the starting position of the search.
+     * @param targets the positions of the targets.
+     * @param targetCount the number of targets.
+     * @param accept decides whether to take a reached target, if not null.
+     * @param userdata passed to the accept callback.
+     * @param results used to return the indices of the taken targets, nearest first.
+     * @param lengths used to return the path lengths to the taken targets, if not null.
+     * @param count the maximum number of targets to take.
+     * @return the number of targets taken.
+     */
+    unsigned int AS_SearchNearest(AStarContext* context, const AStarGrid* grid, const vec2* start,
+            const vec2* targets, unsigned int targetCount,
+            AStarAcceptCallback accept, const void* userdata,
+            unsigned int* results, float* lengths, unsigned int count);
+
+    /**
+     * Finds the path to the nearest target of a distance field by following
+     * it downhill, which only takes as long as the path. Fails if the field
+     * is not up-to-date for the specified grid. The path is pruned and
+     * written the same way as for AS_SearchGrid. Thread safety is the same as
+     * for AS_SearchGrid; the field must not be updated during the search.
+     * @param context the context to perform the search in.
+     * @param field the field to follow.
+     * @param grid the grid the field was last updated for.
+     * @param start the starting position of the search.
+     * @param path used to return the found path, if not null.
+     * @param depth the number of path nodes that can be returned via path, if not null.
+     * @param length the length of the found path, if not null.
+     * @param data used to return the user data of the reached target, if not null.
+     * @return 1 if a path was found, 0 if no target can be reached.
+     */
+    int AS_SearchField(AStarContext* context, const AStarField* field, const AStarGrid* grid,
+            const vec2* start, vec2* path, unsigned int* depth, float* length,
+            void** data);
+
     /**
-     * Performs an A* path search using JPS.
+     * Performs an A* path search using JPS. This uses a shared context, so it
+     * must only be called from a single thread; use AS_Search otherwise.
      * @param start the starting position of the search.
      * @param goal the goal position of the search.
      * @param passable a method used to check if a cell is passable.
@@ -1,24 +1,1082 @@
 #include <assert.h>
+#include <limits.h>
 #include <math.h>
+#include <string.h>
+
+#include <SDL/SDL.h>
 
 #include "astar.h"
 #include "astar_mp.h"
 #include "block.h"
+#include "config.h"
+#include "events.h"
+#include "log.h"
 #include "map.h"
 #include "unit.h"
 #include "room.h"
 
-static const MP_UnitType* gUnitType = NULL;
+/** Passability grid for one combination of passability types */
+typedef struct {
+    /** The passability types a unit must support to pass a cell */
+    MP_Passability mask;
+
+    /** The grid, with cells set where the block matches the mask */
+    AStarGrid* grid;
+
+    /** Cluster graph over the grid, for long distance searches */
+    AStarHierarchy* hierarchy;
+
+    /** Landmark distances over the grid, for a better search heuristic */
+    AStarLandmarks* landmarks;
+} PassabilityGrid;
+
+/** A path search requested via MP_RequestPath */
+typedef struct {
+    /** Ticket of the request, increasing in the order requests were made */
+    MP_PathTicket ticket;
+
+    /** The unit the path is for, and what to call with the result */
+    const MP_Unit* unit;
+    MP_PathCallback callback;
+
+    /** The passability types the unit can pass */
+    MP_Passability mask;
+
+    /** Where to search from and to */
+    vec2 start;
+    vec2 goal;
+
+    /** The search policy and its weight or epsilon */
+    AStarPolicy policy;
+    float factor;
+
+    /** Number of nodes expanded so far, over all frames */
+    unsigned long expanded;
+
+    /** The hierarchy to search and the landmarks to use, set once the
+     * request is handed to workers */
+    const AStarHierarchy* hierarchy;
+    const AStarLandmarks* landmarks;
+
+    /** The grid of the hierarchy, and its version when the search started */
+    const AStarGrid* grid;
+    unsigned int version;
+
+    /** Holds the state of the search while it's suspended, null otherwise */
+    AStarContext* context;
+
+    /** The frame the request was made in, for latency statistics */
+    unsigned int frame;
+
+    /** Whether the request was cancelled, so its result is discarded */
+    bool cancelled;
+
+    /** The result of the search, the path is allocated to fit */
+    bool found;
+    vec2* path;
+    unsigned int depth;
+    float length;
+} PathRequest;
+
+/** A list of path requests, ordered by their tickets */
+typedef struct {
+    PathRequest* requests;
+    unsigned int count;
+    unsigned int capacity;
+} PathRequestList;
+
+/** Buffer searches write their paths to, grown for longer paths */
+typedef struct {
+    vec2* nodes;
+    unsigned int capacity;
+} PathBuffer;
+
+/** A node of a stored path, in fixed point map coordinates */
+typedef struct {
+    unsigned short x;
+    unsigned short y;
+} PathPoolNode;
+
+/** A path stored in the pool */
+typedef struct {
+    /** The first and last node, which aren't on the A* grid */
+    vec2 start;
+    vec2 goal;
+
+    /** Offset of the run holding the nodes in between in the node arena */
+    unsigned int offset;
+
+    /** Number of nodes in the path, zero if the entry is unused */
+    unsigned int depth;
+} PathPoolEntry;
+
+/** A list of offsets or indices, used for free runs and entries */
+typedef struct {
+    unsigned int* items;
+    unsigned int count;
+    unsigned int capacity;
+} PathPoolList;
+
+/** Context used for searches issued via MP_AStar (main thread only) */
+static AStarContext* gContext = NULL;
+
+/** Grids for all passability masks searched so far */
+static PassabilityGrid* gGrids = NULL;
+
+/** Number of grids and capacity of the grid list */
+static unsigned int gGridCount = 0;
+static unsigned int gGridCapacity = 0;
+
+/** Requests made during the current update */
+static PathRequestList gPending = {NULL, 0, 0};
+
+/** Requests being searched by the workers, or waiting to be published */
+static PathRequestList gBatch = {NULL, 0, 0};
+
+/** Number of requests in the batch searched this frame, the next one to
+ * search and the number of searched ones */
+static unsigned int gBatchLimit = 0;
+static unsigned int gBatchNext = 0;
+static unsigned int gBatchDone = 0;
+
+/** Node expansions each searched request may use this frame */
+static unsigned int gBatchSlice = 0;
+
+/** Contexts not in use by a worker or a suspended search */
+static AStarContext** gContextPool = NULL;
+static unsigned int gContextPoolCount = 0;
+static unsigned int gContextPoolCapacity = 0;
+
+/** Guards the batch, and signals new batches and finished ones */
+static SDL_mutex* gBatchLock = NULL;
+static SDL_cond* gBatchStarted = NULL;
+static SDL_cond* gBatchFinished = NULL;
+
+/** Worker threads searching the current batch, told to stop on exit */
+#if MP_AI_PATH_WORKERS > 0
+static SDL_Thread* gWorkers[MP_AI_PATH_WORKERS];
+#endif
+static bool gStopWorkers = false;
+
+/** Last ticket handed out and the number of updates so far */
+static MP_PathTicket gLastTicket = 0;
+static unsigned int gFrame = 0;
+
+/** Statistics on path requests, and the sum of all latencies */
+static MP_PathQueueStats gQueueStats;
+static unsigned long gLatencySum = 0;
+
+/** Buffer for searches on the main thread */
+static PathBuffer gBuffer = {NULL, 0};
+
+/** Buffer for putting together repaired paths */
+static PathBuffer gRepairBuffer = {NULL, 0};
+
+/** Runs of nodes of all stored paths, in power of two sizes */
+static PathPoolNode* gPoolNodes = NULL;
+static unsigned int gPoolNodeCount = 0;
+static unsigned int gPoolNodeCapacity = 0;
+
+/** All stored paths, handles are indices into this plus one */
+static PathPoolEntry* gPoolEntries = NULL;
+static unsigned int gPoolEntryCount = 0;
+static unsigned int gPoolEntryCapacity = 0;
+
+/** Offsets of unused runs of each size, and indices of unused entries */
+static PathPoolList gFreeRuns[CHAR_BIT * sizeof (unsigned int)];
+static PathPoolList gFreeEntries = {NULL, 0, 0};
+
+/** Size of the smallest run of nodes, as a power of two */
+#define POOL_MIN_RUN 2
+
+/** Adds an offset or index to a free list */
+static void pushPoolList(PathPoolList* list, unsigned int item) {
+    if (list->count >= list->capacity) {
+        list->capacity = list->capacity * 2 + 16;
+        if (!(list->items = realloc(list->items, list->capacity * sizeof (unsigned int)))) {
+            MP_log_fatal("Out of memory while resizing path pool free list.\n");
+        }
+    }
+    list->items[list->count++] = item;
+}
+
+/** Gets the size of the run needed for a number of nodes, as a power of two */
+static unsigned int getRunSize(unsigned int count) {
+    unsigned int size = POOL_MIN_RUN;
+    while ((1u << size) < count) {
+        ++size;
+    }
+    return size;
+}
+
+/** Gets an unused run of the specified size, growing the arena if there's none */
+static unsigned int allocateRun(unsigned int size) {
+    unsigned int offset;
+
+    if (gFreeRuns[size].count) {
+        return gFreeRuns[size].items[--gFreeRuns[size].count];
+    }
+
+    offset = gPoolNodeCount;
+    gPoolNodeCount += 1u << size;
+    if (gPoolNodeCount > gPoolNodeCapacity) {
+        while (gPoolNodeCount > gPoolNodeCapacity) {
+            gPoolNodeCapacity = gPoolNodeCapacity * 2 + 256;
+        }
+        if (!(gPoolNodes = realloc(gPoolNodes, gPoolNodeCapacity * sizeof (PathPoolNode)))) {
+            MP_log_fatal("Out of memory while resizing path pool.\n");
+        }
+    }
+    return offset;
+}
+
+#if MP_MAP_SIZE_MAX * MP_AI_PATH_PRECISION > USHRT_MAX
+#error "MP_AI_PATH_PRECISION is too fine to store paths on the largest maps."
+#endif
+
+/** Converts a coordinate to fixed point, for storing it in the pool */
+inline static unsigned short toFixed(float coordinate) {
+    const float value = floorf(coordinate * MP_AI_PATH_PRECISION + 0.5f);
+    if (value < 0) {
+        return 0;
+    }
+    assert(value <= USHRT_MAX);
+    return (unsigned short) value;
+}
+
+/** Forgets all stored paths, keeping the memory for reuse */
+static void clearPaths(void) {
+    gPoolNodeCount = 0;
+    gPoolEntryCount = 0;
+    for (unsigned int i = 0; i < sizeof (gFreeRuns) / sizeof (gFreeRuns[0]); ++i) {
+        gFreeRuns[i].count = 0;
+    }
+    gFreeEntries.count = 0;
+}
+
+/** Makes a path buffer larger, doubling its size */
+static void growPathBuffer(PathBuffer* buffer) {
+    buffer->capacity = buffer->capacity ? buffer->capacity * 2 : MP_AI_PATH_DEPTH;
+    if (!(buffer->nodes = realloc(buffer->nodes, buffer->capacity * sizeof (vec2)))) {
+        MP_log_fatal("Out of memory while resizing path buffer.\n");
+    }
+}
+
+/** Tests if a search may have ended its path early to fit it into the buffer */
+inline static bool isPathCut(const PathBuffer* buffer, unsigned int depth) {
+    return depth + 1 >= buffer->capacity;
+}
+
+/** Gets the context for main thread searches, creating it if necessary */
+static AStarContext* getContext(void) {
+    if (!gContext) {
+        gContext = AS_NewContext();
+    }
+    return gContext;
+}
+
+/** Gets a context from the pool, or a new one. Only while holding the batch
+ * lock, or while the batch is idle */
+static AStarContext* acquireContext(void) {
+    if (gContextPoolCount) {
+        return gContextPool[--gContextPoolCount];
+    }
+    return AS_NewContext();
+}
+
+/** Puts a context back into the pool. Only while holding the batch lock, or
+ * while the batch is idle */
+static void releaseContext(AStarContext* context) {
+    if (gContextPoolCount >= gContextPoolCapacity) {
+        gContextPoolCapacity = gContextPoolCapacity * 2 + 1;
+        if (!(gContextPool = realloc(gContextPool, gContextPoolCapacity * sizeof (AStarContext*)))) {
+            MP_log_fatal("Out of memory while resizing path context pool.\n");
+        }
+    }
+    gContextPool[gContextPoolCount++] = context;
+}
+
+/**
+ * Performs the search for a request, or continues it if it was suspended. If
+ * the search gets suspended, the request keeps the context and the caller has
+ * to get a new one. Found paths are copied out of the buffer.
+ * @return the context of the request if it isn't needed anymore, to be
+ * released by the caller.
+ */
+static AStarContext* searchRequest(AStarContext** context, PathBuffer* buffer, PathRequest* request) {
+    AStarContext* used = request->context ? request->context : *context;
+    const unsigned long expanded = AS_GetSearchExpansions(used);
+    int result;
+
+    if (!buffer->capacity) {
+        growPathBuffer(buffer);
+    }
+
+    AS_SetSearchBudget(used, gBatchSlice);
+    AS_SetSearchLandmarks(used, request->landmarks);
+    AS_SetSearchPolicy(used, request->policy, request->factor);
+    request->depth = buffer->capacity;
+    if (request->context) {
+        result = AS_ResumeSearch(used, buffer->nodes, &request->depth, &request->length);
+    } else {
+        result = AS_SearchHierarchy(used, request->hierarchy, &request->start, &request->goal,
+                                    buffer->nodes, &request->depth, &request->length);
+    }
+
+    // If the path didn't fit, write it again to a larger buffer. Buffers
+    // keep their size, so this only happens for the longest paths so far.
+    // Hierarchical paths are refined further for that, which may run out of
+    // budget, too.
+    while (result > 0 && isPathCut(buffer, request->depth)) {
+        growPathBuffer(buffer);
+        request->depth = buffer->capacity;
+        result = AS_WriteSearchPath(used, buffer->nodes, &request->depth, &request->length);
+    }
+    request->expanded += AS_GetSearchExpansions(used) - expanded;
+
+    if (result == ASTAR_PENDING) {
+        // Keep the open and closed sets for the next frame.
+        if (!request->context) {
+            request->context = used;
+            *context = NULL;
+        }
+        return NULL;
+    }
+
+    request->found = (bool) result;
+    if (request->found && request->depth) {
+        if (!(request->path = malloc(request->depth * sizeof (vec2)))) {
+            MP_log_fatal("Out of memory while allocating path request result.\n");
+        }
+        memcpy(request->path, buffer->nodes, request->depth * sizeof (vec2));
+    }
+    if (request->context) {
+        used = request->context;
+        request->context = NULL;
+        return used;
+    }
+    return NULL;
+}
+
+/**
+ * Searches a claimed request of the batch. Called and returns while holding
+ * the batch lock, which is released during the search.
+ */
+static void runRequest(AStarContext** context, PathBuffer* buffer, PathRequest* request) {
+    AStarContext* finished;
+
+    if (!*context) {
+        *context = acquireContext();
+    }
+    SDL_UnlockMutex(gBatchLock);
+    finished = searchRequest(context, buffer, request);
+    SDL_LockMutex(gBatchLock);
+    if (finished) {
+        releaseContext(finished);
+    }
+    if (++gBatchDone == gBatchLimit) {
+        SDL_CondBroadcast(gBatchFinished);
+    }
+}
+
+#if MP_AI_PATH_WORKERS > 0
+/** Searches requests of the current batch until there are none left */
+static int runWorker(void* data) {
+    AStarContext* context = NULL;
+    PathBuffer buffer = {NULL, 0};
+
+    (void) data;
+
+    SDL_LockMutex(gBatchLock);
+    while (!gStopWorkers) {
+        if (gBatchNext < gBatchLimit) {
+            // Claim the next request and search it without holding the lock.
+            runRequest(&context, &buffer, &gBatch.requests[gBatchNext++]);
+        } else {
+            SDL_CondWait(gBatchStarted, gBatchLock);
+        }
+    }
+    SDL_UnlockMutex(gBatchLock);
 
-static int isPassable(float x, float y) {
-    const MP_Block* block = MP_GetBlockAt((int) floorf(x), (int) floorf(y));
-    return block && MP_IsBlockPassableBy(block, gUnitType);
+    AS_DeleteContext(context);
+    free(buffer.nodes);
+    return 0;
+}
+#endif
+
+/**
+ * Waits until all requests of the current batch were searched, helping out
+ * with the remaining ones. Must be called before grids or hierarchies change,
+ * because workers read them without locking.
+ */
+static void finishBatch(void) {
+    AStarContext* context = NULL;
+
+    SDL_LockMutex(gBatchLock);
+    while (gBatchNext < gBatchLimit) {
+        runRequest(&context, &gBuffer, &gBatch.requests[gBatchNext++]);
+    }
+    if (context) {
+        releaseContext(context);
+    }
+    while (gBatchDone < gBatchLimit) {
+        SDL_CondWait(gBatchFinished, gBatchLock);
+    }
+    SDL_UnlockMutex(gBatchLock);
+}
+
+/** Drops all requests, without publishing them */
+static void clearRequests(void) {
+    finishBatch();
+    for (unsigned int i = 0; i < gBatch.count; ++i) {
+        if (gBatch.requests[i].context) {
+            releaseContext(gBatch.requests[i].context);
+        }
+        free(gBatch.requests[i].path);
+    }
+    gBatch.count = 0;
+    gBatchLimit = 0;
+    gBatchNext = 0;
+    gBatchDone = 0;
+    gPending.count = 0;
+}
+
+/** Gets the request with the specified ticket from a list, if it's in there */
+static PathRequest* findRequest(const PathRequestList* list, MP_PathTicket ticket) {
+    unsigned int low = 0, high = list->count;
+    while (low < high) {
+        const unsigned int mid = low + (high - low) / 2;
+        if (list->requests[mid].ticket < ticket) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low < list->count && list->requests[low].ticket == ticket) {
+        return &list->requests[low];
+    }
+    return NULL;
+}
+
+static void updateGrids(MP_Block* block) {
+    unsigned short x, y;
+    MP_Passability passability;
+
+    // Nothing to do if nobody searched yet.
+    if (!gGridCount) {
+        return;
+    }
+
+    // Workers may be reading the grids.
+    finishBatch();
+
+    MP_GetBlockCoordinates(block, &x, &y);
+    passability = MP_GetBlockPassability(block);
+    for (unsigned int i = 0; i < gGridCount; ++i) {
+        AS_SetGridPassable(gGrids[i].grid, x, y, (passability & gGrids[i].mask) != 0);
+        AS_MarkHierarchyDirty(gGrids[i].hierarchy, x, y);
+    }
+}
+
+static void onBlockTypeChanged(MP_Block* block) {
+    updateGrids(block);
+}
+
+static void onBlockRoomChanged(MP_Block* block) {
+    updateGrids(block);
+}
+
+static void onMapChange(void) {
+    // Map size may have changed, and the map will be re-filled without any
+    // block events, so drop all grids. They'll be rebuilt on demand. Units
+    // are gone, too, so drop their requests and paths.
+    clearRequests();
+    clearPaths();
+    for (unsigned int i = 0; i < gGridCount; ++i) {
+        AS_DeleteLandmarks(gGrids[i].landmarks);
+        AS_DeleteHierarchy(gGrids[i].hierarchy);
+        AS_DeleteGrid(gGrids[i].grid);
+    }
+    gGridCount = 0;
+}
+
+/** Gets the grid for a passability mask, building it if necessary */
+static PassabilityGrid* getGrid(MP_Passability mask) {
+    PassabilityGrid* entry;
+    unsigned short size;
+
+    // See if we already have a grid for this mask.
+    for (unsigned int i = 0; i < gGridCount; ++i) {
+        if (gGrids[i].mask == mask) {
+            return &gGrids[i];
+        }
+    }
+
+    // Nope, build a new one. Workers may be reading the grid list.
+    finishBatch();
+    if (gGridCount >= gGridCapacity) {
+        gGridCapacity = gGridCapacity * 2 + 1;
+        if (!(gGrids = realloc(gGrids, gGridCapacity * sizeof (PassabilityGrid)))) {
+            MP_log_fatal("Out of memory while resizing passability grid list.\n");
+        }
+    }
+    entry = &gGrids[gGridCount++];
+    entry->mask = mask;
+
+    size = MP_GetMapSize();
+    entry->grid = AS_NewGrid(size);
+    for (unsigned short y = 0; y < size; ++y) {
+        for (unsigned short x = 0; x < size; ++x) {
+            if (MP_GetBlockPassability(MP_GetBlockAt(x, y)) & mask) {
+                AS_SetGridPassable(entry->grid, x, y, 1);
+            }
+        }
+    }
+
+    // Build jump tables once the grid is filled.
+    AS_SetGridJumpTables(entry->grid, MP_AI_JUMP_TABLES);
+
+    // The hierarchy is built and the landmarks are placed on the first update.
+    entry->hierarchy = AS_NewHierarchy(entry->grid);
+    entry->landmarks = AS_NewLandmarks(MP_AI_LANDMARKS);
+
+    return entry;
+}
+
+/** Gets the grid for a passability mask, rebuilds dirty clusters and brings
+ * the landmarks up to date */
+static PassabilityGrid* getUpdatedGrid(MP_Passability mask) {
+    PassabilityGrid* entry = getGrid(mask);
+
+    // Workers may be reading the hierarchy and landmarks. Paths on small maps
+    // are never long enough to use the hierarchy, so don't rebuild it there.
+    finishBatch();
+    if (2.0f * MP_GetMapSize() * MP_GetMapSize() >=
+        (float) ASTAR_HIERARCHY_DISTANCE * ASTAR_HIERARCHY_DISTANCE) {
+        AS_UpdateHierarchy(getContext(), entry->hierarchy);
+    }
+    AS_UpdateLandmarks(getContext(), entry->landmarks, entry->grid);
+
+    return entry;
+}
+
+/** Hands the requests made during this update to the workers, along with
+ * those from earlier frames that aren't done, yet */
+static void startBatch(void) {
+    unsigned int count = 0, served;
+
+    // Drop cancelled requests, the batch is idle so there's no need to lock.
+    // Searches can't be resumed on a grid that changed since they started, so
+    // start those over, on the rebuilt hierarchy.
+    for (unsigned int i = 0; i < gBatch.count; ++i) {
+        PathRequest* request = &gBatch.requests[i];
+        if (request->cancelled) {
+            if (request->context) {
+                releaseContext(request->context);
+            }
+            free(request->path);
+            ++gQueueStats.cancelled;
+            continue;
+        }
+        if (AS_GetGridVersion(request->grid) != request->version) {
+            getUpdatedGrid(request->mask);
+            request->version = AS_GetGridVersion(request->grid);
+            if (request->context) {
+                releaseContext(request->context);
+                request->context = NULL;
+            }
+        }
+        gBatch.requests[count++] = *request;
+    }
+    gBatch.count = count;
+
+    // Append new requests, which have higher tickets, so the batch stays in
+    // ticket order. Bring the hierarchies to search up to date, which must
+    // happen before workers start reading them.
+    for (unsigned int i = 0; i < gPending.count; ++i) {
+        const PassabilityGrid* entry;
+        PathRequest* request;
+        if (gPending.requests[i].cancelled) {
+            ++gQueueStats.cancelled;
+            continue;
+        }
+        if (gBatch.count >= gBatch.capacity) {
+            gBatch.capacity = gBatch.capacity * 2 + 1;
+            if (!(gBatch.requests = realloc(gBatch.requests, gBatch.capacity * sizeof (PathRequest)))) {
+                MP_log_fatal("Out of memory while resizing path request list.\n");
+            }
+        }
+        request = &gBatch.requests[gBatch.count++];
+        *request = gPending.requests[i];
+        entry = getUpdatedGrid(request->mask);
+        request->hierarchy = entry->hierarchy;
+        request->landmarks = entry->landmarks;
+        request->grid = entry->grid;
+        request->version = AS_GetGridVersion(entry->grid);
+    }
+    gPending.count = 0;
+    if (!gBatch.count) {
+        return;
+    }
+
+    // Share the frame's budget between the oldest requests, giving each at
+    // least a minimum slice, so that every search makes progress. Searches
+    // stay within their slice, so which requests are searched and how far
+    // only depends on the batch, not on which worker takes which request.
+    served = MP_AI_PATH_BUDGET / MP_AI_PATH_SLICE;
+    if (served < 1) {
+        served = 1;
+    }
+    if (served > gBatch.count) {
+        served = gBatch.count;
+    }
+
+    SDL_LockMutex(gBatchLock);
+    gBatchLimit = served;
+    gBatchSlice = MP_AI_PATH_BUDGET / served;
+    gBatchNext = 0;
+    gBatchDone = 0;
+    SDL_CondBroadcast(gBatchStarted);
+    SDL_UnlockMutex(gBatchLock);
+}
+
+/** Passes the results of the last batch to their callbacks, in ticket order,
+ * keeping requests that aren't done */
+static void publishBatch(void) {
+    unsigned int count = 0;
+
+    // Wait for stragglers. Usually they finished while rendering.
+    finishBatch();
+
+    gQueueStats.suspended = 0;
+    for (unsigned int i = 0; i < gBatch.count; ++i) {
+        const PathRequest* request = &gBatch.requests[i];
+        unsigned int latency;
+
+        // Keep requests that were suspended or not searched at all.
+        if (i >= gBatchLimit || request->context) {
+            if (request->context) {
+                ++gQueueStats.suspended;
+            }
+            gBatch.requests[count++] = *request;
+            continue;
+        }
+
+        if (request->cancelled) {
+            free(request->path);
+            ++gQueueStats.cancelled;
+            continue;
+        }
+
+        latency = gFrame - request->frame;
+        gLatencySum += latency;
+        if (latency > gQueueStats.peakLatency) {
+            gQueueStats.peakLatency = latency;
+        }
+        ++gQueueStats.completed;
+        ++gQueueStats.searches[request->policy];
+        gQueueStats.expanded[request->policy] += request->expanded;
+
+        request->callback(request->unit, request->found,
+                          request->found ? MP_StorePath(request->path, request->depth) : 0,
+                          request->length);
+        free(request->path);
+    }
+
+    // Don't let workers touch what's left until the next batch starts.
+    SDL_LockMutex(gBatchLock);
+    gBatch.count = count;
+    gBatchLimit = 0;
+    gBatchNext = 0;
+    gBatchDone = 0;
+    SDL_UnlockMutex(gBatchLock);
+}
+
+static void onUpdate(void) {
+    ++gFrame;
+    publishBatch();
+}
+
+static void onPreRender(void) {
+    // All changes for this frame were made, search while rendering.
+    startBatch();
+}
+
+static void stopWorkers(void) {
+    SDL_LockMutex(gBatchLock);
+    gStopWorkers = true;
+    SDL_CondBroadcast(gBatchStarted);
+    SDL_UnlockMutex(gBatchLock);
+#if MP_AI_PATH_WORKERS > 0
+    for (unsigned int i = 0; i < MP_AI_PATH_WORKERS; ++i) {
+        if (gWorkers[i]) {
+            SDL_WaitThread(gWorkers[i], NULL);
+        }
+    }
+#endif
+}
+
+const AStarGrid* MP_GetPassabilityGrid(MP_Passability mask) {
+    return getUpdatedGrid(mask)->grid;
+}
+
+bool MP_AStarInContext(AStarContext* context, const MP_Unit* unit, const vec2* goal,
+                       vec2* path, unsigned int* depth, float* length) {
+    const PassabilityGrid* entry;
+
+    assert(context);
+    assert(unit);
+
+    // Search the grid matching the unit type's capabilities. This falls
+    // back to a regular search if the hierarchy is out of date, and out of
+    // date landmarks are ignored.
+    entry = getGrid(unit->type->canPass);
+    AS_SetSearchLandmarks(context, entry->landmarks);
+    return (bool) AS_SearchHierarchy(context, entry->hierarchy,
+                                     &unit->position, goal, path, depth, length);
+}
+
+bool MP_IsReachable(const MP_Unit* unit, const vec2* goal) {
+    assert(unit);
+    assert(goal);
+
+    return (bool) AS_IsGridConnected(getGrid(unit->type->canPass)->grid, &unit->position, goal);
+}
+
+unsigned int MP_GetComponent(MP_Passability mask, const vec2* position) {
+    assert(position);
+
+    return AS_GetGridComponent(getGrid(mask)->grid, position);
+}
+
+bool MP_RepairPath(const MP_Unit* unit, MP_PathHandle path, unsigned int next,
+                   AStarPolicy policy, float factor, MP_PathHandle* repaired) {
+    const PassabilityGrid* entry;
+    AStarContext* context;
+    unsigned int depth, first, last, detour, count = 0;
+    unsigned long expanded;
+    vec2 previous, from, to;
+    int result;
+
+    assert(unit);
+    assert(repaired);
+
+    *repaired = 0;
+    depth = MP_GetPathDepth(path);
+    entry = getGrid(unit->type->canPass);
+
+    // Find the first and last blocked segment of the rest of the path. Each
+    // segment is named by the node it leads to, the first one starts at the
+    // unit's position.
+    first = last = depth;
+    previous = unit->position;
+    for (unsigned int i = next; i < depth; ++i) {
+        const vec2 node = MP_GetPathNode(path, i);
+        if (!AS_IsGridLineClear(entry->grid, &previous, &node)) {
+            if (first == depth) {
+                first = i;
+            }
+            last = i;
+        }
+        previous = node;
+    }
+    if (first == depth) {
+        return true;
+    }
+
+    // The node after the last blocked segment can be walked to the goal
+    // from, so if we can't get there we can't get to the goal at all.
+    from = first > next ? MP_GetPathNode(path, first - 1) : unit->position;
+    to = MP_GetPathNode(path, last);
+    if (!AS_IsGridConnected(entry->grid, &from, &to)) {
+        return false;
+    }
+
+    // Search the way around. Detours are usually short, so skip the
+    // hierarchy, setting up its search costs more than the search itself
+    // then. This runs on the main thread, so give up on long ones, like a
+    // single path request would per frame, and leave them to the workers.
+    context = getContext();
+    expanded = AS_GetSearchExpansions(context);
+    AS_SetSearchBudget(context, MP_AI_PATH_SLICE);
+    AS_SetSearchLandmarks(context, entry->landmarks);
+    AS_SetSearchPolicy(context, policy, factor);
+    if (!gBuffer.capacity) {
+        growPathBuffer(&gBuffer);
+    }
+    detour = gBuffer.capacity;
+    result = AS_SearchGrid(context, &from, &to, entry->grid, gBuffer.nodes, &detour, NULL);
+    AS_SetSearchBudget(context, 0);
+
+    // If the path didn't fit, write it again to a larger buffer.
+    while (result > 0 && isPathCut(&gBuffer, detour)) {
+        growPathBuffer(&gBuffer);
+        detour = gBuffer.capacity;
+        result = AS_WriteSearchPath(context, gBuffer.nodes, &detour, NULL);
+    }
+    ++gQueueStats.searches[policy];
+    gQueueStats.expanded[policy] += AS_GetSearchExpansions(context) - expanded;
+    if (result <= 0) {
+        return false;
+    }
+
+    // Put together the part before the blocked one, the way around it, and
+    // the rest, which ends at the same goal.
+    while (gRepairBuffer.capacity < (first - next) + detour + (depth - last) + 1) {
+        growPathBuffer(&gRepairBuffer);
+    }
+    gRepairBuffer.nodes[count++] = unit->position;
+    for (unsigned int i = next; i < first; ++i) {
+        gRepairBuffer.nodes[count++] = MP_GetPathNode(path, i);
+    }
+    for (unsigned int i = 1; i + 1 < detour; ++i) {
+        gRepairBuffer.nodes[count++] = gBuffer.nodes[i];
+    }
+    for (unsigned int i = last; i < depth; ++i) {
+        gRepairBuffer.nodes[count++] = MP_GetPathNode(path, i);
+    }
+
+    *repaired = MP_StorePath(gRepairBuffer.nodes, count);
+    ++gQueueStats.repaired;
+    return true;
 }
 
 bool MP_AStar(const MP_Unit* unit, const vec2* goal, vec2* path, unsigned int* depth, float* length) {
+    // Fail right away if the goal is unreachable, before any updates.
+    if (!MP_IsReachable(unit, goal)) {
+        return false;
+    }
+
+    // Bring the hierarchy up to date, which also creates the context.
+    getUpdatedGrid(unit->type->canPass);
+    return MP_AStarInContext(gContext, unit, goal, path, depth, length);
+}
+
+MP_PathTicket MP_RequestPath(const MP_Unit* unit, const vec2* goal,
+                             AStarPolicy policy, float factor, MP_PathCallback callback) {
+    PathRequest* request;
+
+    assert(unit);
+    assert(goal);
+    assert(callback);
+
+    // The pending list is only used by the main thread, no need to lock.
+    if (gPending.count >= gPending.capacity) {
+        gPending.capacity = gPending.capacity * 2 + 1;
+        if (!(gPending.requests = realloc(gPending.requests, gPending.capacity * sizeof (PathRequest)))) {
+            MP_log_fatal("Out of memory while resizing path request list.\n");
+        }
+    }
+    request = &gPending.requests[gPending.count++];
+    request->ticket = ++gLastTicket;
+    request->unit = unit;
+    request->callback = callback;
+    request->mask = unit->type->canPass;
+    request->start = unit->position;
+    request->goal = *goal;
+    request->policy = policy;
+    request->factor = factor;
+    request->expanded = 0;
+    request->hierarchy = NULL;
+    request->landmarks = NULL;
+    request->context = NULL;
+    request->frame = gFrame;
+    request->cancelled = false;
+    request->path = NULL;
+
+    if (gPending.count + gBatch.count > gQueueStats.peakDepth) {
+        gQueueStats.peakDepth = gPending.count + gBatch.count;
+    }
+
+    return request->ticket;
+}
+
+void MP_CancelPath(MP_PathTicket ticket) {
+    PathRequest* request;
+    if ((request = findRequest(&gPending, ticket)) ||
+        (request = findRequest(&gBatch, ticket))) {
+        request->cancelled = true;
+    }
+}
+
+void MP_GetPathQueueStats(MP_PathQueueStats* stats) {
+    assert(stats);
+
+    *stats = gQueueStats;
+    stats->depth = gPending.count + gBatch.count;
+    stats->averageLatency = gQueueStats.completed ? gLatencySum / (float) gQueueStats.completed : 0.0f;
+}
+
+unsigned int MP_AStarNearest(const MP_Unit* unit, const vec2* targets, unsigned int targetCount,
+                             AStarAcceptCallback accept, const void* userdata,
+                             unsigned int* results, float* lengths, unsigned int count,
+                             AStarPolicy policy, float factor) {
+    AStarContext* context = getContext();
+    const unsigned long expanded = AS_GetSearchExpansions(context);
+    unsigned int found;
+
+    assert(unit);
+
+    // One search over the grid matching the unit type's capabilities.
+    AS_SetSearchPolicy(context, policy, factor);
+    found = AS_SearchNearest(context, getGrid(unit->type->canPass)->grid, &unit->position,
+                             targets, targetCount, accept, userdata, results, lengths, count);
+
+    ++gQueueStats.searches[policy];
+    gQueueStats.expanded[policy] += AS_GetSearchExpansions(context) - expanded;
+
+    return found;
+}
+
+void MP_UpdateField(AStarField* field, MP_Passability mask) {
+    assert(field);
+
+    AS_UpdateField(getContext(), field, getGrid(mask)->grid);
+}
+
+bool MP_SearchField(const MP_Unit* unit, const AStarField* field,
+                    MP_PathHandle* path, float* length, void** target) {
+    const AStarGrid* grid;
+    unsigned int depth;
+
     assert(unit);
+    assert(field);
+
+    // Follow the field on the grid matching the unit type's capabilities,
+    // which fails if the field was updated for another one.
+    grid = getGrid(unit->type->canPass)->grid;
+    if (!path) {
+        return (bool) AS_SearchField(getContext(), field, grid, &unit->position,
+                                     NULL, NULL, length, target);
+    }
+
+    // Grow the buffer until the whole path fits. Following the field is
+    // cheap, so just do it again.
+    if (!gBuffer.capacity) {
+        growPathBuffer(&gBuffer);
+    }
+    for (;;) {
+        depth = gBuffer.capacity;
+        if (!AS_SearchField(getContext(), field, grid, &unit->position,
+                            gBuffer.nodes, &depth, length, target)) {
+            return false;
+        }
+        if (!isPathCut(&gBuffer, depth)) {
+            break;
+        }
+        growPathBuffer(&gBuffer);
+    }
+
+    *path = MP_StorePath(gBuffer.nodes, depth);
+    return true;
+}
+
+MP_PathHandle MP_StorePath(const vec2* path, unsigned int depth) {
+    PathPoolEntry* entry;
+    unsigned int index;
+
+    assert(path || !depth);
+
+    if (!depth) {
+        return 0;
+    }
+
+    // Reuse an unused entry if possible.
+    if (gFreeEntries.count) {
+        index = gFreeEntries.items[--gFreeEntries.count];
+    } else {
+        if (gPoolEntryCount >= gPoolEntryCapacity) {
+            gPoolEntryCapacity = gPoolEntryCapacity * 2 + 16;
+            if (!(gPoolEntries = realloc(gPoolEntries, gPoolEntryCapacity * sizeof (PathPoolEntry)))) {
+                MP_log_fatal("Out of memory while resizing path pool.\n");
+            }
+        }
+        index = gPoolEntryCount++;
+    }
+    entry = &gPoolEntries[index];
+    entry->start = path[0];
+    entry->goal = path[depth - 1];
+    entry->depth = depth;
+
+    // Nodes in between are on the A* grid, so they fit into fixed point.
+    if (depth > 2) {
+        PathPoolNode* nodes;
+        entry->offset = allocateRun(getRunSize(depth - 2));
+        nodes = &gPoolNodes[entry->offset];
+        for (unsigned int i = 1; i < depth - 1; ++i) {
+            nodes[i - 1].x = toFixed(path[i].d.x);
+            nodes[i - 1].y = toFixed(path[i].d.y);
+        }
+    }
+
+    return index + 1;
+}
+
+void MP_ReleasePath(MP_PathHandle path) {
+    PathPoolEntry* entry;
+
+    if (!path) {
+        return;
+    }
+
+    assert(path <= gPoolEntryCount);
+    entry = &gPoolEntries[path - 1];
+    assert(entry->depth);
+
+    if (entry->depth > 2) {
+        pushPoolList(&gFreeRuns[getRunSize(entry->depth - 2)], entry->offset);
+    }
+    entry->depth = 0;
+    pushPoolList(&gFreeEntries, path - 1);
+}
+
+unsigned int MP_GetPathDepth(MP_PathHandle path) {
+    assert(path <= gPoolEntryCount);
+
+    return path ? gPoolEntries[path - 1].depth : 0;
+}
+
+vec2 MP_GetPathNode(MP_PathHandle path, unsigned int index) {
+    const PathPoolEntry* entry;
+    const PathPoolNode* node;
+    vec2 result;
+
+    assert(path && path <= gPoolEntryCount);
+    entry = &gPoolEntries[path - 1];
+    assert(index < entry->depth);
+
+    if (index == 0) {
+        return entry->start;
+    }
+    if (index == entry->depth - 1) {
+        return entry->goal;
+    }
+    node = &gPoolNodes[entry->offset + index - 1];
+    result.d.x = node->x / (float) MP_AI_PATH_PRECISION;
+    result.d.y = node->y / (float) MP_AI_PATH_PRECISION;
+    return result;
+}
+
+void MP_InitAStar(void) {
+    MP_AddBlockTypeChangedEventListener(onBlockTypeChanged);
+    MP_AddBlockRoomChangedEventListener(onBlockRoomChanged);
+    MP_AddMapChangeEventListener(onMapChange);
+    MP_AddUpdateEventListener(onUpdate);
+    MP_AddPreRenderEventListener(onPreRender);
 
-    // Remember we're working on this unit (passable checks).
-    gUnitType = unit->type;
-    return (bool) AStar(&unit->position, goal, isPassable, MP_GetMapSize(), path, depth, length);
+    // Set up the workers for path requests.
+    if (!(gBatchLock = SDL_CreateMutex()) ||
+        !(gBatchStarted = SDL_CreateCond()) ||
+        !(gBatchFinished = SDL_CreateCond())) {
+        MP_log_fatal("Unable to set up path request workers: %s\n", SDL_GetError());
+    }
+#if MP_AI_PATH_WORKERS > 0
+    for (unsigned int i = 0; i < MP_AI_PATH_WORKERS; ++i) {
+        if (!(gWorkers[i] = SDL_CreateThread(runWorker, NULL))) {
+            // Not fatal, the main thread searches what's left.
+            MP_log_error("Unable to start path request worker: %s\n", SDL_GetError());
+        }
+    }
+#endif
+    atexit(stopWorkers);
 }
@@ -7,6 +7,7 @@
 #ifndef ASTAR_MP_H
 #define	ASTAR_MP_H
 
+#include "astar.h"
 #include "types.h"
 #include "vmath.h"
 
@@ -14,8 +15,82 @@
 extern "C" {
 #endif
 
+    /** Identifies an asynchronous path request, zero is never used */
+    typedef unsigned int MP_PathTicket;
+
+    /** Identifies a path stored in the shared path pool, zero is never used */
+    typedef unsigned int MP_PathHandle;
+
+    /**
+     * Called on the main thread with the result of a path request.
+     * @param unit the unit the path was requested for.
+     * @param found whether a path was found.
+     * @param path the found path, if any, which the callback has to release
+     * (see MP_ReleasePath).
+     * @param length the length of the found path.
+     */
+    typedef void(*MP_PathCallback)(const MP_Unit* unit, bool found,
+            MP_PathHandle path, float length);
+
+    /** Statistics on asynchronous path requests */
+    typedef struct {
+        /** Number of requests that have not been published yet */
+        unsigned int depth;
+
+        /** Highest number of unpublished requests so far */
+        unsigned int peakDepth;
+
+        /** Number of requests published and cancelled so far */
+        unsigned int completed;
+        unsigned int cancelled;
+
+        /** Number of searches that ran out of budget in the last frame */
+        unsigned int suspended;
+
+        /** Average and highest number of frames until a result was published */
+        float averageLatency;
+        unsigned int peakLatency;
+
+        /** Number of completed searches and the nodes they expanded so far
+         * per search policy, including searches for the nearest targets */
+        unsigned int searches[ASTAR_POLICY_COUNT];
+        unsigned long expanded[ASTAR_POLICY_COUNT];
+
+        /** Number of paths repaired after blocks along them changed so far */
+        unsigned int repaired;
+    } MP_PathQueueStats;
+
+    /**
+     * Get the passability grid for units that can pass the specified types.
+     * Grids are built on first use and kept up-to-date as blocks change. This
+     * also rebuilds outdated parts of the cluster graph used for long distance
+     * searches, so this must only be called from the main thread.
+     * @param mask the passability types to get the grid for.
+     * @return the grid for that combination of passability types.
+     */
+    const AStarGrid* MP_GetPassabilityGrid(MP_Passability mask);
+
+    /**
+     * Performs an A* path search using JPS, in the specified context. Long
+     * distance searches use a cluster graph first, if it is up-to-date, and
+     * only refine as much of the path as fits into the buffer. Safe to
+     * call from worker threads, as long as each uses its own context, the map
+     * is not modified while searching and the grid for the unit's type has
+     * already been built (see MP_GetPassabilityGrid).
+     * @param context the search context to use.
+     * @param unit the unit to find a path for.
+     * @param goal the target position as a fraction of map coordinates.
+     * @param path used to return the found path.
+     * @param depth the number of path nodes that can be returned via path.
+     * @param length the length of the found path.
+     * @return true if a path was found, false if there was no path to the target.
+     */
+    bool MP_AStarInContext(AStarContext* context, const MP_Unit* unit, const vec2* goal,
+            vec2* path, unsigned int* depth, float* length);
+
     /**
-     * Performs an A* path search using JPS.
+     * Performs an A* path search using JPS. Uses a shared context, so this
+     * must only be called from the main thread.
      * @param unit the unit to find a path for.
      * @param goal the target position as a fraction of map coordinates.
      * @param path used to return the found path.
@@ -26,6 +101,167 @@ extern "C" {
     bool MP_AStar(const MP_Unit* unit, const vec2* goal,
             vec2* path, unsigned int* depth, float* length);
 
+    /**
+     * Checks whether a unit could walk to a position at all. This is cheap,
+     * because grids keep track of which parts of the map are connected.
+     * @param unit the unit to check for.
+     * @param goal the target position as a fraction of map coordinates.
+     * @return true if there is a path to the target, false if there is not.
+     */
+    bool MP_IsReachable(const MP_Unit* unit, const vec2* goal);
+
+    /**
+     * Gets the part of the map a position is in, for units with some
+     * passability. Units can walk between positions with the same component,
+     * see AS_GetGridComponent. Ids change whenever blocks change.
+     * @param mask the passability of the units.
+     * @param position the position as a fraction of map coordinates.
+     * @return the id of the component, 0 if the position can't be walked on.
+     */
+    unsigned int MP_GetComponent(MP_Passability mask, const vec2* position);
+
+    /**
+     * Checks whether the rest of a path a unit is following is still clear,
+     * and if not, searches a way around the blocked part, from the last node
+     * before it to the first node after it, keeping the rest of the path.
+     * Gives up if that takes more than MP_AI_PATH_SLICE node expansions, a
+     * new path to the goal should be requested then (see MP_RequestPath).
+     * Uses a shared context, so this must only be called from the main
+     * thread.
+     * @param unit the unit following the path, from its current position.
+     * @param path the path the unit is following.
+     * @param next the index of the node of the path the unit is heading to.
+     * @param policy how to trade path quality for speed in the search.
+     * @param factor the weight or epsilon of the policy (see AS_SetSearchPolicy).
+     * @param repaired used to return the repaired path, starting at the
+     * unit's position, which the caller has to release (see MP_ReleasePath),
+     * or zero if the path is still clear.
+     * @return true if the path is clear or was repaired, false if there is
+     * no way around the blocked part, or it's too long to search right away.
+     */
+    bool MP_RepairPath(const MP_Unit* unit, MP_PathHandle path, unsigned int next,
+            AStarPolicy policy, float factor, MP_PathHandle* repaired);
+
+    /**
+     * Requests a path search that is performed in the background, by a pool
+     * of worker threads. Requests made during an update are searched on the
+     * map as it is after that update, and the results are passed to their
+     * callbacks at the start of the next update, in the order the requests
+     * were made. Searches share a budget of node expansions per frame, and
+     * ones that run out of their share are suspended and continued in the
+     * next frame (on the map as it is then), so results of long searches may
+     * take several frames. Must only be called from the main thread.
+     * @param unit the unit to find a path for, from its current position.
+     * @param goal the target position as a fraction of map coordinates.
+     * @param policy how to trade path quality for speed.
+     * @param factor the weight or epsilon of the policy (see AS_SetSearchPolicy).
+     * @param callback called with the result.
+     * @return the ticket of the request, used to cancel it.
+     */
+    MP_PathTicket MP_RequestPath(const MP_Unit* unit, const vec2* goal,
+            AStarPolicy policy, float factor, MP_PathCallback callback);
+
+    /**
+     * Cancels a path request, so that its result won't be published. Does
+     * nothing if the result was already published.
+     * @param ticket the ticket of the request to cancel.
+     */
+    void MP_CancelPath(MP_PathTicket ticket);
+
+    /**
+     * Get statistics on asynchronous path requests.
+     * @param stats used to return the statistics.
+     */
+    void MP_GetPathQueueStats(MP_PathQueueStats* stats);
+
+    /**
+     * Stores a path in the pool shared by all units. Paths may have any
+     * length, their nodes are kept as fixed point coordinates (see
+     * MP_AI_PATH_PRECISION), except for the first and last one, which are
+     * kept as they are. Must only be called from the main thread.
+     * @param path the nodes of the path.
+     * @param depth the number of nodes in the path.
+     * @return the handle of the stored path, zero if the path is empty.
+     */
+    MP_PathHandle MP_StorePath(const vec2* path, unsigned int depth);
+
+    /**
+     * Releases a path stored in the pool, so its memory can be reused. Does
+     * nothing for the zero handle.
+     * @param path the handle of the path to release.
+     */
+    void MP_ReleasePath(MP_PathHandle path);
+
+    /**
+     * Get the number of nodes in a stored path.
+     * @param path the handle of the path.
+     * @return the number of nodes in the path, zero for the zero handle.
+     */
+    unsigned int MP_GetPathDepth(MP_PathHandle path);
+
+    /**
+     * Get a node of a stored path.
+     * @param path the handle of the path.
+     * @param index the index of the node, less than the path's depth.
+     * @return the position of the node.
+     */
+    vec2 MP_GetPathNode(MP_PathHandle path, unsigned int index);
+
+    /**
+     * Finds the nearest of a list of targets a unit can walk to, using a single
+     * search from the unit's position. Targets are passed to the accept
+     * callback nearest first, until enough were taken. Uses a shared context,
+     * so this must only be called from the main thread.
+     * @param unit the unit to find targets for.
+     * @param targets the target positions as fractions of map coordinates.
+     * @param targetCount the number of targets.
+     * @param accept decides whether to take a reached target, if not null.
+     * @param userdata passed to the accept callback.
+     * @param results used to return the indices of the taken targets.
+     * @param lengths used to return the path lengths to the taken targets.
+     * @param count the maximum number of targets to take.
+     * @param policy how to trade accuracy for speed, only weighted searches
+     * differ from optimal ones here, and may take targets out of order.
+     * @param factor the weight of weighted searches (see AS_SetSearchPolicy).
+     * @return the number of targets taken.
+     */
+    unsigned int MP_AStarNearest(const MP_Unit* unit, const vec2* targets, unsigned int targetCount,
+            AStarAcceptCallback accept, const void* userdata,
+            unsigned int* results, float* lengths, unsigned int count,
+            AStarPolicy policy, float factor);
+
+    /**
+     * Bring a distance field up-to-date for units that can pass the specified
+     * types. Uses a shared context, so this must only be called from the main
+     * thread.
+     * @param field the field to update.
+     * @param mask the passability types to compute the distances for.
+     */
+    void MP_UpdateField(AStarField* field, MP_Passability mask);
+
+    /**
+     * Find the path from a unit to the nearest target of a distance field, by
+     * following the field downhill. The field must have been updated for the
+     * unit type's passability. Uses a shared context, so this must only be
+     * called from the main thread.
+     * @param unit the unit to find a path for.
+     * @param field the field to follow.
+     * @param path used to return the found path, which the caller has to
+     * release (see MP_ReleasePath), if not null.
+     * @param length the length of the found path.
+     * @param target used to return the user data of the reached target.
+     * @return true if a path was found, false if no target can be reached.
+     */
+    bool MP_SearchField(const MP_Unit* unit, const AStarField* field,
+            MP_PathHandle* path, float* length, void** target);
+
+    /**
+     * Initialize event handling for keeping passability grids up-to-date, and
+     * start the workers for path requests. Must be initialized before units,
+     * so that path results are published before units are updated.
+     */
+    void MP_InitAStar(void);
+
 #ifdef	__cplusplus
 }
 #endif
@@ -0,0 +1,521 @@
+/*
+ * Headless benchmark for the path searches in astar.c. Generates cave and
+ * dungeon maps at several sizes, runs seeded random queries on them with
+ * each search method, and writes the results as JSON to stdout, so builds
+ * can be compared. Progress goes to stderr.
+ *
+ * Usage: astar_bench [-q queries] [-s seed] [-t seconds] [-m max_size]
+ *
+ * Author: fnuecke
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "astar.h"
+#include "simplexnoise.h"
+#include "timer.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Settings
+///////////////////////////////////////////////////////////////////////////////
+
+/** Map sizes to run, in blocks */
+static const unsigned int gSizes[] = {64, 128, 256, 512, 1024};
+
+/** Number of landmarks for the searches using them, as in the game */
+#define BENCH_LANDMARKS 8
+
+/** Path nodes returned per search, as in the game */
+#define BENCH_PATH_DEPTH 32
+
+/** Tries to find a query of some kind before giving up on the case */
+#define BENCH_QUERY_TRIES 100000
+
+/** How much longer than their distance the paths of detour queries are */
+#define BENCH_DETOUR 1.5f
+
+/** Queries per case */
+static unsigned int gQueries = 500;
+
+/** Seed for maps and queries */
+static unsigned int gSeed = 1;
+
+/** Time after which a case stops early, in seconds */
+static double gTimeLimit = 2.0;
+
+/** Largest map size to run */
+static unsigned int gMaxSize = 1024;
+
+///////////////////////////////////////////////////////////////////////////////
+// Random numbers
+///////////////////////////////////////////////////////////////////////////////
+
+/** State of the random number generator; not rand(), so that the maps and
+ * queries are the same on all platforms */
+static unsigned int gRandom;
+
+static unsigned int nextRandom(void) {
+    // xorshift32
+    gRandom ^= gRandom << 13;
+    gRandom ^= gRandom >> 17;
+    gRandom ^= gRandom << 5;
+    return gRandom;
+}
+
+/** Random number in [min, max] */
+static unsigned int randomRange(unsigned int min, unsigned int max) {
+    return min + nextRandom() % (max - min + 1);
+}
+
+static void seedRandom(unsigned int seed) {
+    gRandom = seed * 2654435761u + 1;
+    if (!gRandom) {
+        gRandom = 1;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Maps
+///////////////////////////////////////////////////////////////////////////////
+
+/** A generated map, one byte per block, non-zero where passable */
+typedef struct {
+    const char* name;
+    unsigned int size;
+    unsigned char* blocks;
+} Map;
+
+static void setBlocks(Map* map, unsigned int x0, unsigned int y0,
+                      unsigned int x1, unsigned int y1, unsigned char passable) {
+    // Keep a solid border.
+    if (x0 < 1) x0 = 1;
+    if (y0 < 1) y0 = 1;
+    if (x1 > map->size - 2) x1 = map->size - 2;
+    if (y1 > map->size - 2) y1 = map->size - 2;
+    for (unsigned int y = y0; y <= y1; ++y) {
+        for (unsigned int x = x0; x <= x1; ++x) {
+            map->blocks[y * map->size + x] = passable;
+        }
+    }
+}
+
+/** Open caves from thresholded noise, with narrow passages between them and
+ * some pockets that can't be reached from the rest */
+static void generateCave(Map* map) {
+    const float ox = (float) randomRange(0, 10000);
+    const float oy = (float) randomRange(0, 10000);
+    for (unsigned int y = 1; y < map->size - 1; ++y) {
+        for (unsigned int x = 1; x < map->size - 1; ++x) {
+            const float noise = snoise2(ox + x * 0.05f, oy + y * 0.05f) +
+                    0.5f * snoise2(ox + x * 0.15f, oy + y * 0.15f);
+            map->blocks[y * map->size + x] = noise > -0.2f;
+        }
+    }
+}
+
+/** Rooms connected in a chain by corridors one block wide, so most paths
+ * run through long corridors. Every eighth room is walled in. */
+static void generateDungeon(Map* map) {
+    const unsigned int count = map->size * map->size / 256;
+    unsigned int* rooms = malloc(count * 4 * sizeof (unsigned int));
+    if (!rooms) {
+        fprintf(stderr, "Out of memory while generating dungeon.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (unsigned int i = 0; i < count; ++i) {
+        unsigned int* room = &rooms[i * 4];
+        room[0] = randomRange(2, map->size - 14);
+        room[1] = randomRange(2, map->size - 14);
+        room[2] = room[0] + randomRange(2, 9);
+        room[3] = room[1] + randomRange(2, 9);
+        if (i % 8) {
+            setBlocks(map, room[0], room[1], room[2], room[3], 1);
+        }
+    }
+
+    // Connect the centers of consecutive rooms, first along x then along y.
+    for (unsigned int i = 1, previous = 0; i < count; ++i) {
+        unsigned int ax, ay, bx, by;
+        if (!(i % 8)) {
+            continue;
+        }
+        ax = (rooms[previous * 4] + rooms[previous * 4 + 2]) / 2;
+        ay = (rooms[previous * 4 + 1] + rooms[previous * 4 + 3]) / 2;
+        bx = (rooms[i * 4] + rooms[i * 4 + 2]) / 2;
+        by = (rooms[i * 4 + 1] + rooms[i * 4 + 3]) / 2;
+        setBlocks(map, ax < bx ? ax : bx, ay, ax < bx ? bx : ax, ay, 1);
+        setBlocks(map, bx, ay < by ? ay : by, bx, ay < by ? by : ay, 1);
+        previous = i;
+    }
+
+    // Wall in the sealed rooms last, cutting corridors running through them.
+    for (unsigned int i = 0; i < count; i += 8) {
+        const unsigned int* room = &rooms[i * 4];
+        setBlocks(map, room[0] - 1, room[1] - 1, room[2] + 1, room[3] + 1, 0);
+        setBlocks(map, room[0], room[1], room[2], room[3], 1);
+    }
+
+    free(rooms);
+}
+
+static void generateMap(Map* map, const char* name, unsigned int size) {
+    map->name = name;
+    map->size = size;
+    if (!(map->blocks = calloc(size * size, 1))) {
+        fprintf(stderr, "Out of memory while allocating map.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (strcmp(name, "cave") == 0) {
+        generateCave(map);
+    } else {
+        generateDungeon(map);
+    }
+}
+
+/** Passability callback for searches without a grid, like the game's */
+static int isPassable(const void* userdata, float x, float y) {
+    const Map* map = userdata;
+    return x >= 0 && y >= 0 && x < map->size && y < map->size &&
+            map->blocks[(unsigned int) y * map->size + (unsigned int) x];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Queries
+///////////////////////////////////////////////////////////////////////////////
+
+/** Kinds of queries run on each map */
+typedef enum {
+    /** Any two positions connected to each other */
+    QUERY_RANDOM,
+    /** Connected positions at least half the map size apart */
+    QUERY_FAR,
+    /** Positions that are not connected, so the search has to fail, starting
+     * in the largest area, so that it has to look at a lot before it does */
+    QUERY_UNREACHABLE,
+    /** Connected positions at least an eighth of the map size apart, with
+     * the shortest path BENCH_DETOUR times as long as that or longer, such
+     * as for goals in dead ends opening away from the start */
+    QUERY_DETOUR,
+    QUERY_COUNT
+} QueryKind;
+
+static const char* gQueryNames[QUERY_COUNT] = {"random", "far", "unreachable", "detour"};
+
+static vec2 randomPosition(const Map* map) {
+    vec2 position;
+    do {
+        position.d.x = randomRange(1, map->size - 2) + 0.5f;
+        position.d.y = randomRange(1, map->size - 2) + 0.5f;
+    } while (!isPassable(map, position.d.x, position.d.y));
+    return position;
+}
+
+/** Finds a position that's likely in the largest connected area, by picking
+ * the one connected to most others of a few random ones */
+static vec2 findAnchor(const Map* map, const AStarGrid* grid) {
+    vec2 candidates[16];
+    unsigned int best = 0, bestCount = 0;
+    for (unsigned int i = 0; i < 16; ++i) {
+        candidates[i] = randomPosition(map);
+    }
+    for (unsigned int i = 0; i < 16; ++i) {
+        unsigned int count = 0;
+        for (unsigned int j = 0; j < 16; ++j) {
+            count += AS_IsGridConnected(grid, &candidates[i], &candidates[j]);
+        }
+        if (count > bestCount) {
+            best = i;
+            bestCount = count;
+        }
+    }
+    return candidates[best];
+}
+
+/** Picks start and goal positions for a kind of query; the grid is only used
+ * to check whether they are connected, and to measure detours with the
+ * context, which should use the optimal policy */
+static int generateQuery(const Map* map, const AStarGrid* grid, AStarContext* context,
+                         const vec2* anchor, QueryKind kind, vec2* start, vec2* goal) {
+    float length;
+    for (unsigned int i = 0; i < BENCH_QUERY_TRIES; ++i) {
+        *start = randomPosition(map);
+        *goal = randomPosition(map);
+        switch (kind) {
+            case QUERY_RANDOM:
+                if (AS_IsGridConnected(grid, start, goal)) {
+                    return 1;
+                }
+                break;
+            case QUERY_FAR:
+                if (v2distance(start, goal) >= map->size / 2 &&
+                    AS_IsGridConnected(grid, start, goal)) {
+                    return 1;
+                }
+                break;
+            case QUERY_UNREACHABLE:
+                if (AS_IsGridConnected(grid, anchor, start) &&
+                    !AS_IsGridConnected(grid, start, goal)) {
+                    return 1;
+                }
+                break;
+            default:
+                if (v2distance(start, goal) >= map->size / 8 &&
+                    AS_SearchGrid(context, start, goal, grid, NULL, NULL, &length) > 0 &&
+                    length >= BENCH_DETOUR * v2distance(start, goal)) {
+                    return 1;
+                }
+                break;
+        }
+    }
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Methods
+///////////////////////////////////////////////////////////////////////////////
+
+/** Ways to search that are compared */
+typedef enum {
+    /** Passability callback, as used by AStar() */
+    METHOD_CALLBACK,
+    /** Passability grid, scanning for jump points */
+    METHOD_GRID,
+    /** Passability grid, searching from both ends */
+    METHOD_BIDIRECTIONAL,
+    /** Passability grid with jump tables */
+    METHOD_JUMP_TABLES,
+    /** Passability grid with jump tables and landmarks */
+    METHOD_LANDMARKS,
+    /** As METHOD_LANDMARKS, searching from both ends */
+    METHOD_LANDMARKS_BIDIRECTIONAL,
+    /** As METHOD_LANDMARKS, with the search policies */
+    METHOD_OPTIMAL,
+    METHOD_WEIGHTED_SMALL,
+    METHOD_WEIGHTED_LARGE,
+    METHOD_FOCAL,
+    /** Hierarchy over a grid with jump tables and landmarks, as in the game */
+    METHOD_HIERARCHY,
+    METHOD_COUNT
+} Method;
+
+/** How a context and grid are set up for a method */
+typedef struct {
+    const char* name;
+    int jumpTables;
+    int landmarks;
+    int bidirectional;
+    AStarPolicy policy;
+    float factor;
+} MethodSetup;
+
+static const MethodSetup gMethods[METHOD_COUNT] = {
+    {"callback", 0, 0, 0, ASTAR_POLICY_DEFAULT, 0},
+    {"grid", 0, 0, 0, ASTAR_POLICY_DEFAULT, 0},
+    {"grid+bi", 0, 0, 1, ASTAR_POLICY_DEFAULT, 0},
+    {"jps+", 1, 0, 0, ASTAR_POLICY_DEFAULT, 0},
+    {"jps+alt", 1, 1, 0, ASTAR_POLICY_DEFAULT, 0},
+    {"jps+alt+bi", 1, 1, 1, ASTAR_POLICY_DEFAULT, 0},
+    {"jps+alt+optimal", 1, 1, 0, ASTAR_POLICY_OPTIMAL, 0},
+    {"jps+alt+weighted1.2", 1, 1, 0, ASTAR_POLICY_WEIGHTED, 1.2f},
+    {"jps+alt+weighted2", 1, 1, 0, ASTAR_POLICY_WEIGHTED, 2.0f},
+    {"jps+alt+focal0.1", 1, 1, 0, ASTAR_POLICY_FOCAL, 0.1f},
+    {"hierarchy", 1, 1, 0, ASTAR_POLICY_DEFAULT, 0}
+};
+
+/** Everything searches on a map need */
+typedef struct {
+    const Map* map;
+    AStarContext* context;
+    AStarGrid* grid;
+    AStarHierarchy* hierarchy;
+    AStarLandmarks* landmarks;
+} Searcher;
+
+static void setupMethod(Searcher* searcher, Method method) {
+    const MethodSetup* setup = &gMethods[method];
+    AS_SetGridJumpTables(searcher->grid, setup->jumpTables);
+    AS_SetSearchLandmarks(searcher->context, setup->landmarks ? searcher->landmarks : NULL);
+    AS_SetSearchBidirectional(searcher->context, setup->bidirectional);
+    AS_SetSearchPolicy(searcher->context, setup->policy, setup->factor);
+    if (method == METHOD_HIERARCHY) {
+        AS_UpdateHierarchy(searcher->context, searcher->hierarchy);
+    }
+}
+
+static int search(Searcher* searcher, Method method, const vec2* start, const vec2* goal,
+                  vec2* path, unsigned int* depth, float* length) {
+    switch (method) {
+        case METHOD_CALLBACK:
+            return AS_Search(searcher->context, start, goal, isPassable, searcher->map,
+                             searcher->map->size, path, depth, length);
+        case METHOD_HIERARCHY:
+            return AS_SearchHierarchy(searcher->context, searcher->hierarchy,
+                                      start, goal, path, depth, length);
+        default:
+            return AS_SearchGrid(searcher->context, start, goal, searcher->grid,
+                                 path, depth, length);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Running
+///////////////////////////////////////////////////////////////////////////////
+
+static int compareDoubles(const void* a, const void* b) {
+    const double da = *(const double*) a, db = *(const double*) b;
+    return (da > db) - (da < db);
+}
+
+/** Nearest rank percentile of sorted values */
+static double percentile(const double* sorted, unsigned int count, unsigned int percent) {
+    return sorted[(count - 1) * percent / 100];
+}
+
+/** Whether the next result written is the first, for the separators */
+static int gFirstResult = 1;
+
+static void runCase(Searcher* searcher, Method method, QueryKind kind,
+                    const vec2* starts, const vec2* goals, unsigned int count) {
+    double* latencies = malloc(count * sizeof (double));
+    vec2 path[BENCH_PATH_DEPTH];
+    unsigned long expanded;
+    unsigned int done = 0, found = 0;
+    double total = 0, length = 0;
+
+    if (!latencies) {
+        fprintf(stderr, "Out of memory while allocating latencies.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    setupMethod(searcher, method);
+    expanded = AS_GetSearchExpansions(searcher->context);
+
+    T_Start();
+    while (done < count && total < gTimeLimit * 1000000.0) {
+        unsigned int depth = BENCH_PATH_DEPTH;
+        float pathLength = 0;
+        const double begin = T_GetElapsedTimeInMicroSec();
+        if (search(searcher, method, &starts[done], &goals[done], path, &depth, &pathLength) > 0) {
+            ++found;
+            length += pathLength;
+        }
+        total = T_GetElapsedTimeInMicroSec();
+        latencies[done++] = total - begin;
+    }
+    T_Stop();
+
+    expanded = AS_GetSearchExpansions(searcher->context) - expanded;
+    qsort(latencies, done, sizeof (double), compareDoubles);
+
+    printf("%s\n    {\"map\": \"%s\", \"size\": %u, \"method\": \"%s\", \"queries\": \"%s\", "
+           "\"count\": %u, \"found\": %u, \"queries_per_second\": %.1f, "
+           "\"expanded\": %lu, \"expanded_per_query\": %.1f, "
+           "\"p50_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f, \"mean_length\": %.2f}",
+           gFirstResult ? "" : ",", searcher->map->name, searcher->map->size,
+           gMethods[method].name, gQueryNames[kind], done, found,
+           total > 0 ? done / (total / 1000000.0) : 0.0,
+           expanded, (double) expanded / done,
+           percentile(latencies, done, 50), percentile(latencies, done, 99),
+           latencies[done - 1], found ? length / found : 0.0);
+    gFirstResult = 0;
+    fflush(stdout);
+
+    free(latencies);
+}
+
+static void runMap(const char* name, unsigned int size) {
+    vec2* starts = malloc(gQueries * sizeof (vec2));
+    vec2* goals = malloc(gQueries * sizeof (vec2));
+    Searcher searcher;
+    vec2 anchor;
+    Map map;
+
+    if (!starts || !goals) {
+        fprintf(stderr, "Out of memory while allocating queries.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Seed per map, so maps and queries don't depend on which others ran.
+    seedRandom(gSeed + size * 31 + (unsigned int) name[0]);
+    generateMap(&map, name, size);
+    fprintf(stderr, "%s %ux%u\n", name, size, size);
+
+    searcher.map = &map;
+    searcher.context = AS_NewContext();
+    searcher.grid = AS_NewGrid(size);
+    for (unsigned int y = 0; y < size; ++y) {
+        for (unsigned int x = 0; x < size; ++x) {
+            AS_SetGridPassable(searcher.grid, x, y, map.blocks[y * size + x]);
+        }
+    }
+    searcher.hierarchy = AS_NewHierarchy(searcher.grid);
+    searcher.landmarks = AS_NewLandmarks(BENCH_LANDMARKS);
+    AS_UpdateLandmarks(searcher.context, searcher.landmarks, searcher.grid);
+    anchor = findAnchor(&map, searcher.grid);
+
+    for (unsigned int kind = 0; kind < QUERY_COUNT; ++kind) {
+        unsigned int count = 0;
+        setupMethod(&searcher, METHOD_OPTIMAL);
+        while (count < gQueries &&
+               generateQuery(&map, searcher.grid, searcher.context, &anchor, kind,
+                             &starts[count], &goals[count])) {
+            ++count;
+        }
+        if (!count) {
+            fprintf(stderr, "  no %s queries on this map, skipped\n", gQueryNames[kind]);
+            continue;
+        }
+        for (unsigned int method = 0; method < METHOD_COUNT; ++method) {
+            fprintf(stderr, "  %s %s\n", gQueryNames[kind], gMethods[method].name);
+            runCase(&searcher, method, kind, starts, goals, count);
+        }
+    }
+
+    AS_DeleteLandmarks(searcher.landmarks);
+    AS_DeleteHierarchy(searcher.hierarchy);
+    AS_DeleteGrid(searcher.grid);
+    AS_DeleteContext(searcher.context);
+    free(map.blocks);
+    free(goals);
+    free(starts);
+}
+
+int main(int argc, char** argv) {
+    int i;
+    for (i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-q") == 0) {
+            gQueries = (unsigned int) atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-s") == 0) {
+            gSeed = (unsigned int) atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-t") == 0) {
+            gTimeLimit = atof(argv[i + 1]);
+        } else if (strcmp(argv[i], "-m") == 0) {
+            gMaxSize = (unsigned int) atoi(argv[i + 1]);
+        } else {
+            break;
+        }
+    }
+    if (i < argc || !gQueries) {
+        fprintf(stderr, "Usage: %s [-q queries] [-s seed] [-t seconds] [-m max_size]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    T_Init();
+
+    printf("{\n  \"seed\": %u,\n  \"queries\": %u,\n  \"granularity\": %d,\n  \"results\": [",
+           gSeed, gQueries, ASTAR_GRANULARITY);
+    for (unsigned int size = 0; size < sizeof (gSizes) / sizeof (gSizes[0]); ++size) {
+        if (gSizes[size] > gMaxSize) {
+            break;
+        }
+        runMap("cave", gSizes[size]);
+        runMap("dungeon", gSizes[size]);
+    }
+    printf("\n  ]\n}\n");
+
+    return EXIT_SUCCESS;
+}
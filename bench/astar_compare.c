@@ -0,0 +1,130 @@
+/*
+ * Headless benchmark of AStar() alone, the one search function every
+ * revision since the sorted array open set has, so that its speed can be
+ * compared between two revisions of astar.c. Runs seeded random queries on
+ * noise caves and writes the results as JSON to stdout.
+ *
+ * Built against a revision's astar.c by the bench Makefile, see "compare"
+ * there. Found counts should match between revisions, and mean lengths up
+ * to which of equally short paths is taken; if they don't, the searches
+ * being compared aren't the same.
+ *
+ * Usage: astar_compare [-q queries] [-s seed] [-m size]
+ *
+ * Author: fnuecke
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "astar.h"
+#include "simplexnoise.h"
+#include "timer.h"
+
+/** Path nodes returned per search, as in the game */
+#define COMPARE_PATH_DEPTH 32
+
+/** Queries per map */
+static unsigned int gQueries = 200;
+
+/** Seed for the map and queries */
+static unsigned int gSeed = 1;
+
+/** Map size, in blocks */
+static unsigned int gSize = 256;
+
+/** The map, one byte per block, non-zero where passable; global because
+ * AStar()'s callback gets no user data */
+static unsigned char* gBlocks;
+
+/** State of the random number generator, as in astar_bench.c */
+static unsigned int gRandom;
+
+static unsigned int randomRange(unsigned int min, unsigned int max) {
+    // xorshift32
+    gRandom ^= gRandom << 13;
+    gRandom ^= gRandom >> 17;
+    gRandom ^= gRandom << 5;
+    return min + gRandom % (max - min + 1);
+}
+
+static int isPassable(float x, float y) {
+    return x >= 0 && y >= 0 && x < gSize && y < gSize &&
+            gBlocks[(unsigned int) y * gSize + (unsigned int) x];
+}
+
+static vec2 randomPosition(void) {
+    vec2 position;
+    do {
+        position.d.x = randomRange(1, gSize - 2) + 0.5f;
+        position.d.y = randomRange(1, gSize - 2) + 0.5f;
+    } while (!isPassable(position.d.x, position.d.y));
+    return position;
+}
+
+int main(int argc, char** argv) {
+    vec2 path[COMPARE_PATH_DEPTH];
+    unsigned int found = 0;
+    double total, length = 0;
+    float ox, oy;
+    int i;
+
+    for (i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-q") == 0) {
+            gQueries = (unsigned int) atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-s") == 0) {
+            gSeed = (unsigned int) atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-m") == 0) {
+            gSize = (unsigned int) atoi(argv[i + 1]);
+        } else {
+            break;
+        }
+    }
+    if (i < argc || !gQueries || gSize < 16) {
+        fprintf(stderr, "Usage: %s [-q queries] [-s seed] [-m size]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Open caves from thresholded noise, as the cave maps of astar_bench.c,
+    // with a solid border.
+    if (!(gBlocks = calloc(gSize * gSize, 1))) {
+        fprintf(stderr, "Out of memory while allocating map.\n");
+        return EXIT_FAILURE;
+    }
+    gRandom = gSeed ? gSeed : 1;
+    ox = (float) randomRange(0, 10000);
+    oy = (float) randomRange(0, 10000);
+    for (unsigned int y = 1; y < gSize - 1; ++y) {
+        for (unsigned int x = 1; x < gSize - 1; ++x) {
+            const float noise = snoise2(ox + x * 0.05f, oy + y * 0.05f) +
+                    0.5f * snoise2(ox + x * 0.15f, oy + y * 0.15f);
+            gBlocks[y * gSize + x] = noise > -0.2f;
+        }
+    }
+
+    T_Init();
+    T_Start();
+    for (unsigned int query = 0; query < gQueries; ++query) {
+        const vec2 start = randomPosition();
+        const vec2 goal = randomPosition();
+        unsigned int depth = COMPARE_PATH_DEPTH;
+        float pathLength = 0;
+        if (AStar(&start, &goal, isPassable, gSize, path, &depth, &pathLength)) {
+            ++found;
+            length += pathLength;
+        }
+    }
+    total = T_GetElapsedTimeInMicroSec();
+    T_Stop();
+
+    printf("{\"map\": \"cave\", \"size\": %u, \"seed\": %u, \"jps\": %d, "
+           "\"count\": %u, \"found\": %u, \"queries_per_second\": %.1f, "
+           "\"mean_length\": %.2f}\n",
+           gSize, gSeed, ASTAR_JPS, gQueries, found,
+           total > 0 ? gQueries / (total / 1000000.0) : 0.0,
+           found ? length / found : 0.0);
+
+    free(gBlocks);
+    return EXIT_SUCCESS;
+}
@@ -110,9 +110,17 @@ extern "C" {
     // AI
     ///////////////////////////////////////////////////////////////////////////////
 
-    /** Maximum path length a unit can keep track of */
+    /** Initial size of path search buffers, which grow to fit longer paths */
 #define MP_AI_PATH_DEPTH 32
 
+    /** Fixed point steps per block for stored paths (must be a multiple of 4,
+     * so the A* waypoints are stored exactly) */
+#define MP_AI_PATH_PRECISION 64
+
+    /** Largest supported map size, limited by the fixed point range of stored
+     * paths (MP_AI_PATH_PRECISION steps per block in an unsigned short) */
+#define MP_MAP_SIZE_MAX 1023
+
     /** Whether to use interpolation for estimating path segment lengths */
 #define MP_AI_PATH_INTERPOLATE 1
 
@@ -125,6 +133,46 @@ extern "C" {
     /** Bonus accounted to a worker that's already on a job when checking if closer */
 #define MP_AI_ALREADY_WORKING_BONUS 0.5f
 
+    /** Whether to precompute jump distances (JPS+) for path searches */
+#define MP_AI_JUMP_TABLES 1
+
+    /** Number of landmarks per passability grid for the path search heuristic (ALT) */
+#define MP_AI_LANDMARKS 8
+
+    /** Search policy and its weight or epsilon for paths units move along */
+#define MP_AI_MOVE_POLICY ASTAR_POLICY_WEIGHTED
+#define MP_AI_MOVE_FACTOR 1.2f
+
+    /** Search policy and its weight for finding the nearest jobs, which only
+     * needs rough distances */
+#define MP_AI_JOB_POLICY ASTAR_POLICY_WEIGHTED
+#define MP_AI_JOB_FACTOR 2.0f
+
+    /** Size of the buckets jobs are sorted into for finding the nearest ones, in blocks */
+#define MP_AI_JOB_BUCKET 8
+
+    /** Number of jobs allocated at a time, jobs are kept in pages of this size */
+#define MP_AI_JOB_PAGE 256
+
+    /** Number of units that may look for jobs per frame, the others wait */
+#define MP_AI_JOB_SEARCH_BUDGET 8
+
+    /** Seconds units that found no job wait before looking again, unless
+     * they're woken up earlier because a job was added or blocks changed */
+#define MP_AI_JOB_WAIT 10
+
+    /** Number of worker threads searching requested paths, zero to search on the main thread */
+#define MP_AI_PATH_WORKERS 2
+
+    /** Node expansions per frame shared by all path requests */
+#define MP_AI_PATH_BUDGET 40000
+
+    /** Minimum node expansions per frame for each path request that's searched */
+#define MP_AI_PATH_SLICE 1000
+
+    /** Size of the regions used to find the paths crossing a changed block, in blocks */
+#define MP_AI_PATH_REGION 8
+
     ///////////////////////////////////////////////////////////////////////////////
     // Camera
     ///////////////////////////////////////////////////////////////////////////////
@@ -267,6 +315,9 @@ extern "C" {
     /** Maximum number of units a single player have at a time */
 #define MP_UNITS_MAX_PER_PLAYER 100
 
+    /** Number of units allocated at a time, units are kept in pages of this size */
+#define MP_UNIT_PAGE 64
+
 #ifdef	__cplusplus
 }
 #endif
@@ -26,8 +26,8 @@ static void renderPathing(const MP_Unit* unit) {
 
     // If we display pathing render the units current path.
     if (MP_DBG_drawPaths && MP_IsUnitMoving(unit)) {
-        const vec2* path = unit->ai->pathing.nodes;
-        const unsigned int depth = unit->ai->pathing.depth;
+        const unsigned int depth = MP_GetPathDepth(unit->ai->pathing.path);
+        vec2 path[4];
 
         if (!quadratic) {
             quadratic = gluNewQuadric();
@@ -45,18 +45,27 @@ static void renderPathing(const MP_Unit* unit) {
         glBegin(GL_LINES);
         {
             unsigned int j = 0;
-            glVertex3f(path[1].d.x * MP_BLOCK_SIZE, path[1].d.y * MP_BLOCK_SIZE, MP_D_DRAW_PATH_HEIGHT);
+            // Keep the four nodes of the current segment, shifting in the
+            // next one for each segment.
+            path[1] = MP_GetUnitPathNode(unit, 0);
+            path[2] = MP_GetUnitPathNode(unit, 1);
+            path[3] = MP_GetUnitPathNode(unit, 2);
+            glVertex3f(path[2].d.x * MP_BLOCK_SIZE, path[2].d.y * MP_BLOCK_SIZE, MP_D_DRAW_PATH_HEIGHT);
             for (j = 2; j <= depth; ++j) {
+                path[0] = path[1];
+                path[1] = path[2];
+                path[2] = path[3];
+                path[3] = MP_GetUnitPathNode(unit, j + 1);
                 // Somewhere in the middle, smooth the path.
                 for (unsigned int k = 1; k < 20; ++k) {
                     const float t = k / 20.0f;
-                    const float x = cr(path[j - 2].d.x, path[j - 1].d.x, path[j].d.x, path[j + 1].d.x, t);
-                    const float y = cr(path[j - 2].d.y, path[j - 1].d.y, path[j].d.y, path[j + 1].d.y, t);
+                    const float x = cr(path[0].d.x, path[1].d.x, path[2].d.x, path[3].d.x, t);
+                    const float y = cr(path[0].d.y, path[1].d.y, path[2].d.y, path[3].d.y, t);
                     glVertex3f(x * MP_BLOCK_SIZE, y * MP_BLOCK_SIZE, MP_D_DRAW_PATH_HEIGHT);
                     glVertex3f(x * MP_BLOCK_SIZE, y * MP_BLOCK_SIZE, MP_D_DRAW_PATH_HEIGHT);
                 }
             }
-            glVertex3f(path[j - 1].d.x * MP_BLOCK_SIZE, path[j - 1].d.y * MP_BLOCK_SIZE, MP_D_DRAW_PATH_HEIGHT);
+            glVertex3f(path[2].d.x * MP_BLOCK_SIZE, path[2].d.y * MP_BLOCK_SIZE, MP_D_DRAW_PATH_HEIGHT);
         }
         glEnd();
 
@@ -67,8 +76,9 @@ static void renderPathing(const MP_Unit* unit) {
         MP_SetMaterial(&material);
 
         for (unsigned int j = 1; j <= depth; ++j) {
+            const vec2 node = MP_GetUnitPathNode(unit, j);
             MP_PushModelMatrix();
-            MP_TranslateModelMatrix(path[j].d.x * MP_BLOCK_SIZE, path[j].d.y * MP_BLOCK_SIZE, MP_D_DRAW_PATH_HEIGHT);
+            MP_TranslateModelMatrix(node.d.x * MP_BLOCK_SIZE, node.d.y * MP_BLOCK_SIZE, MP_D_DRAW_PATH_HEIGHT);
             gluSphere(quadratic, 0.5f, 8, 8);
             MP_PopModelMatrix();
         }
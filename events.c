@@ -281,10 +281,14 @@ MP_EVENT_IMPL(ModelMatrixChanged, (), void)
 
 MP_EVENT_IMPL(UnitAdded, (unit), MP_Unit* unit)
 
+MP_EVENT_IMPL(JobAdded, (job), MP_Job* job)
+
 MP_EVENT_IMPL(BlockTypeChanged, (block), MP_Block* block)
 
 MP_EVENT_IMPL(BlockOwnerChanged, (block), MP_Block* block)
 
+MP_EVENT_IMPL(BlockRoomChanged, (block), MP_Block* block)
+
 MP_EVENT_IMPL(BlockSelectionChanged, (block, player), MP_Block* block, MP_Player player)
 
 #undef MP_EVENT_IMPL
@@ -32,10 +32,14 @@ void MP_Dispatch##NAME##Event(__VA_ARGS__)
 
     MP_EVENT(UnitAdded, MP_Unit*);
 
+    MP_EVENT(JobAdded, MP_Job*);
+
     MP_EVENT(BlockTypeChanged, MP_Block*);
 
     MP_EVENT(BlockOwnerChanged, MP_Block*);
 
+    MP_EVENT(BlockRoomChanged, MP_Block*);
+
     MP_EVENT(BlockSelectionChanged, MP_Block*, MP_Player);
 
 #undef MP_EVENT
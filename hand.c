@@ -68,10 +68,10 @@ void MP_DropTopHandEntry(MP_Player player, const vec2* position) {
                         entry->unit->position = *position;
                         entry->unit->ai->isInHand = false;
                         // Don't continue moving (would jump the unit to that path).
-                        entry->unit->ai->pathing.index = entry->unit->ai->pathing.depth + 1;
+                        MP_StopMoving(entry->unit);
                         // Immediately look for a new job.
-                        entry->unit->ai->state.jobSearchDelay = 0;
-                        entry->unit->ai->state.jobRunDelay = 0;
+                        *entry->unit->ai->state.jobSearchDelay = 0;
+                        *entry->unit->ai->state.jobRunDelay = 0;
 
                         // Drop successful.
                         --gObjectsInHandCount[player];
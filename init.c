@@ -6,6 +6,7 @@
 #include <GL/glew.h>
 
 #include "astar.h"
+#include "astar_mp.h"
 #include "block.h"
 #include "camera.h"
 #include "config.h"
@@ -17,6 +18,7 @@
 #include "selection.h"
 #include "textures.h"
 #include "unit.h"
+#include "unit_ai.h"
 #include "camera.h"
 #include "cursor.h"
 #include "job.h"
@@ -93,7 +95,9 @@ void MP_Init(void) {
     MP_InitCamera();
     MP_InitCursor();
     MP_InitSelection();
+    MP_InitAStar();
     MP_InitUnits();
+    MP_InitAI();
     MP_InitMap();
     MP_InitJobs();
     MP_InitLuaEvents();
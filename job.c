@@ -1,8 +1,13 @@
 #include <assert.h>
 #include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "astar_mp.h"
+#include "events.h"
 #include "job.h"
 #include "job_type.h"
 #include "log.h"
@@ -14,6 +19,27 @@
 // Globals
 ///////////////////////////////////////////////////////////////////////////////
 
+/**
+ * Job handles consist of the slot the job is stored in plus one, so that zero
+ * is never used, and in the remaining upper bits a generation that is bumped
+ * whenever the slot is reused.
+ */
+#define JOB_HANDLE_SLOT_BITS 20
+#define JOB_HANDLE_SLOT_MASK ((1u << JOB_HANDLE_SLOT_BITS) - 1)
+
+/** Pages jobs are allocated from, each holding MP_AI_JOB_PAGE jobs. Pages
+ * are never moved, so pointers to jobs stay valid while they exist */
+static MP_Job** gJobPages = NULL;
+static unsigned int gJobPageCount = 0;
+
+/** Number of slots in the pages that were used so far */
+static unsigned int gJobSlotCount = 0;
+
+/** Slots of deleted jobs that can be reused, and their capacity */
+static unsigned int* gFreeJobSlots = NULL;
+static unsigned int gFreeJobSlotsCount = 0;
+static unsigned int gFreeJobSlotsCapacity = 0;
+
 /** List of all current jobs, per player, per type */
 static MP_Job** gJobs[MP_PLAYER_COUNT][MP_TYPE_ID_MAX];
 
@@ -23,10 +49,176 @@ static unsigned int gJobsCount[MP_PLAYER_COUNT][MP_TYPE_ID_MAX];
 /** Capacity of the workplace lists */
 static unsigned int gJobsCapacity[MP_PLAYER_COUNT][MP_TYPE_ID_MAX];
 
+/** The jobs searched in MP_FindJobs and their positions, and their capacity */
+static MP_Job** gJobCandidates = NULL;
+static vec2* gJobPositions = NULL;
+static unsigned int gJobPositionsCapacity = 0;
+
+/** Indices of the jobs found in MP_FindJobs and the distances to them, and
+ * their capacity */
+static unsigned int* gJobResults = NULL;
+static float* gJobDistances = NULL;
+static unsigned int gJobResultsCapacity = 0;
+
+/** A job in the spatial index, with its position cached */
+typedef struct {
+    MP_Job* job;
+    vec2 position;
+} JobEntry;
+
+/** The jobs in one cell of the spatial index */
+typedef struct {
+    JobEntry* entries;
+    unsigned int count;
+    unsigned int capacity;
+} JobBucket;
+
+/** Jobs of one type of one player, sorted into buckets by their position */
+typedef struct {
+    /** Buckets of MP_AI_JOB_BUCKET blocks, stored row by row */
+    JobBucket* buckets;
+
+    /** Number of buckets per row and column */
+    unsigned int size;
+
+    /** Jobs whose position isn't fixed, e.g. because they target units, so
+     * they're not in any bucket and their position isn't cached */
+    JobBucket unbucketed;
+} JobIndex;
+
+/** Spatial indices per player, per type */
+static JobIndex gJobIndices[MP_PLAYER_COUNT][MP_TYPE_ID_MAX];
+
+/** Distance field towards all jobs of a type, for one passability mask */
+typedef struct {
+    /** The passability types the field was computed for */
+    MP_Passability mask;
+
+    /** The actual field */
+    AStarField* field;
+} JobField;
+
+/** Distance fields for all jobs of one type of one player */
+typedef struct {
+    /** The fields for all passability masks searched so far */
+    JobField* fields;
+    unsigned int count;
+    unsigned int capacity;
+
+    /** Number of jobs targeting units, which move and aren't in fields */
+    unsigned int unitJobs;
+} JobFields;
+
+/** Distance fields per player, per type */
+static JobFields gJobFields[MP_PLAYER_COUNT][MP_TYPE_ID_MAX];
+
+/** Jobs targeting one object, see gTargets */
+typedef struct {
+    /** The targeted block, room or unit, null if the entry is free */
+    const void* target;
+
+    /** First job targeting it, the others are linked via nextForTarget */
+    MP_Job* head;
+} TargetEntry;
+
+/**
+ * Reverse index from targeted objects to the jobs targeting them, of all
+ * players and types. Hash table with linear probing, the capacity is a power
+ * of two and kept at least twice the number of entries.
+ */
+static TargetEntry* gTargets = NULL;
+static unsigned int gTargetsCount = 0;
+static unsigned int gTargetsCapacity = 0;
+
+/** Data passed along to the accept callback when searching jobs */
+typedef struct {
+    /** The unit we're finding jobs for */
+    const MP_Unit* unit;
+
+    /** The list of jobs that is being searched */
+    MP_Job* const* jobs;
+} JobSearch;
+
 ///////////////////////////////////////////////////////////////////////////////
 // Allocation
 ///////////////////////////////////////////////////////////////////////////////
 
+inline static MP_Job* getSlot(unsigned int slot) {
+    return &gJobPages[slot / MP_AI_JOB_PAGE][slot % MP_AI_JOB_PAGE];
+}
+
+/** Takes a job from the pages, reusing the slot of a deleted one if possible */
+static MP_Job* allocateJob(void) {
+    MP_JobHandle handle;
+    MP_Job* job;
+
+    if (gFreeJobSlotsCount) {
+        job = getSlot(gFreeJobSlots[--gFreeJobSlotsCount]);
+        // Next generation, so handles to the deleted job no longer match.
+        handle = job->handle + (1u << JOB_HANDLE_SLOT_BITS);
+    } else {
+        if (gJobSlotCount >= JOB_HANDLE_SLOT_MASK) {
+            MP_log_fatal("Too many jobs.\n");
+        }
+        if (gJobSlotCount >= gJobPageCount * MP_AI_JOB_PAGE) {
+            if (!(gJobPages = realloc(gJobPages, (gJobPageCount + 1) * sizeof (MP_Job*))) ||
+                !(gJobPages[gJobPageCount] = calloc(MP_AI_JOB_PAGE, sizeof (MP_Job)))) {
+                MP_log_fatal("Out of memory while allocating a job page.\n");
+            }
+            ++gJobPageCount;
+        }
+        job = getSlot(gJobSlotCount++);
+        handle = gJobSlotCount;
+    }
+
+    memset(job, 0, sizeof (MP_Job));
+    job->handle = handle;
+    return job;
+}
+
+/** Returns the slot of a job to the pages, invalidating its handle */
+static void releaseJob(MP_Job* job) {
+    if (gFreeJobSlotsCount >= gFreeJobSlotsCapacity) {
+        gFreeJobSlotsCapacity = gFreeJobSlotsCapacity * 2 + 1;
+        if (!(gFreeJobSlots = realloc(gFreeJobSlots, gFreeJobSlotsCapacity * sizeof (unsigned int)))) {
+            MP_log_fatal("Out of memory while resizing free job list.\n");
+        }
+    }
+    gFreeJobSlots[gFreeJobSlotsCount++] = (job->handle & JOB_HANDLE_SLOT_MASK) - 1;
+
+    // Mark it as unused, which MP_GetJob checks.
+    job->type = NULL;
+}
+
+static void ensurePositionCapacity(unsigned int count) {
+    if (count > gJobPositionsCapacity) {
+        gJobPositionsCapacity = count * 2;
+        if (!(gJobCandidates = realloc(gJobCandidates, gJobPositionsCapacity * sizeof (MP_Job*))) ||
+            !(gJobPositions = realloc(gJobPositions, gJobPositionsCapacity * sizeof (vec2)))) {
+            MP_log_fatal("Out of memory while resizing job position list.\n");
+        }
+    }
+}
+
+static void ensureResultCapacity(unsigned int count) {
+    if (count > gJobResultsCapacity) {
+        gJobResultsCapacity = count;
+        if (!(gJobResults = realloc(gJobResults, gJobResultsCapacity * sizeof (unsigned int))) ||
+            !(gJobDistances = realloc(gJobDistances, gJobResultsCapacity * sizeof (float)))) {
+            MP_log_fatal("Out of memory while resizing job result list.\n");
+        }
+    }
+}
+
+static void ensureBucketCapacity(JobBucket* bucket) {
+    if (bucket->count >= bucket->capacity) {
+        bucket->capacity = bucket->capacity * 2 + 1;
+        if (!(bucket->entries = realloc(bucket->entries, bucket->capacity * sizeof (JobEntry)))) {
+            MP_log_fatal("Out of memory while resizing job bucket.\n");
+        }
+    }
+}
+
 static void ensureListCapacity(MP_Player player, unsigned int index) {
     if (gJobsCount[player][index] >= gJobsCapacity[player][index]) {
         gJobsCapacity[player][index] = gJobsCapacity[player][index] * 2 + 1;
@@ -37,79 +229,270 @@ static void ensureListCapacity(MP_Player player, unsigned int index) {
     }
 }
 
-static void deleteJob(MP_Player player, unsigned int index, unsigned int number) {
-    assert(gJobsCount[player][index] > number);
+/** Whether the position of a job never changes, so it can be bucketed */
+inline static bool hasFixedPosition(const MP_Job* job) {
+    return job->targetType == MP_JOB_TARGET_BLOCK || job->targetType == MP_JOB_TARGET_NONE;
+}
+
+/** Gets the bucket row or column a map coordinate is in */
+inline static int toBucket(const JobIndex* jobIndex, float coordinate) {
+    const unsigned int bucket = coordinate > 0 ? (unsigned int) coordinate / MP_AI_JOB_BUCKET : 0;
+    return bucket < jobIndex->size ? (int) bucket : (int) jobIndex->size - 1;
+}
+
+/** Gets the bucket a job is stored in, with its position if it's fixed */
+static JobBucket* getBucket(JobIndex* jobIndex, const MP_Job* job, vec2* position) {
+    if (!hasFixedPosition(job)) {
+        return &jobIndex->unbucketed;
+    }
+
+    if (!jobIndex->buckets) {
+        // First job with a position, allocate the buckets for this map.
+        jobIndex->size = MP_GetMapSize() / MP_AI_JOB_BUCKET + 1;
+        if (!(jobIndex->buckets = calloc(jobIndex->size * jobIndex->size, sizeof (JobBucket)))) {
+            MP_log_fatal("Out of memory while allocating job buckets.\n");
+        }
+    }
+
+    *position = MP_GetJobPosition(job);
+    return &jobIndex->buckets[toBucket(jobIndex, position->d.y) * jobIndex->size +
+            toBucket(jobIndex, position->d.x)];
+}
+
+static void indexJob(MP_Player player, unsigned int index, MP_Job* job) {
+    JobEntry* entry;
+    vec2 position = ZERO_VEC2;
+    JobBucket* bucket = getBucket(&gJobIndices[player][index], job, &position);
+
+    ensureBucketCapacity(bucket);
+    entry = &bucket->entries[bucket->count++];
+    entry->job = job;
+    entry->position = position;
+}
+
+static void unindexJob(MP_Player player, unsigned int index, const MP_Job* job) {
+    vec2 position;
+    JobBucket* bucket = getBucket(&gJobIndices[player][index], job, &position);
+
+    for (unsigned int i = 0; i < bucket->count; ++i) {
+        if (bucket->entries[i].job == job) {
+            bucket->entries[i] = bucket->entries[--bucket->count];
+            return;
+        }
+    }
+
+    assert(!"trying to remove job that's not in its bucket");
+}
+
+inline static unsigned int hashTarget(const void* target) {
+    // Allocations are aligned, so the lowest bits are always the same.
+    return (unsigned int) ((uintptr_t) target >> 3) * 2654435761u;
+}
+
+/** Gets the entry of a target, or the free one where it would go */
+static TargetEntry* findTarget(const void* target) {
+    const unsigned int mask = gTargetsCapacity - 1;
+    unsigned int i = hashTarget(target) & mask;
+    while (gTargets[i].target && gTargets[i].target != target) {
+        i = (i + 1) & mask;
+    }
+    return &gTargets[i];
+}
+
+static void ensureTargetCapacity(void) {
+    if ((gTargetsCount + 1) * 2 > gTargetsCapacity) {
+        TargetEntry* old = gTargets;
+        const unsigned int oldCapacity = gTargetsCapacity;
+
+        gTargetsCapacity = gTargetsCapacity ? gTargetsCapacity * 2 : 64;
+        if (!(gTargets = calloc(gTargetsCapacity, sizeof (TargetEntry)))) {
+            MP_log_fatal("Out of memory while resizing job target index.\n");
+        }
+        for (unsigned int i = 0; i < oldCapacity; ++i) {
+            if (old[i].target) {
+                *findTarget(old[i].target) = old[i];
+            }
+        }
+        free(old);
+    }
+}
+
+/** Gets the first of the jobs targeting an object, see nextForTarget */
+static MP_Job* getJobsTargeting(const void* target) {
+    return gTargetsCapacity ? findTarget(target)->head : NULL;
+}
+
+static void addTargetedJob(MP_Job* job) {
+    TargetEntry* entry;
+
+    if (!job->target) {
+        return;
+    }
+
+    ensureTargetCapacity();
+    entry = findTarget(job->target);
+    if (!entry->target) {
+        entry->target = job->target;
+        ++gTargetsCount;
+    }
+    job->previousForTarget = NULL;
+    job->nextForTarget = entry->head;
+    if (entry->head) {
+        entry->head->previousForTarget = job;
+    }
+    entry->head = job;
+}
+
+static void removeTargetedJob(MP_Job* job) {
+    const unsigned int mask = gTargetsCapacity - 1;
+    unsigned int hole, i;
+
+    if (!job->target) {
+        return;
+    }
+
+    if (job->nextForTarget) {
+        job->nextForTarget->previousForTarget = job->previousForTarget;
+    }
+    if (job->previousForTarget) {
+        job->previousForTarget->nextForTarget = job->nextForTarget;
+        return;
+    }
+
+    // It's the first job, update the entry, and remove it if it was the only one.
+    hole = findTarget(job->target) - gTargets;
+    assert(gTargets[hole].head == job);
+    if ((gTargets[hole].head = job->nextForTarget)) {
+        return;
+    }
+
+    // Shift back the entries after it that would otherwise not be found
+    // anymore, i.e. those for which the hole is between their hash and where
+    // they are.
+    for (i = (hole + 1) & mask; gTargets[i].target; i = (i + 1) & mask) {
+        const unsigned int home = hashTarget(gTargets[i].target) & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            gTargets[hole] = gTargets[i];
+            hole = i;
+        }
+    }
+    gTargets[hole].target = NULL;
+    gTargets[hole].head = NULL;
+    --gTargetsCount;
+}
+
+static void deleteJob(MP_Job* job) {
+    const unsigned int index = job->type->info.id - 1;
+    const MP_Player player = job->player;
+    JobFields* fields = &gJobFields[player][index];
+    MP_Job** list = gJobs[player][index];
+
+    assert(gJobsCount[player][index] > job->number);
+    assert(list[job->number] == job);
+
+    // Remove it from the distance fields and the indices.
+    unindexJob(player, index, job);
+    removeTargetedJob(job);
+    if (job->targetType == MP_JOB_TARGET_UNIT) {
+        --fields->unitJobs;
+    } else {
+        for (unsigned int i = 0; i < fields->count; ++i) {
+            AS_RemoveFieldTarget(fields->fields[i].field, job);
+        }
+    }
 
     // Notify worker that it's no longer needed.
-    MP_StopJob(gJobs[player][index][number]);
+    MP_StopJob(job);
 
-    // Free the actual memory.
-    free(gJobs[player][index][number]);
+    // Move the last job into the gap. Lists are iterated back to front when
+    // deleting, which keeps the jobs not visited yet where they are.
+    list[job->number] = list[--gJobsCount[player][index]];
+    list[job->number]->number = job->number;
 
-    // Move up the list entries to close the gap.
-    --gJobsCount[player][index];
-    memmove(&gJobs[player][index][number], &gJobs[player][index][number + 1],
-            (gJobsCount[player][index] - number) * sizeof (MP_Job*));
+    // Free the slot for reuse.
+    releaseJob(job);
 }
 
 /** Allocate a job and track it in our list */
-MP_Job* MP_NewJob(const MP_JobType* type, MP_Player player) {
+MP_Job* MP_NewJob(const MP_JobType* type, MP_Player player,
+                  MP_JobTargetType targetType, void* target, const vec2* offset) {
+    JobFields* fields;
     MP_Job* job;
     unsigned int index;
 
     assert(player > MP_PLAYER_NONE && player < MP_PLAYER_COUNT);
     assert(type);
+    assert(targetType == MP_JOB_TARGET_NONE || target);
+    assert(offset);
 
     // Allocate the actual job.
-    if (!(job = calloc(1, sizeof (MP_Job)))) {
-        MP_log_fatal("Out of memory while allocating a job.\n");
-    }
+    job = allocateJob();
     job->type = type;
     job->player = player;
+    job->targetType = targetType;
+    job->target = target;
+    job->offset = *offset;
 
     // Store it in our list. Ensure we have the capacity to do so.
     index = type->info.id - 1;
     ensureListCapacity(player, index);
-    gJobs[player][index][gJobsCount[player][index]++] = job;
+    job->number = gJobsCount[player][index]++;
+    gJobs[player][index][job->number] = job;
+
+    // Add it to the distance fields and the indices.
+    indexJob(player, index, job);
+    addTargetedJob(job);
+    fields = &gJobFields[player][index];
+    if (job->targetType == MP_JOB_TARGET_UNIT) {
+        ++fields->unitJobs;
+    } else {
+        const vec2 position = MP_GetJobPosition(job);
+        for (unsigned int i = 0; i < fields->count; ++i) {
+            AS_AddFieldTarget(fields->fields[i].field, &position, job);
+        }
+    }
+
+    // Let units waiting for work know.
+    MP_DispatchJobAddedEvent(job);
 
     return job;
 }
 
 /** Delete a job that is no longer used */
 void MP_DeleteJob(MP_Job* job) {
-    unsigned int index, player, count;
-
     assert(job);
 
-    index = job->type->info.id - 1;
-    player = job->player;
-    count = gJobsCount[player][index];
+    deleteJob(job);
+}
 
-    // Find the job.
-    for (unsigned int number = 0; number < count; ++number) {
-        if (gJobs[player][index][number] == job) {
-            // Found it.
-            deleteJob(player, index, number);
-            return;
+static void deleteJobsTargeting(MP_Player player, const MP_JobType* type, MP_JobTargetType targetType, const void* target) {
+    MP_Job* job;
+
+    assert(player > MP_PLAYER_NONE && player < MP_PLAYER_COUNT);
+    assert(type);
+    assert(target);
+
+    job = getJobsTargeting(target);
+    while (job) {
+        MP_Job* next = job->nextForTarget;
+        if (job->player == player && job->type == type && job->targetType == targetType) {
+            deleteJob(job);
         }
+        job = next;
     }
 }
 
-static void deleteJobsTargeting(MP_Player player, const MP_JobType* type, MP_JobTargetType targetType, const void* target) {
-    unsigned int index;
-
+static bool hasJobsTargeting(MP_Player player, const MP_JobType* type, MP_JobTargetType targetType, const void* target) {
     assert(player > MP_PLAYER_NONE && player < MP_PLAYER_COUNT);
     assert(type);
     assert(target);
 
-    // Run back to front so that deletions don't matter.
-    index = type->info.id - 1;
-    for (unsigned int number = gJobsCount[player][index]; number > 0; --number) {
-        MP_Job* job = gJobs[player][index][number - 1];
-        if (job->targetType == targetType && job->target == target) {
-            deleteJob(player, index, number - 1);
+    for (const MP_Job* job = getJobsTargeting(target); job; job = job->nextForTarget) {
+        if (job->player == player && job->type == type && job->targetType == targetType) {
+            return true;
         }
     }
+    return false;
 }
 
 void MP_DeleteJobsTargetingBlock(MP_Player player, const MP_JobType* type, const MP_Block* block) {
@@ -124,6 +507,18 @@ void MP_DeleteJobsTargetingUnit(MP_Player player, const MP_JobType* type, const
     deleteJobsTargeting(player, type, MP_JOB_TARGET_UNIT, unit);
 }
 
+bool MP_HasJobsTargetingBlock(MP_Player player, const MP_JobType* type, const MP_Block* block) {
+    return hasJobsTargeting(player, type, MP_JOB_TARGET_BLOCK, block);
+}
+
+bool MP_HasJobsTargetingRoom(MP_Player player, const MP_JobType* type, const MP_Room* room) {
+    return hasJobsTargeting(player, type, MP_JOB_TARGET_ROOM, room);
+}
+
+bool MP_HasJobsTargetingUnit(MP_Player player, const MP_JobType* type, const MP_Unit* unit) {
+    return hasJobsTargeting(player, type, MP_JOB_TARGET_UNIT, unit);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Utility
 ///////////////////////////////////////////////////////////////////////////////
@@ -168,17 +563,21 @@ vec2 MP_GetJobPosition(const MP_Job* job) {
 
 bool MP_RunJob(MP_Unit* unit, MP_Job* job, unsigned int* delay) {
     lua_State* L = MP_Lua();
+    const MP_JobType* type;
 
     assert(unit);
     assert(job);
 
-    if (job->type->runMethod == LUA_REFNIL) {
-        MP_log_warning("Trying to run job '%s', which has no 'run' method.\n", job->type->info.name);
+    // The script may delete the job, so don't access it afterwards.
+    type = job->type;
+
+    if (type->runMethod == LUA_REFNIL) {
+        MP_log_warning("Trying to run job '%s', which has no 'run' method.\n", type->info.name);
         return false;
     }
 
     // Try to get the callback.
-    lua_rawgeti(L, LUA_REGISTRYINDEX, job->type->runMethod);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, type->runMethod);
     if (lua_isfunction(L, -1)) {
         // Call it with the unit that we want to execute the script for.
         MP_Lua_PushUnit(L, unit);
@@ -208,10 +607,10 @@ bool MP_RunJob(MP_Unit* unit, MP_Job* job, unsigned int* delay) {
             return active;
         } else {
             // Something went wrong.
-            MP_log_error("In 'run' for job '%s': %s\n", job->type->info.name, lua_tostring(L, -1));
+            MP_log_error("In 'run' for job '%s': %s\n", type->info.name, lua_tostring(L, -1));
         }
     } else {
-        MP_log_error("'run' for job '%s' isn't a function anymore.\n", job->type->info.name);
+        MP_log_error("'run' for job '%s' isn't a function anymore.\n", type->info.name);
     }
 
     // Pop function or error message.
@@ -219,7 +618,7 @@ bool MP_RunJob(MP_Unit* unit, MP_Job* job, unsigned int* delay) {
 
     // We get here only on failure. In that case disable the run callback,
     // so we don't try this again.
-    MP_DisableJobRunMethod(job->type);
+    MP_DisableJobRunMethod(type);
 
     return false;
 }
@@ -267,10 +666,122 @@ float MP_GetDynamicPreference(MP_Unit* unit, const MP_JobType* type) {
     return 0;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Searching
+///////////////////////////////////////////////////////////////////////////////
+
+/** Decides whether a unit should take a job it can reach via a path of the given length */
+static bool shouldTakeJob(const MP_Unit* unit, const MP_Job* job, const vec2* position, float length) {
+    // Check if it's occupied, and if so only take it if our path is better
+    // than the direct distance to the occupant.
+    if (job->worker && job->worker != unit) {
+        // This is not fail-safe, e.g.  if we're on the other side of a very
+        // long wall, but it should be good enough in most cases, and at least
+        // guarantees that *when* we steal the job, we're really closer.
+        const float workerDistance = v2distance(&job->worker->position, position);
+        if (workerDistance <= length + MP_AI_ALREADY_WORKING_BONUS) {
+            // The one that's on it is better suited, ignore job.
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/** Accept callback for multi-target searches, see shouldTakeJob */
+static int acceptJob(const void* userdata, unsigned int target, float length) {
+    const JobSearch* search = userdata;
+    return shouldTakeJob(search->unit, search->jobs[target], &gJobPositions[target], length);
+}
+
+/** Adds the jobs in the buckets at Chebyshev distance (inner, outer] from a
+ * bucket to the candidates for MP_FindJobs */
+static unsigned int gatherBuckets(const JobIndex* jobIndex, int bx, int by, int inner, int outer,
+                                  unsigned int candidates) {
+    const int x0 = bx - outer > 0 ? bx - outer : 0;
+    const int y0 = by - outer > 0 ? by - outer : 0;
+    const int x1 = bx + outer < (int) jobIndex->size - 1 ? bx + outer : (int) jobIndex->size - 1;
+    const int y1 = by + outer < (int) jobIndex->size - 1 ? by + outer : (int) jobIndex->size - 1;
+
+    for (int y = y0; y <= y1; ++y) {
+        for (int x = x0; x <= x1; ++x) {
+            const JobBucket* bucket = &jobIndex->buckets[y * jobIndex->size + x];
+            if (abs(x - bx) <= inner && abs(y - by) <= inner) {
+                // Gathered before.
+                continue;
+            }
+            ensurePositionCapacity(candidates + bucket->count);
+            for (unsigned int i = 0; i < bucket->count; ++i) {
+                gJobCandidates[candidates] = bucket->entries[i].job;
+                gJobPositions[candidates] = bucket->entries[i].position;
+                ++candidates;
+            }
+        }
+    }
+
+    return candidates;
+}
+
+/**
+ * Gets the up-to-date distance field towards all jobs of a type, for the
+ * specified passability types. Returns null if jobs of that type target
+ * units, because those move around.
+ */
+static const AStarField* getJobField(MP_Player player, unsigned int index, MP_Passability mask) {
+    JobFields* fields = &gJobFields[player][index];
+    JobField* entry = NULL;
+
+    if (fields->unitJobs) {
+        return NULL;
+    }
+
+    for (unsigned int i = 0; i < fields->count; ++i) {
+        if (fields->fields[i].mask == mask) {
+            entry = &fields->fields[i];
+            break;
+        }
+    }
+
+    if (!entry) {
+        // Not searched for this mask yet, create the field.
+        if (fields->count >= fields->capacity) {
+            fields->capacity = fields->capacity * 2 + 1;
+            if (!(fields->fields = realloc(fields->fields, fields->capacity * sizeof (JobField)))) {
+                MP_log_fatal("Out of memory while resizing job field list.\n");
+            }
+        }
+        entry = &fields->fields[fields->count++];
+        entry->mask = mask;
+        entry->field = AS_NewField();
+        for (unsigned int number = 0; number < gJobsCount[player][index]; ++number) {
+            MP_Job* job = gJobs[player][index][number];
+            const vec2 position = MP_GetJobPosition(job);
+            AS_AddFieldTarget(entry->field, &position, job);
+        }
+    }
+
+    MP_UpdateField(entry->field, mask);
+
+    return entry->field;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Accessors
 ///////////////////////////////////////////////////////////////////////////////
 
+MP_Job* MP_GetJob(MP_JobHandle handle) {
+    // For zero this wraps around, which is never a used slot.
+    const unsigned int slot = (handle & JOB_HANDLE_SLOT_MASK) - 1;
+    MP_Job* job;
+
+    if (slot >= gJobSlotCount) {
+        return NULL;
+    }
+
+    job = getSlot(slot);
+    return job->type && job->handle == handle ? job : NULL;
+}
+
 MP_JobList MP_GetJobs(const MP_JobType* type, MP_Player player, unsigned int* count) {
     unsigned int index;
 
@@ -283,80 +794,207 @@ MP_JobList MP_GetJobs(const MP_JobType* type, MP_Player player, unsigned int* co
     return gJobs[player][index];
 }
 
-MP_Job* MP_FindJob(const MP_Unit* unit, const MP_JobType* type, float* distance) {
-    MP_Job* closestJob = NULL;
-    float closestDistance = FLT_MAX;
-    unsigned int index;
+unsigned int MP_FindJobs(const MP_Unit* unit, const MP_JobType* type,
+                         MP_Job** jobs, float* distances, unsigned int count) {
+    const JobIndex* jobIndex;
+    JobSearch search;
+    unsigned int index, candidates = 0, found = 0;
+    int bx, by, radius, gathered = -1;
 
     assert(unit);
     assert(type);
+    assert(jobs || !count);
 
     index = type->info.id - 1;
-    ensureListCapacity(unit->owner, index);
+    if (!gJobsCount[unit->owner][index] || !count) {
+        return 0;
+    }
 
-    // Loop through all jobs of the specified type for the owner of the unit.
-    for (unsigned int number = 0; number < gJobsCount[unit->owner][index]; ++number) {
-        MP_Job* job = gJobs[unit->owner][index][number];
+    jobIndex = &gJobIndices[unit->owner][index];
 
-        // Based on the job type we use the target's position.
-        vec2 position = MP_GetJobPosition(job);
+    // Jobs that aren't in buckets are always searched, get their current
+    // position based on their target.
+    ensurePositionCapacity(jobIndex->unbucketed.count);
+    for (; candidates < jobIndex->unbucketed.count; ++candidates) {
+        gJobCandidates[candidates] = jobIndex->unbucketed.entries[candidates].job;
+        gJobPositions[candidates] = MP_GetJobPosition(gJobCandidates[candidates]);
+    }
 
-        // Test direct distance; if that's longer than our best we
-        // can safely skip this one.
-        float currentDistance = v2distance(&unit->position, &position);
-        if (currentDistance >= closestDistance) {
+    // Find the closest ones with a single search from the unit, instead of
+    // finding a path to each one. We're not really interested in the actual
+    // paths, though, only their lengths. Only search the jobs in the buckets
+    // around the unit, and look further out until the found ones are closer
+    // than any job in the buckets we didn't look at.
+    search.unit = unit;
+    ensureResultCapacity(count);
+    bx = toBucket(jobIndex, unit->position.d.x);
+    by = toBucket(jobIndex, unit->position.d.y);
+
+    // With only a few jobs the heuristic is cheap, and searching all of them
+    // at once beats searching again when the closest ones are far away.
+    radius = gJobsCount[unit->owner][index] > MP_AI_JOB_BUCKET * MP_AI_JOB_BUCKET ? 0 : INT_MAX / 2;
+    for (;;) {
+        const bool complete = !jobIndex->size ||
+                (bx - radius <= 0 && by - radius <= 0 &&
+                bx + radius >= (int) jobIndex->size - 1 && by + radius >= (int) jobIndex->size - 1);
+        float bound = FLT_MAX, farthest = 0;
+
+        if (jobIndex->size) {
+            candidates = gatherBuckets(jobIndex, bx, by, gathered, radius, candidates);
+            gathered = radius;
+        }
+        if (candidates < count && !complete) {
+            // Can't have enough yet.
+            radius = radius * 2 + 1;
             continue;
         }
 
-        // Find a path to it. We're not really interested in the actual path,
-        // though, so pass null for that.
-        if (MP_AStar(unit, &position, NULL, NULL, &currentDistance)) {
-            // Got a path, check its length.
-            if (currentDistance < closestDistance) {
-                // Got a new best. Check if it's occupied, and if so
-                // only take it if our path is better than the
-                // direct distance to the occupant.
-                if (job->worker && job->worker != unit) {
-                    // This is not fail-safe, e.g.  if we're on the other side
-                    // of a very long wall, but it should be good enough in most
-                    // cases, and at least guarantees that *when* we steal the
-                    // job, we're really closer.
-                    const float workerDistance = v2distance(&job->worker->position, &position);
-                    if (workerDistance <= currentDistance + MP_AI_ALREADY_WORKING_BONUS) {
-                        // The one that's on it is better suited, ignore job.
-                        continue;
-                    }
-                }
+        search.jobs = gJobCandidates;
+        found = MP_AStarNearest(unit, gJobPositions, candidates, acceptJob, &search,
+                                gJobResults, gJobDistances, count,
+                                MP_AI_JOB_POLICY, MP_AI_JOB_FACTOR);
+        if (complete) {
+            break;
+        }
+
+        // Paths are never shorter than the straight line, so jobs in the
+        // buckets we didn't look at are at least as far away as the closest
+        // edge of the ones we did, ignoring edges of the map.
+        if (bx - radius > 0) {
+            bound = fminf(bound, unit->position.d.x - (bx - radius) * MP_AI_JOB_BUCKET);
+        }
+        if (by - radius > 0) {
+            bound = fminf(bound, unit->position.d.y - (by - radius) * MP_AI_JOB_BUCKET);
+        }
+        if (bx + radius < (int) jobIndex->size - 1) {
+            bound = fminf(bound, (bx + radius + 1) * MP_AI_JOB_BUCKET - unit->position.d.x);
+        }
+        if (by + radius < (int) jobIndex->size - 1) {
+            bound = fminf(bound, (by + radius + 1) * MP_AI_JOB_BUCKET - unit->position.d.y);
+        }
+        // Weighted searches may find jobs slightly out of order.
+        for (unsigned int i = 0; i < found; ++i) {
+            farthest = fmaxf(farthest, gJobDistances[i]);
+        }
+        if (found == count && farthest <= bound) {
+            break;
+        }
+        if (found == count) {
+            // Only closer jobs can be better, which are all in the buckets
+            // up to that distance, so the next search is the last one.
+            radius = (int) fmaxf(radius + 1, ceilf(farthest / MP_AI_JOB_BUCKET));
+        } else {
+            radius = radius * 2 + 1;
+        }
+    }
+
+    for (unsigned int i = 0; i < found; ++i) {
+        jobs[i] = gJobCandidates[gJobResults[i]];
+        if (distances) {
+            distances[i] = gJobDistances[i];
+        }
+    }
+
+    return found;
+}
 
-                // Copy data.
-                closestDistance = currentDistance;
-                closestJob = job;
+MP_Job* MP_FindJob(const MP_Unit* unit, const MP_JobType* type, float* distance) {
+    const AStarField* field;
+    MP_Job* closestJob = NULL;
+    float closestDistance;
+
+    assert(unit);
+    assert(type);
+
+    // Try following the distance field shared by all units first, which is
+    // a lot cheaper than searching. If the nearest job is better left to
+    // its current worker we need to search for the next best one, though.
+    if ((field = getJobField(unit->owner, type->info.id - 1, unit->type->canPass))) {
+        void* target;
+        if (!MP_SearchField(unit, field, NULL, &closestDistance, &target)) {
+            // Can't reach any job of this type.
+            return NULL;
+        }
+        closestJob = target;
+        {
+            const vec2 position = MP_GetJobPosition(closestJob);
+            if (!shouldTakeJob(unit, closestJob, &position, closestDistance)) {
+                closestJob = NULL;
             }
         }
     }
 
-    // Return distance if desired.
-    if (distance && closestJob) {
+    if ((closestJob || MP_FindJobs(unit, type, &closestJob, &closestDistance, 1)) && distance) {
+        // Return distance if desired.
         *distance = closestDistance;
     }
 
     return closestJob;
 }
 
+bool MP_FindJobPath(const MP_Unit* unit, const MP_Job* job,
+                    MP_PathHandle* path, float* length) {
+    const AStarField* field;
+    void* target;
+    MP_PathHandle fieldPath = 0;
+    float fieldLength;
+
+    assert(unit);
+    assert(job);
+    assert(path);
+
+    // The field leads to the nearest job, so only use the path if that's the
+    // one we're looking for. Don't touch the output otherwise.
+    if (!(field = getJobField(job->player, job->type->info.id - 1, unit->type->canPass)) ||
+        !MP_SearchField(unit, field, &fieldPath, &fieldLength, &target) ||
+        target != job) {
+        MP_ReleasePath(fieldPath);
+        return false;
+    }
+
+    *path = fieldPath;
+    if (length) {
+        *length = fieldLength;
+    }
+    return true;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Init / Teardown
 ///////////////////////////////////////////////////////////////////////////////
 
 void MP_ClearJobs(void) {
+    free(gTargets);
+    gTargets = NULL;
+    gTargetsCount = 0;
+    gTargetsCapacity = 0;
+
     for (unsigned int player = 0; player < MP_PLAYER_COUNT; ++player) {
         for (unsigned int typeId = 0; typeId < MP_TYPE_ID_MAX; ++typeId) {
+            // Keep the pages, so that handles to these jobs stay invalid.
             for (unsigned int number = 0; number < gJobsCount[player][typeId]; ++number) {
-                free(gJobs[player][typeId][number]);
+                releaseJob(gJobs[player][typeId][number]);
             }
             free(gJobs[player][typeId]);
             gJobs[player][typeId] = NULL;
             gJobsCount[player][typeId] = 0;
             gJobsCapacity[player][typeId] = 0;
+
+            for (unsigned int i = 0; i < gJobFields[player][typeId].count; ++i) {
+                AS_DeleteField(gJobFields[player][typeId].fields[i].field);
+            }
+            free(gJobFields[player][typeId].fields);
+            memset(&gJobFields[player][typeId], 0, sizeof (JobFields));
+
+            {
+                JobIndex* jobIndex = &gJobIndices[player][typeId];
+                for (unsigned int i = 0; i < jobIndex->size * jobIndex->size; ++i) {
+                    free(jobIndex->buckets[i].entries);
+                }
+                free(jobIndex->buckets);
+                free(jobIndex->unbucketed.entries);
+                memset(jobIndex, 0, sizeof (JobIndex));
+            }
         }
     }
 }
@@ -365,4 +1003,6 @@ void MP_InitJobs(void) {
     memset(gJobs, 0, MP_PLAYER_COUNT * MP_TYPE_ID_MAX * sizeof (MP_Job**));
     memset(gJobsCount, 0, MP_PLAYER_COUNT * MP_TYPE_ID_MAX * sizeof (unsigned int));
     memset(gJobsCapacity, 0, MP_PLAYER_COUNT * MP_TYPE_ID_MAX * sizeof (unsigned int));
+    memset(gJobFields, 0, MP_PLAYER_COUNT * MP_TYPE_ID_MAX * sizeof (JobFields));
+    memset(gJobIndices, 0, MP_PLAYER_COUNT * MP_TYPE_ID_MAX * sizeof (JobIndex));
 }
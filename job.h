@@ -7,6 +7,7 @@
 #ifndef JOB_H
 #define	JOB_H
 
+#include "astar_mp.h"
 #include "types.h"
 #include "vmath.h"
 
@@ -73,21 +74,39 @@ extern "C" {
 
         /** Offset to the target position; absolute, if there is no target */
         vec2 offset;
+
+        /** Index of the job in the list of jobs of its type (see MP_GetJobs) */
+        unsigned int number;
+
+        /** Other jobs with the same target, of any player and type */
+        MP_Job* previousForTarget;
+        MP_Job* nextForTarget;
+
+        /** Handle referring to this job, see MP_GetJob */
+        MP_JobHandle handle;
     };
 
     /**
      * Allocates a new job that will be tracked and can be found via the
-     * FindJob method.
-     * @param player the player for whom to create the job.
+     * FindJob method. The target of a job can't be changed afterwards.
      * @param meta the type of the job to create.
+     * @param player the player for whom to create the job.
+     * @param targetType the type of the targeted object.
+     * @param target the targeted object, if any.
+     * @param offset the offset to the target position; absolute, if there is
+     * no target.
      * @return the newly created job.
      */
-    MP_Job* MP_NewJob(const MP_JobType* type, MP_Player player);
+    MP_Job* MP_NewJob(const MP_JobType* type, MP_Player player,
+            MP_JobTargetType targetType, void* target, const vec2* offset);
 
     /**
-     * Deletes a job. This frees the memory the job occupies, so all pointers to
-     * it will be invalid after calling this. It will also tell any units
-     * working on this job to stop doing so.
+     * Deletes a job. The memory the job occupies is reused for later jobs, so
+     * all pointers to it will be invalid after calling this, while handles to
+     * it can still be checked via MP_GetJob. It will also tell any units
+     * working on this job to stop doing so. The last job in the list of its
+     * type takes its place, so lists should be iterated back to front when
+     * deleting jobs.
      * @param job the job to delete.
      */
     void MP_DeleteJob(MP_Job* job);
@@ -119,6 +138,33 @@ extern "C" {
      */
     void MP_DeleteJobsTargetingUnit(MP_Player player, const MP_JobType* type, const MP_Unit* unit);
 
+    /**
+     * Checks whether there are jobs targeting the specified block.
+     * @param player the player for whom to check the jobs.
+     * @param type the type of job to check for.
+     * @param block the targeted block to check for.
+     * @return whether there is at least one such job.
+     */
+    bool MP_HasJobsTargetingBlock(MP_Player player, const MP_JobType* type, const MP_Block* block);
+
+    /**
+     * Checks whether there are jobs targeting the specified room.
+     * @param player the player for whom to check the jobs.
+     * @param type the type of job to check for.
+     * @param room the targeted room to check for.
+     * @return whether there is at least one such job.
+     */
+    bool MP_HasJobsTargetingRoom(MP_Player player, const MP_JobType* type, const MP_Room* room);
+
+    /**
+     * Checks whether there are jobs targeting the specified unit.
+     * @param player the player for whom to check the jobs.
+     * @param type the type of job to check for.
+     * @param unit the targeted unit to check for.
+     * @return whether there is at least one such job.
+     */
+    bool MP_HasJobsTargetingUnit(MP_Player player, const MP_JobType* type, const MP_Unit* unit);
+
     /**
      * Get a list of all jobs of the specified type, as well as the size of that
      * list.
@@ -129,6 +175,14 @@ extern "C" {
      */
     MP_JobList MP_GetJobs(const MP_JobType* meta, MP_Player player, unsigned int* count);
 
+    /**
+     * Get the job a handle refers to. Handles stay valid until the job is
+     * deleted, so unlike pointers they can be kept around safely.
+     * @param handle the handle of the job, see MP_Job.handle.
+     * @return the job, or null if it has been deleted.
+     */
+    MP_Job* MP_GetJob(MP_JobHandle handle);
+
     /**
      * Get the actual position of a job, i.e. that of its target including the
      * set offset.
@@ -137,6 +191,20 @@ extern "C" {
      */
     vec2 MP_GetJobPosition(const MP_Job* job);
 
+    /**
+     * Find the jobs of the specified type closest to the specified unit, using
+     * a single search from the unit. Jobs that are being worked on by another
+     * unit which is closer to them are skipped.
+     * @param unit the unit to find the jobs for.
+     * @param type the type of job we're looking for.
+     * @param jobs used to return the found jobs, closest first.
+     * @param distances used to return the distances to the found jobs, if not null.
+     * @param count the maximum number of jobs to find.
+     * @return the number of jobs found.
+     */
+    unsigned int MP_FindJobs(const MP_Unit* unit, const MP_JobType* type,
+            MP_Job** jobs, float* distances, unsigned int count);
+
     /**
      * Find the job of the specified type closest to the specified unit.
      * @param unit the unit to find the job for.
@@ -146,6 +214,21 @@ extern "C" {
      */
     MP_Job* MP_FindJob(const MP_Unit* unit, const MP_JobType* type, float* distance);
 
+    /**
+     * Find a path from a unit to a job by following the distance field shared
+     * by all units looking for jobs of that type. This only works if the job
+     * is the closest of its type to the unit, otherwise this fails without
+     * modifying the output, and a regular search has to be used.
+     * @param unit the unit to find the path for.
+     * @param job the job to find the path to.
+     * @param path used to return the found path, which the caller has to
+     * release (see MP_ReleasePath).
+     * @param length the length of the found path.
+     * @return true if a path was found, false otherwise.
+     */
+    bool MP_FindJobPath(const MP_Unit* unit, const MP_Job* job,
+            MP_PathHandle* path, float* length);
+
     /**
      * Clear all job lists and free all additional memory.
      */
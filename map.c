@@ -1229,6 +1229,8 @@ float MP_GetBlockDepthUnderCursor(void) {
 ///////////////////////////////////////////////////////////////////////////////
 
 void MP_SetMapSize(unsigned short size, const MP_BlockType* fillWith) {
+    assert(size <= MP_MAP_SIZE_MAX);
+
     gCursorBlock = NULL;
 
     // Reallocate data only if the size changed.
@@ -5,6 +5,7 @@
 #include "log.h"
 #include "room.h"
 #include "block.h"
+#include "events.h"
 #include "map.h"
 
 /** A room consists of multiple nodes, thus spanning multiple blocks */
@@ -243,6 +244,8 @@ void MP_SetRoom(MP_Block* block, const MP_RoomType* type) {
     } else {
         removeNode(block);
     }
+
+    MP_DispatchBlockRoomChangedEvent(block);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
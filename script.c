@@ -355,7 +355,7 @@ static int lua_Import(lua_State* L) {
 static int lua_SetMapSize(lua_State* L) {
     unsigned int size = luaL_checkunsigned(L, 1);
     const MP_BlockType* type = MP_Lua_CheckBlockType(L, 2);
-    if (size < 1) {
+    if (size < 1 || size > MP_MAP_SIZE_MAX) {
         return luaL_error(L, "invalid map size");
     }
     MP_SetMapSize(size, type);
@@ -1,10 +1,19 @@
 #include "ability_type.h"
 #include "block_type.h"
+#include "job.h"
 #include "job_type.h"
 #include "room_type.h"
 #include "script.h"
+#include "unit.h"
 #include "unit_type.h"
 
+#define MP_LUA_TYPE_IMPL(NAME, LIBNAME) \
+const MP_##NAME##Type* MP_Lua_Check##NAME##Type(lua_State* L, int narg) { \
+    const MP_##NAME##Type* type = MP_Get##NAME##TypeByName(luaL_checkstring(L, narg)); \
+    luaL_argcheck(L, type != NULL, narg, "invalid '" LIBNAME "' type"); \
+    return type; \
+}
+
 #define MP_LUA_LIBRARY_IMPL(NAME, LIBNAME) \
 void MP_Lua_Push##NAME(lua_State* L, MP_##NAME* value) { \
     if (value) { \
@@ -26,16 +35,43 @@ MP_##NAME* MP_Lua_Check##NAME(lua_State* L, int narg) { \
     luaL_argcheck(L, ud != NULL, narg, "'" LIBNAME "' expected"); \
     return *(MP_##NAME**) ud; \
 } \
-const MP_##NAME##Type* MP_Lua_Check##NAME##Type(lua_State* L, int narg) { \
-    const MP_##NAME##Type* type = MP_Get##NAME##TypeByName(luaL_checkstring(L, narg)); \
-    luaL_argcheck(L, type != NULL, narg, "invalid '" LIBNAME "' type"); \
-    return type; \
-}
+MP_LUA_TYPE_IMPL(NAME, LIBNAME)
+
+#define MP_LUA_HANDLE_IMPL(NAME, LIBNAME) \
+void MP_Lua_Push##NAME(lua_State* L, MP_##NAME* value) { \
+    if (value) { \
+        MP_##NAME##Handle* ud = (MP_##NAME##Handle*) lua_newuserdata(L, sizeof (MP_##NAME##Handle)); \
+        *ud = value->handle; \
+        luaL_setmetatable(L, LIBNAME); \
+    } else { \
+        lua_pushnil(L); \
+    } \
+} \
+bool MP_Lua_Is##NAME(lua_State* L, int narg) { \
+    return luaL_testudata(L, narg, LIBNAME) != NULL; \
+} \
+MP_##NAME* MP_Lua_To##NAME(lua_State* L, int narg) { \
+    return MP_Get##NAME(*(MP_##NAME##Handle*) lua_touserdata(L, narg)); \
+} \
+MP_##NAME* MP_Lua_Check##NAME(lua_State* L, int narg) { \
+    MP_##NAME* value; \
+    void* ud = luaL_checkudata(L, narg, LIBNAME); \
+    luaL_argcheck(L, ud != NULL, narg, "'" LIBNAME "' expected"); \
+    value = MP_Get##NAME(*(MP_##NAME##Handle*) ud); \
+    luaL_argcheck(L, value != NULL, narg, "'" LIBNAME "' no longer exists"); \
+    return value; \
+} \
+MP_LUA_TYPE_IMPL(NAME, LIBNAME)
 
 MP_LUA_LIBRARY_IMPL(Ability, LUA_ABILITYLIBNAME)
-MP_LUA_LIBRARY_IMPL(Job, LUA_JOBLIBNAME)
 MP_LUA_LIBRARY_IMPL(Block, LUA_BLOCKLIBNAME)
-MP_LUA_LIBRARY_IMPL(Unit, LUA_UNITLIBNAME)
 MP_LUA_LIBRARY_IMPL(Room, LUA_ROOMLIBNAME)
 
+// Jobs and units come and go, and scripts may hold on to them longer than
+// they exist, so we store their handles instead, and check them on access.
+MP_LUA_HANDLE_IMPL(Job, LUA_JOBLIBNAME)
+MP_LUA_HANDLE_IMPL(Unit, LUA_UNITLIBNAME)
+
+#undef MP_LUA_HANDLE_IMPL
 #undef MP_LUA_LIBRARY_IMPL
+#undef MP_LUA_TYPE_IMPL
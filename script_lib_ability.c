@@ -17,7 +17,7 @@ static int lua_GetUnit(lua_State* L) {
 static int lua_GetCooldown(lua_State* L) {
     MP_Ability* ability = MP_Lua_CheckAbility(L, 1);
 
-    lua_pushnumber(L, ability->cooldown / (float) MP_FRAMERATE);
+    lua_pushnumber(L, *ability->cooldown / (float) MP_FRAMERATE);
 
     return 1;
 }
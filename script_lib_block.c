@@ -139,22 +139,13 @@ static int lua_IsTargetOfJobByType(lua_State* L) {
     const MP_Block* block = MP_Lua_CheckBlock(L, 1);
     const MP_Player player = MP_Lua_CheckPlayer(L, 2);
     const MP_JobType* meta = MP_Lua_CheckJobType(L, 3);
-    unsigned int count;
 
     if (player == MP_PLAYER_NONE) {
         return luaL_argerror(L, 2, "invalid player value");
-    } else {
-        MP_JobList jobs = MP_GetJobs(meta, player, &count);
-        for (unsigned int i = 0; i < count; ++i) {
-            if (jobs[i]->targetType == MP_JOB_TARGET_BLOCK &&
-                (const MP_Block*) jobs[i]->target == block) {
-                lua_pushboolean(L, true);
-                return 1;
-            }
-        }
-        lua_pushboolean(L, false);
     }
 
+    lua_pushboolean(L, MP_HasJobsTargetingBlock(player, meta, block));
+
     return 1;
 }
 
@@ -9,16 +9,24 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 typedef struct JobIter {
-    MP_JobList jobs;
+    const MP_JobType* type;
+    MP_Player player;
     unsigned int i;
 } JobIter;
 
 static int lua_JobIter(lua_State* L) {
     JobIter* iter = (JobIter*) lua_touserdata(L, lua_upvalueindex(1));
-
-    // We iterate back to front, to allow deletion of current entry.
+    unsigned int count;
+    // Get the list anew, it may have been reallocated since the last call.
+    MP_JobList jobs = MP_GetJobs(iter->type, iter->player, &count);
+
+    // We iterate back to front, to allow deletion of current entry. Skip
+    // ahead if more than that was deleted.
+    if (iter->i > count) {
+        iter->i = count;
+    }
     if (iter->i > 0) {
-        MP_Lua_PushJob(L, iter->jobs[--iter->i]);
+        MP_Lua_PushJob(L, jobs[--iter->i]);
         return 1;
     }
 
@@ -35,7 +43,9 @@ static int lua_GetByType(lua_State* L) {
     }
 
     iter = (JobIter*) lua_newuserdata(L, sizeof (JobIter));
-    iter->jobs = MP_GetJobs(type, player, &iter->i);
+    iter->type = type;
+    iter->player = player;
+    MP_GetJobs(type, player, &iter->i);
 
     lua_pushcclosure(L, lua_JobIter, 1);
 
@@ -92,7 +102,6 @@ static int lua_GetTarget(lua_State* L) {
 ///////////////////////////////////////////////////////////////////////////////
 
 static int lua_CreateJob(lua_State* L) {
-    MP_Job* job;
     const MP_JobType* type;
     MP_Player player = MP_PLAYER_NONE;
     MP_JobTargetType targetType = MP_JOB_TARGET_NONE;
@@ -181,11 +190,8 @@ static int lua_CreateJob(lua_State* L) {
     luaL_argcheck(L, target != NULL, 1, "must set 'target'");
     luaL_argcheck(L, player != MP_PLAYER_NONE, 1, "must set 'player'");
 
-    // Allocate job and set values.
-    job = MP_NewJob(type, player);
-    job->targetType = targetType;
-    job->target = target;
-    job->offset = offset;
+    // Allocate job.
+    MP_NewJob(type, player, targetType, target, &offset);
 
     return 0;
 }
@@ -1,5 +1,6 @@
 #include "ability.h"
 #include "ability_type.h"
+#include "job.h"
 #include "job_type.h"
 #include "script.h"
 #include "unit.h"
@@ -39,7 +40,7 @@ static int lua_GetCanPass(lua_State* L) {
 static int lua_GetJob(lua_State* L) {
     const MP_Unit* unit = MP_Lua_CheckUnit(L, 1);
 
-    MP_Lua_PushJob(L, unit->ai->state.job);
+    MP_Lua_PushJob(L, MP_GetJob(unit->ai->state.job));
 
     return 1;
 }
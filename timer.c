@@ -74,6 +74,18 @@ double T_GetElapsedTimeInMicroSec(void) {
     return gEndTimeInMicroSec - gStartTimeInMicroSec;
 }
 
+double T_GetTimeInMicroSec(void) {
+#ifdef WIN32
+    LARGE_INTEGER count;
+    QueryPerformanceCounter(&count);
+    return count.QuadPart * 1000000.0 / gFrequency.QuadPart;
+#else
+    struct timeval count;
+    gettimeofday(&count, NULL);
+    return (count.tv_sec * 1000000.0) + count.tv_usec;
+#endif
+}
+
 double T_GetElapsedTimeInMilliSec(void) {
     return T_GetElapsedTimeInMicroSec() * 0.001;
 }
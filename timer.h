@@ -31,6 +31,10 @@ extern "C" {
     // get elapsed time in micro-second
     double T_GetElapsedTimeInMicroSec(void);
 
+    // get current time in micro-second, regardless of the timer, for measuring
+    // durations while it's running
+    double T_GetTimeInMicroSec(void);
+
 #ifdef	__cplusplus
 }
 #endif
@@ -25,6 +25,7 @@ extern "C" {
 
     typedef struct MP_Job MP_Job;
     typedef MP_Job* const* MP_JobList;
+    typedef unsigned int MP_JobHandle;
     typedef struct MP_JobType MP_JobType;
 
     typedef struct MP_Room MP_Room;
@@ -33,6 +34,7 @@ extern "C" {
     typedef struct MP_RoomType MP_RoomType;
 
     typedef struct MP_Unit MP_Unit;
+    typedef unsigned int MP_UnitHandle;
     typedef struct MP_UnitType MP_UnitType;
     typedef struct MP_UnitAbilityType MP_UnitAbilityType;
     typedef struct MP_UnitJobType MP_UnitJobType;
@@ -1,5 +1,6 @@
 #include "unit.h"
 
+#include <assert.h>
 #include <float.h>
 #include <math.h>
 #include <memory.h>
@@ -28,12 +29,75 @@
 // Global variables
 ///////////////////////////////////////////////////////////////////////////////
 
-/** Units in the game, must be ensured to be non-sparse */
-static MP_Unit** gUnits[MP_PLAYER_COUNT];
-
-/** Number of units and list capacity per player */
-static unsigned short gUnitCount[MP_PLAYER_COUNT] = {0};
-static unsigned short gUnitCapacity[MP_PLAYER_COUNT] = {0};
+/**
+ * Unit handles consist of the slot the unit is stored in plus one, so that
+ * zero is never used, its player, and in the remaining upper bits the number
+ * of times the units of that player were cleared.
+ */
+#define UNIT_HANDLE_SLOT_BITS 20
+#define UNIT_HANDLE_SLOT_MASK ((1u << UNIT_HANDLE_SLOT_BITS) - 1)
+#define UNIT_HANDLE_PLAYER_BITS 3
+#define UNIT_HANDLE_PLAYER_MASK ((1u << UNIT_HANDLE_PLAYER_BITS) - 1)
+
+/** Number of entries in a chunk of a unit arena, enough for the jobs and
+ * abilities of any unit type */
+#define UNIT_ARENA_CHUNK (MP_UNIT_PAGE * 8)
+
+/**
+ * Units of a player are kept in pages, which hold the units themselves, their
+ * AI state, and the delays that are counted down every frame in arrays of
+ * their own, so that runs over contiguous memory. Pages are never moved, so
+ * pointers to units and their data stay valid until the units are cleared.
+ */
+typedef struct {
+    /** The units, which point to their data */
+    MP_Unit units[MP_UNIT_PAGE];
+
+    /** AI state of the units */
+    MP_AI_Info ai[MP_UNIT_PAGE];
+
+    /** Updates left until the units look for jobs, and until they run their
+     * job's logic again, see AI_State */
+    unsigned int jobSearchDelays[MP_UNIT_PAGE];
+    unsigned int jobRunDelays[MP_UNIT_PAGE];
+} UnitPage;
+
+/**
+ * Data of units whose size depends on the unit type, handed out in order
+ * from chunks of UNIT_ARENA_CHUNK entries, which are never moved either.
+ */
+typedef struct {
+    /** The chunks, only the last one has room left */
+    char** chunks;
+    unsigned int count;
+
+    /** Number of entries used in the last chunk */
+    unsigned int used;
+
+    /** Size of an entry */
+    size_t size;
+} UnitArena;
+
+/** All units of one player */
+typedef struct {
+    /** Pages the units are stored in */
+    UnitPage** pages;
+    unsigned int pageCount;
+
+    /** Number of units, which are stored in the first slots */
+    unsigned int count;
+
+    /** Abilities, their cooldowns and job saturations of the units */
+    UnitArena abilities;
+    UnitArena cooldowns;
+    UnitArena saturations;
+
+    /** Number of times the units were cleared, see MP_GetUnit */
+    unsigned int epoch;
+} UnitList;
+
+/** Units in the game per player */
+static UnitList gUnits[MP_PLAYER_COUNT];
 
 /** The unit currently under the cursor */
 static MP_Unit* gCursorUnit = NULL;
@@ -48,32 +112,93 @@ static bool gIsPicking = false;
 // Allocation
 ///////////////////////////////////////////////////////////////////////////////
 
-static void ensureUnitListSize(MP_Player player) {
-    if (gUnitCount[player] >= gUnitCapacity[player]) {
-        gUnitCapacity[player] = gUnitCapacity[player] * 2 + 1;
-        if (!(gUnits[player] =
-            realloc(gUnits[player], gUnitCapacity[player] * sizeof (MP_Unit**)))) {
-            MP_log_fatal("Out of memory while resizing unit list.\n");
+/** Takes the next slot for a unit of a player, adding a page if necessary */
+static unsigned int allocateSlot(UnitList* list) {
+    if (list->count >= UNIT_HANDLE_SLOT_MASK) {
+        MP_log_fatal("Too many units.\n");
+    }
+    if (list->count >= list->pageCount * MP_UNIT_PAGE) {
+        if (!(list->pages = realloc(list->pages, (list->pageCount + 1) * sizeof (UnitPage*))) ||
+            !(list->pages[list->pageCount] = calloc(1, sizeof (UnitPage)))) {
+            MP_log_fatal("Out of memory while allocating a unit page.\n");
         }
+        ++list->pageCount;
     }
+    return list->count++;
+}
+
+inline static UnitPage* getPage(const UnitList* list, unsigned int slot) {
+    return list->pages[slot / MP_UNIT_PAGE];
+}
+
+inline static MP_Unit* getUnit(MP_Player player, unsigned int slot) {
+    return &getPage(&gUnits[player], slot)->units[slot % MP_UNIT_PAGE];
+}
+
+/** Takes the specified number of entries from an arena, all in one chunk */
+static void* allocateFromArena(UnitArena* arena, unsigned int count) {
+    void* entries;
+
+    assert(count <= UNIT_ARENA_CHUNK);
+
+    if (!arena->count || arena->used + count > UNIT_ARENA_CHUNK) {
+        if (!(arena->chunks = realloc(arena->chunks, (arena->count + 1) * sizeof (char*))) ||
+            !(arena->chunks[arena->count] = calloc(UNIT_ARENA_CHUNK, arena->size))) {
+            MP_log_fatal("Out of memory while allocating unit data.\n");
+        }
+        ++arena->count;
+        arena->used = 0;
+    }
+    entries = arena->chunks[arena->count - 1] + arena->used * arena->size;
+    arena->used += count;
+    return entries;
+}
+
+static void clearArena(UnitArena* arena) {
+    for (unsigned int i = 0; i < arena->count; ++i) {
+        free(arena->chunks[i]);
+    }
+    free(arena->chunks);
+    arena->chunks = NULL;
+    arena->count = 0;
+    arena->used = 0;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 // Update
 ///////////////////////////////////////////////////////////////////////////////
 
+/** Counts down the non-zero entries of an array of delays */
+static void countDown(unsigned int* delays, unsigned int count) {
+    for (unsigned int i = 0; i < count; ++i) {
+        if (delays[i] > 0) {
+            --delays[i];
+        }
+    }
+}
+
 static void onUpdate(void) {
     if (MP_DBG_isAIEnabled) {
         for (unsigned int player = 0; player < MP_PLAYER_COUNT; ++player) {
-            for (unsigned short unitId = 0; unitId < gUnitCount[player]; ++unitId) {
+            const UnitArena* cooldowns = &gUnits[player].cooldowns;
+
+            // Count down job delays, of all units at once. Unused slots at
+            // the end of the last page are zero, so they are skipped.
+            for (unsigned int page = 0; page < gUnits[player].pageCount; ++page) {
+                countDown(gUnits[player].pages[page]->jobSearchDelays, MP_UNIT_PAGE);
+                countDown(gUnits[player].pages[page]->jobRunDelays, MP_UNIT_PAGE);
+            }
+
+            for (unsigned int unitId = 0; unitId < gUnits[player].count; ++unitId) {
                 // Update the unit's AI state.
-                MP_UpdateAI(gUnits[player][unitId]);
-                // Update ability cooldowns.
-                for (unsigned int i = 0; i < gUnits[player][unitId]->type->abilityCount; ++i) {
-                    if (gUnits[player][unitId]->abilities[i].cooldown > 0) {
-                        --gUnits[player][unitId]->abilities[i].cooldown;
-                    }
-                }
+                MP_UpdateAI(getUnit(player, unitId));
+            }
+
+            // Update ability cooldowns, of all units at once. Unused entries
+            // at the end of chunks are zero, so they are skipped.
+            for (unsigned int chunk = 0; chunk < cooldowns->count; ++chunk) {
+                countDown((unsigned int*) cooldowns->chunks[chunk],
+                          chunk + 1 < cooldowns->count ? UNIT_ARENA_CHUNK : cooldowns->used);
             }
         }
     }
@@ -95,8 +220,8 @@ static void onRender(void) {
 
 #define LN(x, y) glLoadName(((unsigned short) (y) << 16) | (unsigned short) (x))
     for (unsigned int player = 0; player < MP_PLAYER_COUNT; ++player) {
-        for (unsigned short unitId = 0; unitId < gUnitCount[player]; ++unitId) {
-            const MP_Unit* unit = gUnits[player][unitId];
+        for (unsigned short unitId = 0; unitId < gUnits[player].count; ++unitId) {
+            const MP_Unit* unit = getUnit(player, unitId);
 
             // Skip while in hand.
             if (unit->ai->isInHand) {
@@ -143,7 +268,7 @@ static void onPreRender(void) {
     if (MP_Pick(mouseX, MP_resolutionY - mouseY, &onRender, &name, &gCursorZ)) {
         const MP_Player player = (short) (name & 0xFFFF);
         const unsigned int unitId = (short) (name >> 16);
-        gCursorUnit = gUnits[player][unitId];
+        gCursorUnit = getUnit(player, unitId);
     } else {
         gCursorUnit = NULL;
         gCursorZ = FLT_MAX;
@@ -156,7 +281,8 @@ static void onPreRender(void) {
 ///////////////////////////////////////////////////////////////////////////////
 
 bool MP_IsUnitMoving(const MP_Unit* unit) {
-    return unit->ai->pathing.index <= unit->ai->pathing.depth;
+    return unit->ai->pathing.path &&
+            unit->ai->pathing.index <= MP_GetPathDepth(unit->ai->pathing.path);
 }
 
 MP_Unit* MP_GetUnitUnderCursor(void) {
@@ -167,8 +293,26 @@ float MP_GetUnitDepthUnderCursor(void) {
     return gCursorZ;
 }
 
+MP_Unit* MP_GetUnit(MP_UnitHandle handle) {
+    // For zero this wraps around, which is never a used slot.
+    const unsigned int slot = (handle & UNIT_HANDLE_SLOT_MASK) - 1;
+    const unsigned int player = (handle >> UNIT_HANDLE_SLOT_BITS) & UNIT_HANDLE_PLAYER_MASK;
+    MP_Unit* unit;
+
+    if (player >= MP_PLAYER_COUNT || slot >= gUnits[player].count) {
+        return NULL;
+    }
+
+    unit = getUnit(player, slot);
+    return unit->handle == handle ? unit : NULL;
+}
+
 MP_Unit* MP_AddUnit(MP_Player player, const MP_UnitType* meta, const vec2* position) {
     lua_State* L = MP_Lua();
+    UnitList* list = &gUnits[player];
+    UnitPage* page;
+    unsigned int slot;
+    unsigned int* cooldowns;
     MP_Unit* unit;
 
     // Can that kind of unit be spawned at the specified position? Also checks
@@ -177,26 +321,28 @@ MP_Unit* MP_AddUnit(MP_Player player, const MP_UnitType* meta, const vec2* posit
         return NULL;
     }
 
-    // Ensure we have the capacity to add the unit.
-    ensureUnitListSize(player);
-
-    // Allocate the actual unit.
-    if (!(unit = calloc(1, sizeof (MP_Unit)))) {
-        MP_log_fatal("Out of memory while allocating a job.\n");
-    }
+    // Take a slot in our list, and point the unit to its data.
+    slot = allocateSlot(list);
+    page = getPage(list, slot);
+    unit = &page->units[slot % MP_UNIT_PAGE];
     unit->type = meta;
     unit->owner = player;
+    unit->handle = (list->epoch << (UNIT_HANDLE_SLOT_BITS + UNIT_HANDLE_PLAYER_BITS)) |
+            (player << UNIT_HANDLE_SLOT_BITS) | (slot + 1);
     unit->position = *position;
+    unit->ai = &page->ai[slot % MP_UNIT_PAGE];
+    unit->ai->state.jobSearchDelay = &page->jobSearchDelays[slot % MP_UNIT_PAGE];
+    unit->ai->state.jobRunDelay = &page->jobRunDelays[slot % MP_UNIT_PAGE];
 
-    // Allocate ability list.
-    if (!(unit->abilities = calloc(unit->type->abilityCount, sizeof (MP_Ability)))) {
-        MP_log_fatal("Out of memory while allocating unit abilities.\n");
-    }
+    // Get ability list and cooldowns.
+    unit->abilities = allocateFromArena(&list->abilities, unit->type->abilityCount);
+    cooldowns = allocateFromArena(&list->cooldowns, unit->type->abilityCount);
     
     // Create shallow copy of ability property list.
     for (unsigned int number = 0; number < unit->type->abilityCount; ++number) {
         unit->abilities[number].type = unit->type->abilities[number].type;
         unit->abilities[number].unit = unit;
+        unit->abilities[number].cooldown = &cooldowns[number];
         lua_rawgeti(L, LUA_REGISTRYINDEX, unit->type->abilities[number].properties);
         lua_newtable(L);
         lua_pushnil(L);
@@ -208,27 +354,17 @@ MP_Unit* MP_AddUnit(MP_Player player, const MP_UnitType* meta, const vec2* posit
         unit->abilities[number].properties = luaL_ref(L, LUA_REGISTRYINDEX);
     }
     
-    // Allocate job saturation memory.
-    if (!(unit->jobSaturation = calloc(unit->type->jobCount, sizeof (float)))) {
-        MP_log_fatal("Out of memory while allocating job saturation.\n");
-    }
+    // Get job saturation memory.
+    unit->jobSaturation = allocateFromArena(&list->saturations, unit->type->jobCount);
 
     // Set initial job saturations.
     for (unsigned int number = 0; number < unit->type->jobCount; ++number) {
         unit->jobSaturation[number] = unit->type->jobs[number].initialSaturation;
     }
 
-    // OK, allocate AI data, if necessary.
-    if (!(unit->ai = calloc(1, sizeof (MP_AI_Info)))) {
-        MP_log_fatal("Out of memory while allocating AI info.\n");
-    }
-
     // Disable movement initially.
     unit->ai->pathing.index = 1;
 
-    // Store it in our list.
-    gUnits[player][gUnitCount[player]++] = unit;
-
     // Send event to AI scripts.
     MP_DispatchUnitAddedEvent(unit);
 
@@ -238,9 +374,9 @@ MP_Unit* MP_AddUnit(MP_Player player, const MP_UnitType* meta, const vec2* posit
 void MP_StopJob(MP_Job* job) {
     if (job && job->worker) {
         AI_State* state = &job->worker->ai->state;
-        state->job = NULL;
-        state->jobRunDelay = 0;
-        state->jobSearchDelay = 0;
+        state->job = 0;
+        *state->jobRunDelay = 0;
+        *state->jobSearchDelay = 0;
         state->active = false;
         job->worker = NULL;
     }
@@ -252,15 +388,22 @@ void MP_StopJob(MP_Job* job) {
 
 void MP_ClearUnits(void) {
     for (unsigned int player = 0; player < MP_PLAYER_COUNT; ++player) {
-        for (unsigned short unitId = 0; unitId < gUnitCount[player]; ++unitId) {
-            free(gUnits[player][unitId]);
-            gUnits[player][unitId] = NULL;
+        UnitList* list = &gUnits[player];
+
+        for (unsigned int i = 0; i < list->pageCount; ++i) {
+            free(list->pages[i]);
         }
-        gUnitCount[player] = 0;
+        free(list->pages);
+        list->pages = NULL;
+        list->pageCount = 0;
+        list->count = 0;
+
+        clearArena(&list->abilities);
+        clearArena(&list->cooldowns);
+        clearArena(&list->saturations);
 
-        free(gUnits[player]);
-        gUnits[player] = NULL;
-        gUnitCapacity[player] = 0;
+        // Make handles to the cleared units invalid.
+        ++list->epoch;
     }
 
     gCursorUnit = NULL;
@@ -272,7 +415,10 @@ void MP_InitUnits(void) {
     MP_AddPreRenderEventListener(onPreRender);
     MP_AddRenderEventListener(onRender);
 
-    memset(gUnits, 0, MP_PLAYER_COUNT * sizeof (MP_Unit**));
-    memset(gUnitCount, 0, MP_PLAYER_COUNT * sizeof (unsigned short));
-    memset(gUnitCapacity, 0, MP_PLAYER_COUNT * sizeof (unsigned short));
+    memset(gUnits, 0, MP_PLAYER_COUNT * sizeof (UnitList));
+    for (unsigned int player = 0; player < MP_PLAYER_COUNT; ++player) {
+        gUnits[player].abilities.size = sizeof (MP_Ability);
+        gUnits[player].cooldowns.size = sizeof (unsigned int);
+        gUnits[player].saturations.size = sizeof (float);
+    }
 }
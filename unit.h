@@ -18,7 +18,11 @@ extern "C" {
     // Types
     ///////////////////////////////////////////////////////////////////////////
 
-    /** Contains data on a single unit instance */
+    /**
+     * Contains data on a single unit instance. Units are stored in pages per
+     * player, along with their AI state and the delays counted down every
+     * frame, which are stored field by field.
+     */
     struct MP_Unit {
         /** Info on the unit type */
         const MP_UnitType* type;
@@ -26,6 +30,9 @@ extern "C" {
         /** The player this unit belongs to */
         MP_Player owner;
 
+        /** Handle referring to this unit, see MP_GetUnit */
+        MP_UnitHandle handle;
+
         /** Current position of the unit */
         vec2 position;
 
@@ -50,6 +57,14 @@ extern "C" {
      */
     bool MP_IsUnitMoving(const MP_Unit* unit);
 
+    /**
+     * Get the unit a handle refers to. Units stay valid until all units are
+     * cleared, e.g. when loading a map, handles can be checked after that.
+     * @param handle the handle of the unit, see MP_Unit.handle.
+     * @return the unit, or null if it no longer exists.
+     */
+    MP_Unit* MP_GetUnit(MP_UnitHandle handle);
+
     /**
      * Get the unit currently hovered by the cursor, if any.
      */
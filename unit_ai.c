@@ -2,16 +2,552 @@
 #include <float.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "astar_mp.h"
 #include "block.h"
+#include "events.h"
 #include "job.h"
 #include "job_type.h"
+#include "log.h"
 #include "map.h"
 #include "script.h"
+#include "timer.h"
 #include "unit.h"
 #include "unit_ai.h"
 
+///////////////////////////////////////////////////////////////////////////////
+// Path index
+///////////////////////////////////////////////////////////////////////////////
+
+/** Units whose path crosses a region of the map */
+typedef struct {
+    /** The units, in no particular order */
+    const MP_Unit** units;
+    unsigned int count;
+    unsigned int capacity;
+
+    /** The path that visited this region last while indexing paths */
+    unsigned int stamp;
+} PathRegion;
+
+/** Regions of the map, stored row by row, see MP_AI_PATH_REGION */
+static PathRegion* gRegions = NULL;
+
+/** Number of regions per row and column */
+static unsigned int gRegionSize = 0;
+
+/** Incremented for each indexed path, so it visits each region only once */
+static unsigned int gRegionStamp = 0;
+
+/** A job a unit would take, found while it was looking for work */
+typedef struct {
+    /** The unit that would take the job */
+    MP_Unit* unit;
+
+    /** The job, which may be deleted before the bids are resolved */
+    MP_JobHandle job;
+
+    /** The distance to the job, weighted by the unit's preferences */
+    float cost;
+} JobBid;
+
+/** Bids of the units that looked for work this update, see assignJobs */
+static JobBid* gBids = NULL;
+static unsigned int gBidCount = 0;
+static unsigned int gBidCapacity = 0;
+
+/** Incremented for each round of assignments, see AI_State.assignment */
+static unsigned int gAssignment = 0;
+
+/** Units waiting for their turn to look for jobs, in a ring buffer */
+typedef struct {
+    MP_Unit** units;
+    unsigned int head;
+    unsigned int count;
+    unsigned int capacity;
+} SearchQueue;
+
+/** Units without a job, which go first, and units checking for better ones */
+static SearchQueue gIdleQueue = {NULL, 0, 0, 0};
+static SearchQueue gBusyQueue = {NULL, 0, 0, 0};
+
+/** A unit waiting for jobs to be added, see AI_State.waiting */
+typedef struct {
+    MP_Unit* unit;
+    unsigned int waiting;
+} Waiter;
+
+/** Units waiting for jobs of one type of one player */
+typedef struct {
+    Waiter* waiters;
+    unsigned int count;
+    unsigned int capacity;
+} WaitList;
+
+/** Wait lists per player, per job type */
+static WaitList gWaitLists[MP_PLAYER_COUNT][MP_TYPE_ID_MAX];
+
+/** Whether blocks changed since the last update, which may have made jobs
+ * reachable for waiting units, see wakeUnitsForConnectivity */
+static bool gConnectivityChanged = false;
+
+/** A component of the map for units with some passability */
+typedef struct {
+    MP_Passability mask;
+
+    /** Id of the component, zero if the entry is free */
+    unsigned int component;
+} ComponentEntry;
+
+/**
+ * Components containing the jobs of a wait list's type, for each passability
+ * of the units waiting in it, see collectJobComponents. Hash table with
+ * linear probing, the capacity is a power of two and kept at least twice the
+ * number of entries.
+ */
+static ComponentEntry* gJobComponents = NULL;
+static unsigned int gJobComponentsCapacity = 0;
+
+/** Distinct passabilities of the units waiting in a wait list */
+static MP_Passability* gWaiterMasks = NULL;
+static unsigned int gWaiterMasksCapacity = 0;
+
+/** Statistics on job searches, and the sum of all frame times */
+static AI_JobSearchStats gSearchStats;
+static double gSearchTimeSum = 0;
+static unsigned int gSearchFrames = 0;
+
+/** Makes sure there are regions for the current map size */
+static void ensureRegions(void) {
+    const unsigned int size = (MP_GetMapSize() + MP_AI_PATH_REGION - 1) / MP_AI_PATH_REGION;
+    if (size != gRegionSize) {
+        for (unsigned int i = 0; i < gRegionSize * gRegionSize; ++i) {
+            free(gRegions[i].units);
+        }
+        free(gRegions);
+        gRegionSize = size;
+        if (!(gRegions = calloc(size * size, sizeof (PathRegion)))) {
+            MP_log_fatal("Out of memory while allocating path regions.\n");
+        }
+        gRegionStamp = 0;
+    }
+}
+
+/** Gets the region row or column a map coordinate is in */
+inline static unsigned int toRegion(float coordinate) {
+    const unsigned int region = coordinate > 0 ? (unsigned int) coordinate / MP_AI_PATH_REGION : 0;
+    return region < gRegionSize ? region : gRegionSize - 1;
+}
+
+static void addRegionUnit(PathRegion* region, const MP_Unit* unit) {
+    if (region->count >= region->capacity) {
+        region->capacity = region->capacity * 2 + 4;
+        if (!(region->units = realloc(region->units, region->capacity * sizeof (MP_Unit*)))) {
+            MP_log_fatal("Out of memory while resizing path region.\n");
+        }
+    }
+    region->units[region->count++] = unit;
+}
+
+static void removeRegionUnit(PathRegion* region, const MP_Unit* unit) {
+    for (unsigned int i = 0; i < region->count; ++i) {
+        if (region->units[i] == unit) {
+            region->units[i] = region->units[--region->count];
+            return;
+        }
+    }
+    assert(!"unit's path is not in the region it crosses");
+}
+
+/**
+ * Adds a unit to, or removes it from, the regions its current path crosses.
+ * Segments are checked by looking at the cells on their line, which are all
+ * inside the bounding box of the segment, so take the regions that covers.
+ */
+static void indexPath(const MP_Unit* unit, bool add) {
+    const MP_PathHandle path = unit->ai->pathing.path;
+    const unsigned int depth = MP_GetPathDepth(path);
+    vec2 previous;
+
+    if (!depth) {
+        return;
+    }
+
+    ensureRegions();
+    if (++gRegionStamp == 0) {
+        for (unsigned int i = 0; i < gRegionSize * gRegionSize; ++i) {
+            gRegions[i].stamp = 0;
+        }
+        gRegionStamp = 1;
+    }
+
+    previous = MP_GetPathNode(path, 0);
+    for (unsigned int i = depth > 1 ? 1 : 0; i < depth; ++i) {
+        const vec2 node = MP_GetPathNode(path, i);
+        const unsigned int x0 = toRegion(fminf(previous.d.x, node.d.x));
+        const unsigned int x1 = toRegion(fmaxf(previous.d.x, node.d.x));
+        const unsigned int y0 = toRegion(fminf(previous.d.y, node.d.y));
+        const unsigned int y1 = toRegion(fmaxf(previous.d.y, node.d.y));
+        for (unsigned int y = y0; y <= y1; ++y) {
+            for (unsigned int x = x0; x <= x1; ++x) {
+                PathRegion* region = &gRegions[y * gRegionSize + x];
+                if (region->stamp == gRegionStamp) {
+                    continue;
+                }
+                region->stamp = gRegionStamp;
+                if (add) {
+                    addRegionUnit(region, unit);
+                } else {
+                    removeRegionUnit(region, unit);
+                }
+            }
+        }
+        previous = node;
+    }
+}
+
+/** Marks the paths crossing a changed block to be checked on the next move */
+static void onBlockChanged(MP_Block* block) {
+    const PathRegion* region;
+    unsigned short x, y;
+
+    gConnectivityChanged = true;
+
+    if (!gRegionSize) {
+        return;
+    }
+
+    MP_GetBlockCoordinates(block, &x, &y);
+    region = &gRegions[toRegion(y) * gRegionSize + toRegion(x)];
+    for (unsigned int i = 0; i < region->count; ++i) {
+        region->units[i]->ai->pathing.dirty = true;
+    }
+}
+
+static void onMapChange(void) {
+    // Units are gone, and the map size may have changed.
+    for (unsigned int i = 0; i < gRegionSize * gRegionSize; ++i) {
+        gRegions[i].count = 0;
+    }
+    ensureRegions();
+    gBidCount = 0;
+    gIdleQueue.count = 0;
+    gBusyQueue.count = 0;
+    for (unsigned int player = 0; player < MP_PLAYER_COUNT; ++player) {
+        for (unsigned int index = 0; index < MP_TYPE_ID_MAX; ++index) {
+            gWaitLists[player][index].count = 0;
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Job assignment
+///////////////////////////////////////////////////////////////////////////////
+
+static void addBid(MP_Unit* unit, const MP_Job* job, float cost) {
+    JobBid* bid;
+
+    if (gBidCount >= gBidCapacity) {
+        gBidCapacity = gBidCapacity * 2 + 1;
+        if (!(gBids = realloc(gBids, gBidCapacity * sizeof (JobBid)))) {
+            MP_log_fatal("Out of memory while resizing job bid list.\n");
+        }
+    }
+    bid = &gBids[gBidCount++];
+    bid->unit = unit;
+    bid->job = job->handle;
+    bid->cost = cost;
+}
+
+/** Makes a unit that found no job wait until jobs it could do are added */
+static void parkUnit(MP_Unit* unit) {
+    AI_State* state = &unit->ai->state;
+    const unsigned int waiting = ++state->waiting;
+
+    for (unsigned int number = 0; number < unit->type->jobCount; ++number) {
+        const MP_JobType* type = unit->type->jobs[number].type;
+        WaitList* list = &gWaitLists[unit->owner][type->info.id - 1];
+
+        if (type->runMethod == LUA_REFNIL) {
+            continue;
+        }
+
+        if (list->count >= list->capacity) {
+            // Drop outdated entries first, those of units that were woken up
+            // for another type of job, or stopped waiting otherwise.
+            unsigned int count = 0;
+            for (unsigned int i = 0; i < list->count; ++i) {
+                if (list->waiters[i].waiting == list->waiters[i].unit->ai->state.waiting) {
+                    list->waiters[count++] = list->waiters[i];
+                }
+            }
+            list->count = count;
+        }
+        if (list->count >= list->capacity) {
+            list->capacity = list->capacity * 2 + 1;
+            if (!(list->waiters = realloc(list->waiters, list->capacity * sizeof (Waiter)))) {
+                MP_log_fatal("Out of memory while resizing job wait list.\n");
+            }
+        }
+        list->waiters[list->count].unit = unit;
+        list->waiters[list->count].waiting = waiting;
+        ++list->count;
+    }
+
+    // Look again after a while anyway, e.g. for jobs targeting units, which
+    // may come into reach without any blocks changing.
+    *state->jobSearchDelay = MP_AI_JOB_WAIT * MP_FRAMERATE;
+}
+
+/** Makes the units waiting for jobs of a type look for jobs again */
+static void wakeUnits(MP_Player player, unsigned int index) {
+    WaitList* list = &gWaitLists[player][index];
+
+    for (unsigned int i = 0; i < list->count; ++i) {
+        AI_State* state = &list->waiters[i].unit->ai->state;
+        if (list->waiters[i].waiting == state->waiting) {
+            ++state->waiting;
+            *state->jobSearchDelay = 0;
+        }
+    }
+    list->count = 0;
+}
+
+inline static unsigned int hashComponent(MP_Passability mask, unsigned int component) {
+    return (component ^ mask << 16) * 2654435761u;
+}
+
+/** Gets the entry of a component, or the free one where it would go */
+static ComponentEntry* findJobComponent(MP_Passability mask, unsigned int component) {
+    const unsigned int bits = gJobComponentsCapacity - 1;
+    unsigned int i = hashComponent(mask, component) & bits;
+    while (gJobComponents[i].component &&
+           (gJobComponents[i].component != component || gJobComponents[i].mask != mask)) {
+        i = (i + 1) & bits;
+    }
+    return &gJobComponents[i];
+}
+
+/**
+ * Collects the components the jobs of a list are in, for each passability of
+ * the units in a wait list, so that each waiting unit only has to look up its
+ * own component, instead of checking each job.
+ */
+static void collectJobComponents(const WaitList* list, MP_JobList jobs, unsigned int count) {
+    unsigned int maskCount = 0, capacity = gJobComponentsCapacity ? gJobComponentsCapacity : 64;
+
+    // Units of one type share their passability, so there are only a few.
+    for (unsigned int i = 0; i < list->count; ++i) {
+        const MP_Passability mask = list->waiters[i].unit->type->canPass;
+        unsigned int j = 0;
+        while (j < maskCount && gWaiterMasks[j] != mask) {
+            ++j;
+        }
+        if (j < maskCount) {
+            continue;
+        }
+        if (maskCount >= gWaiterMasksCapacity) {
+            gWaiterMasksCapacity = gWaiterMasksCapacity * 2 + 1;
+            if (!(gWaiterMasks = realloc(gWaiterMasks, gWaiterMasksCapacity * sizeof (MP_Passability)))) {
+                MP_log_fatal("Out of memory while resizing waiter passability list.\n");
+            }
+        }
+        gWaiterMasks[maskCount++] = mask;
+    }
+
+    // Make room for the components of all jobs, and clear the table.
+    while (capacity < count * maskCount * 2) {
+        capacity *= 2;
+    }
+    if (capacity != gJobComponentsCapacity) {
+        free(gJobComponents);
+        gJobComponentsCapacity = capacity;
+        if (!(gJobComponents = calloc(capacity, sizeof (ComponentEntry)))) {
+            MP_log_fatal("Out of memory while resizing job component table.\n");
+        }
+    } else {
+        memset(gJobComponents, 0, capacity * sizeof (ComponentEntry));
+    }
+
+    for (unsigned int i = 0; i < count; ++i) {
+        const vec2 position = MP_GetJobPosition(jobs[i]);
+        for (unsigned int j = 0; j < maskCount; ++j) {
+            const unsigned int component = MP_GetComponent(gWaiterMasks[j], &position);
+            if (component) {
+                ComponentEntry* entry = findJobComponent(gWaiterMasks[j], component);
+                entry->mask = gWaiterMasks[j];
+                entry->component = component;
+            }
+        }
+    }
+}
+
+/**
+ * Wakes the units waiting for jobs for which a job became reachable after
+ * blocks changed, i.e. that are in the same component as one now. Most block
+ * changes don't connect anything, so this only looks up components instead
+ * of waking everybody to search. The jobs' components are collected once per
+ * list, so this takes time linear in the number of jobs and waiting units.
+ */
+static void wakeUnitsForConnectivity(void) {
+    if (!gConnectivityChanged) {
+        return;
+    }
+    gConnectivityChanged = false;
+
+    for (unsigned int player = 0; player < MP_PLAYER_COUNT; ++player) {
+        for (unsigned int index = 0; index < MP_TYPE_ID_MAX; ++index) {
+            WaitList* list = &gWaitLists[player][index];
+            unsigned int count, kept = 0;
+            MP_JobList jobs;
+
+            if (!list->count) {
+                continue;
+            }
+            jobs = MP_GetJobs(MP_GetJobTypeById(index + 1), player, &count);
+            if (!count) {
+                continue;
+            }
+
+            // Drop outdated entries while we're at it, see parkUnit.
+            for (unsigned int i = 0; i < list->count; ++i) {
+                if (list->waiters[i].waiting == list->waiters[i].unit->ai->state.waiting) {
+                    list->waiters[kept++] = list->waiters[i];
+                }
+            }
+            list->count = kept;
+            if (!kept) {
+                continue;
+            }
+
+            collectJobComponents(list, jobs, count);
+            kept = 0;
+            for (unsigned int i = 0; i < list->count; ++i) {
+                const Waiter* waiter = &list->waiters[i];
+                const MP_Passability mask = waiter->unit->type->canPass;
+                const unsigned int component = MP_GetComponent(mask, &waiter->unit->position);
+                AI_State* state = &waiter->unit->ai->state;
+                if (component && findJobComponent(mask, component)->component) {
+                    ++state->waiting;
+                    *state->jobSearchDelay = 0;
+                } else {
+                    list->waiters[kept++] = *waiter;
+                }
+            }
+            list->count = kept;
+        }
+    }
+}
+
+static void onJobAdded(MP_Job* job) {
+    wakeUnits(job->player, job->type->info.id - 1);
+}
+
+static int compareBids(const void* a, const void* b) {
+    const float costA = ((const JobBid*) a)->cost;
+    const float costB = ((const JobBid*) b)->cost;
+    return (costA > costB) - (costA < costB);
+}
+
+/**
+ * Hands out the jobs the units bid for this update, all at once. Instead of
+ * each unit taking its favorite job right away, and another unit taking it
+ * from it a moment later, the cheapest bids win, and each unit and job is
+ * only assigned once per round.
+ */
+static void assignJobs(void) {
+    if (!gBidCount) {
+        return;
+    }
+
+    ++gAssignment;
+    qsort(gBids, gBidCount, sizeof (JobBid), compareBids);
+
+    for (unsigned int i = 0; i < gBidCount; ++i) {
+        MP_Unit* unit = gBids[i].unit;
+        AI_State* state = &unit->ai->state;
+        MP_Job* job = MP_GetJob(gBids[i].job);
+        MP_Job* currentJob;
+
+        // Skip if the job is gone, the unit already got one, or it was
+        // picked up in the meantime.
+        if (!job || state->assignment == gAssignment || unit->ai->isInHand) {
+            continue;
+        }
+
+        // Skip if a unit with a better bid got it this round. Workers that
+        // didn't bid were already compared against when finding the job.
+        if (job->worker && job->worker != unit &&
+            job->worker->ai->state.assignment == gAssignment) {
+            continue;
+        }
+
+        state->assignment = gAssignment;
+
+        // Keep doing what we're doing if that's still the best.
+        currentJob = MP_GetJob(state->job);
+        if (job == currentJob) {
+            continue;
+        }
+
+        // Fire previous workers.
+        MP_StopJob(job);
+
+        // Make self stop the active job (if any), which frees it up for
+        // units waiting for work.
+        if (currentJob) {
+            MP_StopJob(currentJob);
+            wakeUnits(currentJob->player, currentJob->type->info.id - 1);
+        }
+
+        // Pursue that job now.
+        *state->jobRunDelay = 0;
+        state->job = job->handle;
+        state->active = false;
+
+        // We found work, reserve it for ourself.
+        job->worker = unit;
+    }
+
+    // Units that lost all their bids to others try again right away, the
+    // jobs they lost will be skipped the next time.
+    for (unsigned int i = 0; i < gBidCount; ++i) {
+        AI_State* state = &gBids[i].unit->ai->state;
+        if (state->assignment != gAssignment && !MP_GetJob(state->job)) {
+            *state->jobSearchDelay = 0;
+        }
+    }
+
+    gBidCount = 0;
+}
+
+static void pushSearch(SearchQueue* queue, MP_Unit* unit) {
+    if (queue->count >= queue->capacity) {
+        // Grow, and unwrap the entries while at it.
+        const unsigned int capacity = queue->capacity * 2 + 1;
+        MP_Unit** units;
+        if (!(units = malloc(capacity * sizeof (MP_Unit*)))) {
+            MP_log_fatal("Out of memory while resizing job search queue.\n");
+        }
+        for (unsigned int i = 0; i < queue->count; ++i) {
+            units[i] = queue->units[(queue->head + i) % queue->capacity];
+        }
+        free(queue->units);
+        queue->units = units;
+        queue->head = 0;
+        queue->capacity = capacity;
+    }
+    queue->units[(queue->head + queue->count++) % queue->capacity] = unit;
+}
+
+static MP_Unit* popSearch(SearchQueue* queue) {
+    MP_Unit* unit = queue->units[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    --queue->count;
+    return unit;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Utility methods
 ///////////////////////////////////////////////////////////////////////////////
@@ -33,6 +569,12 @@ static float weightedPreference(float saturation, float preference, const MP_Uni
     return preference - FLT_MAX / 2;
 }
 
+/** Tests whether a position is (close enough to) that of the specified job */
+static bool isJobPosition(const MP_Job* job, const vec2* position) {
+    const vec2 jobPosition = MP_GetJobPosition(job);
+    return v2distance(&jobPosition, position) < 0.001f;
+}
+
 /** Catmull-rom interpolation */
 inline static float cr(float p0, float p1, float p2, float p3, float t) {
     const float m1 = MP_AI_CATMULL_ROM_T * (p2 - p0);
@@ -43,12 +585,131 @@ inline static float cr(float p0, float p1, float p2, float p3, float t) {
             p1;
 }
 
+/** Gets a node of a path, see MP_GetUnitPathNode */
+static vec2 getPathNode(const AI_Path* pathing, unsigned int index) {
+    const unsigned int depth = MP_GetPathDepth(pathing->path);
+    vec2 node, previous;
+
+    if (index > 0 && index <= depth) {
+        return MP_GetPathNode(pathing->path, index - 1);
+    }
+
+    // Generate endpoints for catmull-rom spline; just
+    // extend the path in the direction of the last two
+    // nodes before that end.
+    if (index == 0) {
+        node = MP_GetPathNode(pathing->path, 0);
+        previous = MP_GetPathNode(pathing->path, depth > 1 ? 1 : 0);
+    } else {
+        node = MP_GetPathNode(pathing->path, depth - 1);
+        previous = MP_GetPathNode(pathing->path, depth > 1 ? depth - 2 : 0);
+    }
+    {
+        const float dlx = node.d.x - previous.d.x;
+        const float dly = node.d.y - previous.d.y;
+        const float l = sqrtf(dlx * dlx + dly * dly);
+        if (l > 0) {
+            node.d.x += dlx / l;
+            node.d.y += dly / l;
+        }
+    }
+    return node;
+}
+
+/** Gets the four nodes defining the spline of the current path segment */
+static void getSegment(const AI_Path* pathing, vec2* nodes) {
+    for (unsigned int i = 0; i < 4; ++i) {
+        nodes[i] = getPathNode(pathing, pathing->index - 2 + i);
+    }
+}
+
+/** Stops following the current path, if any, and lets others use the memory */
+static void endPath(const MP_Unit* unit) {
+    AI_Path* pathing = &unit->ai->pathing;
+    indexPath(unit, false);
+    MP_ReleasePath(pathing->path);
+    pathing->path = 0;
+}
+
+/** Starts following a path, dropping the one we followed so far */
+static void beginPath(const MP_Unit* unit, MP_PathHandle path) {
+    AI_Path* pathing = &unit->ai->pathing;
+    endPath(unit);
+    pathing->path = path;
+    pathing->index = 1;
+    pathing->distance = 0;
+    pathing->traveled = 0;
+    // Paths may have been searched on an older map, check them once.
+    pathing->dirty = true;
+    indexPath(unit, true);
+}
+
+/** Takes the result of a path request made in MP_MoveTo or updatePath */
+static void onPathFound(const MP_Unit* unit, bool found, MP_PathHandle path, float length) {
+    AI_Path* pathing = &unit->ai->pathing;
+
+    pathing->ticket = 0;
+
+    // If there's no path, just keep going (or standing around). The job
+    // will try again once it runs next.
+    if (!found) {
+        return;
+    }
+
+    beginPath(unit, path);
+
+    // The job was told the estimated travel time, make it wait for the rest.
+    if (length > pathing->estimate && unit->ai->state.job) {
+        *unit->ai->state.jobRunDelay += (unsigned int) (MP_FRAMERATE * (length - pathing->estimate) / unit->type->moveSpeed);
+    }
+}
+
+/**
+ * Checks the rest of the path if blocks along it changed since we last
+ * looked, and goes around the blocked parts. Stops the unit if there's no
+ * way around that can be found right away, asking for a new path then.
+ * @return whether the unit is still moving.
+ */
+static bool updatePath(const MP_Unit* unit) {
+    AI_Path* pathing = &unit->ai->pathing;
+    MP_PathHandle repaired;
+    vec2 goal;
+
+    if (!pathing->dirty) {
+        return true;
+    }
+    pathing->dirty = false;
+
+    if (!MP_RepairPath(unit, pathing->path, pathing->index - 1,
+                       MP_AI_MOVE_POLICY, MP_AI_MOVE_FACTOR, &repaired)) {
+        // Stop, but keep waiting for a path we asked for, if any. Otherwise
+        // ask for a new one in the background, if there's a way at all, the
+        // way around may just have been too long to search right away.
+        goal = MP_GetPathNode(pathing->path, MP_GetPathDepth(pathing->path) - 1);
+        endPath(unit);
+        if (!pathing->ticket && MP_IsReachable(unit, &goal)) {
+            pathing->ticket = MP_RequestPath(unit, &goal, MP_AI_MOVE_POLICY, MP_AI_MOVE_FACTOR,
+                                             onPathFound);
+            pathing->goal = goal;
+            pathing->estimate = v2distance(&unit->position, &goal);
+        }
+        return false;
+    }
+    if (repaired) {
+        // Searched on the current map, no need to check it again.
+        beginPath(unit, repaired);
+        pathing->dirty = false;
+    }
+    return true;
+}
+
 /** Moves a unit along its current path */
 static void updateMove(MP_Unit* unit) {
     AI_Path* path = &unit->ai->pathing;
+    vec2 nodes[4];
 
-    // Are we even moving?
-    if (!MP_IsUnitMoving(unit) || unit->ai->isInHand) {
+    // Are we even moving? And can we still go where we're going?
+    if (!MP_IsUnitMoving(unit) || unit->ai->isInHand || !updatePath(unit)) {
         return;
     }
 
@@ -62,8 +723,8 @@ static void updateMove(MP_Unit* unit) {
         ++path->index;
         if (!MP_IsUnitMoving(unit)) {
             // Reached final node, we're done.
-            unit->position.d.x = path->nodes[path->depth].d.x;
-            unit->position.d.y = path->nodes[path->depth].d.y;
+            unit->position = MP_GetPathNode(path->path, MP_GetPathDepth(path->path) - 1);
+            endPath(unit);
             return;
         } else {
             // Subtract length of previous to carry surplus movement.
@@ -71,30 +732,23 @@ static void updateMove(MP_Unit* unit) {
 
             // Do a direct check for distance, to allow skipping equal
             // nodes.
+            getSegment(path, nodes);
             {
-                const float dx = path->nodes[path->index].d.x -
-                        path->nodes[path->index - 1].d.x;
-                const float dy = path->nodes[path->index].d.y -
-                        path->nodes[path->index - 1].d.y;
+                const float dx = nodes[2].d.x - nodes[1].d.x;
+                const float dy = nodes[2].d.y - nodes[1].d.y;
                 path->distance = sqrtf(dx * dx + dy * dy);
             }
             // If there is a distance, estimate the actual path length.
             if (path->distance > 0 && MP_AI_PATH_INTERPOLATE) {
                 int e;
                 float x, y, dx, dy;
-                float lx = path->nodes[path->index - 1].d.x;
-                float ly = path->nodes[path->index - 1].d.y;
+                float lx = nodes[1].d.x;
+                float ly = nodes[1].d.y;
                 path->distance = 0;
                 for (e = 1; e <= MP_AI_PATH_INTERPOLATION; ++e) {
                     const float t = e / (float) MP_AI_PATH_INTERPOLATION;
-                    x = cr(path->nodes[path->index - 2].d.x,
-                           path->nodes[path->index - 1].d.x,
-                           path->nodes[path->index].d.x,
-                           path->nodes[path->index + 1].d.x, t);
-                    y = cr(path->nodes[path->index - 2].d.y,
-                           path->nodes[path->index - 1].d.y,
-                           path->nodes[path->index].d.y,
-                           path->nodes[path->index + 1].d.y, t);
+                    x = cr(nodes[0].d.x, nodes[1].d.x, nodes[2].d.x, nodes[3].d.x, t);
+                    y = cr(nodes[0].d.y, nodes[1].d.y, nodes[2].d.y, nodes[3].d.y, t);
                     dx = x - lx;
                     dy = y - ly;
                     lx = x;
@@ -108,23 +762,17 @@ static void updateMove(MP_Unit* unit) {
     // Compute actual position of the unit.
     if (path->distance > 0) {
         const float t = path->traveled / path->distance;
-        unit->position.d.x = cr(
-                                path->nodes[path->index - 2].d.x,
-                                path->nodes[path->index - 1].d.x,
-                                path->nodes[path->index].d.x,
-                                path->nodes[path->index + 1].d.x, t);
-        unit->position.d.y = cr(
-                                path->nodes[path->index - 2].d.y,
-                                path->nodes[path->index - 1].d.y,
-                                path->nodes[path->index].d.y,
-                                path->nodes[path->index + 1].d.y, t);
+        getSegment(path, nodes);
+        unit->position.d.x = cr(nodes[0].d.x, nodes[1].d.x, nodes[2].d.x, nodes[3].d.x, t);
+        unit->position.d.y = cr(nodes[0].d.y, nodes[1].d.y, nodes[2].d.y, nodes[3].d.y, t);
     }
 }
 
 /** Updates unit desire saturation based on currently performed job and such */
 static void updateSaturation(MP_Unit* unit) {
     const AI_State* state = &unit->ai->state;
-    const MP_JobType* activeJob = (state->active && state->job) ? state->job->type : NULL;
+    const MP_Job* job = MP_GetJob(state->job);
+    const MP_JobType* activeJob = (state->active && job) ? job->type : NULL;
     const MP_UnitJobType* jobTypes = unit->type->jobs;
     float* saturation = unit->jobSaturation;
 
@@ -148,39 +796,16 @@ static void updateSaturation(MP_Unit* unit) {
     }
 }
 
-/** Looks for the most desirable job for the unit */
-static void updateCurrentJob(MP_Unit* unit) {
-    AI_State* state = &unit->ai->state;
-    const MP_UnitJobType* jobTypes;
-    const float* saturation;
-
-    MP_Job* bestJob;
-    float bestWeightedDistance;
-
-    // Skip if the unit is in the player's hand.
-    if (unit->ai->isInHand) {
-        return;
-    }
-
-    // Make sure our job still has a run method.
-    if (state->job && state->job->type->runMethod == LUA_REFNIL) {
-        MP_StopJob(state->job);
-    }
-
-    // Skip if we already have a job.
-    if (state->jobSearchDelay > 0) {
-        --state->jobSearchDelay;
-        return;
-    }
-
-    // Initialize.
-    jobTypes = unit->type->jobs;
-    saturation = unit->jobSaturation;
+/** Bids for the most desirable job of each type, see assignJobs */
+static void searchJobs(MP_Unit* unit) {
+    const MP_UnitJobType* jobTypes = unit->type->jobs;
+    const float* saturation = unit->jobSaturation;
+    const unsigned int bids = gBidCount;
 
-    bestJob = NULL;
-    bestWeightedDistance = FLT_MAX;
+    // No longer waiting, in case we were, e.g. if we waited too long.
+    ++unit->ai->state.waiting;
 
-    // Find the closest job, weighted based on the unit's preferences.
+    // Find the closest jobs, weighted based on the unit's preferences.
     for (int number = unit->type->jobCount - 1; number >= 0; --number) {
         float distance;
         MP_Job* job;
@@ -203,106 +828,187 @@ static void updateCurrentJob(MP_Unit* unit) {
             distance -= weightedPreference(saturation[number], jobTypes[number].preference, &jobTypes[number]);
         }
 
-        // Better than other jobs we have found?
-        if (distance < bestWeightedDistance) {
-            bestJob = job;
-            bestWeightedDistance = distance;
-        }
+        // The best bid of all units wins, at the end of the update.
+        addBid(unit, job, distance);
     }
 
-    // Check if we found something (else) to do.
-    if (bestJob && bestJob != state->job) {
-        // Fire previous workers.
-        MP_StopJob(bestJob);
+    if (gBidCount == bids && !unit->ai->state.job) {
+        // Nothing to do, and nothing to give up. Don't look again until
+        // something changes.
+        parkUnit(unit);
+    } else {
+        // Wait a bit before looking for a new job again.
+        *unit->ai->state.jobSearchDelay = MP_FRAMERATE;
+    }
+}
 
-        // Make self stop the active job (if any).
-        MP_StopJob(state->job);
+/** Makes the unit wait for its turn to look for jobs, see runSearches */
+static void updateCurrentJob(MP_Unit* unit) {
+    AI_State* state = &unit->ai->state;
+    MP_Job* currentJob;
 
-        // Pursue that job now.
-        state->jobRunDelay = 0;
-        state->job = bestJob;
-        state->active = false;
+    // Skip if the unit is in the player's hand.
+    if (unit->ai->isInHand) {
+        return;
+    }
 
-        // We found work, reserve it for ourself.
-        bestJob->worker = unit;
+    // Make sure our job still exists and has a run method.
+    currentJob = MP_GetJob(state->job);
+    if (!currentJob) {
+        state->job = 0;
+    } else if (currentJob->type->runMethod == LUA_REFNIL) {
+        MP_StopJob(currentJob);
+    }
+
+    // Skip if we already have a job, or are already waiting. The delay is
+    // counted down for all units at once, see unit.c.
+    if (*state->jobSearchDelay > 0) {
+        return;
+    }
+    if (state->queued) {
+        return;
     }
 
-    // Wait a bit before looking for a new job again.
-    state->jobSearchDelay = MP_FRAMERATE;
+    pushSearch(state->job ? &gBusyQueue : &gIdleQueue, unit);
+    state->queued = true;
 }
 
 /** Runs job logic, if possible */
 static void updateJob(MP_Unit* unit) {
     AI_State* state = &unit->ai->state;
+    MP_Job* job = MP_GetJob(state->job);
     // Only if we have a job and we're not in the player's hand.
-    if (state->job && !unit->ai->isInHand) {
-        // See if we have an update method for it or have to wait before running the
-        // job logic again.
-        if (state->jobRunDelay > 0) {
-            // Wait some more.
-            --state->jobRunDelay;
-        } else {
-            // Otherwise update the unit based on its current job.
-            assert(state->job->type->runMethod != LUA_REFNIL);
+    if (job && !unit->ai->isInHand) {
+        // See if we have to wait before running the job logic again. The
+        // delay is counted down like the search delay.
+        if (!*state->jobRunDelay) {
+            // Update the unit based on its current job.
+            assert(job->type->runMethod != LUA_REFNIL);
             // Set active only if the job still exists after execution!
-            state->active = MP_RunJob(unit, state->job, &state->jobRunDelay) && state->job;
+            state->active = MP_RunJob(unit, job, state->jobRunDelay) && MP_GetJob(state->job);
         }
     }
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Scheduling
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Lets the next units waiting for their turn look for jobs, units without a
+ * job first. This spreads the searches of units that started looking at the
+ * same time, e.g. after being spawned or dropped together, over multiple
+ * frames, which then stay spread, because units only search again a while
+ * after their last search.
+ */
+static void runSearches(void) {
+    const double begin = T_GetTimeInMicroSec();
+    unsigned int searches = 0;
+    float time;
+
+    while (searches < MP_AI_JOB_SEARCH_BUDGET && (gIdleQueue.count || gBusyQueue.count)) {
+        MP_Unit* unit = popSearch(gIdleQueue.count ? &gIdleQueue : &gBusyQueue);
+        unit->ai->state.queued = false;
+
+        // Units picked up while waiting queue up again when they're dropped.
+        if (unit->ai->isInHand) {
+            continue;
+        }
+
+        searchJobs(unit);
+        ++searches;
+    }
+
+    time = (float) ((T_GetTimeInMicroSec() - begin) * 0.001);
+    gSearchStats.searches += searches;
+    gSearchStats.lastTime = time;
+    if (time > gSearchStats.peakTime) {
+        gSearchStats.peakTime = time;
+    }
+    gSearchTimeSum += time;
+    ++gSearchFrames;
+    if (gIdleQueue.count + gBusyQueue.count > gSearchStats.peakDepth) {
+        gSearchStats.peakDepth = gIdleQueue.count + gBusyQueue.count;
+    }
+}
+
+static void onUpdate(void) {
+    // Units were updated before us, let those that are waiting search, then
+    // resolve the bids they made. Units woken up here search next update.
+    wakeUnitsForConnectivity();
+    runSearches();
+    assignJobs();
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Header implementation
 ///////////////////////////////////////////////////////////////////////////////
 
 float MP_MoveTo(const MP_Unit* unit, const vec2* position) {
     AI_Path* pathing;
-    unsigned int depth = MP_AI_PATH_DEPTH;
+    const MP_Job* job;
+    MP_PathHandle path;
     float distance = 0;
 
     assert(unit);
     assert(position);
 
-    // Find a path to it. Use temporary output data to avoid
-    // overriding existing path that may be shorter.
     pathing = &unit->ai->pathing;
-    if (MP_AStar(unit, position, &pathing->nodes[1], &depth, &distance)) {
-        pathing->depth = depth;
-        pathing->index = 1;
-        pathing->distance = 0;
-        pathing->traveled = 0;
-
-        // Generate endpoints for catmull-rom spline; just
-        // extend the path in the direction of the last two
-        // nodes before that end.
-        {
-            const float dlx = pathing->nodes[1].d.x - pathing->nodes[2].d.x;
-            const float dly = pathing->nodes[1].d.y - pathing->nodes[2].d.y;
-            const float l = sqrtf(dlx * dlx + dly * dly);
-            pathing->nodes[0].d.x = pathing->nodes[1].d.x;
-            pathing->nodes[0].d.y = pathing->nodes[1].d.y;
-            if (l > 0) {
-                pathing->nodes[0].d.x += dlx / l;
-                pathing->nodes[0].d.y += dly / l;
-            }
-        }
-        {
-            const float dlx = pathing->nodes[depth].d.x - pathing->nodes[depth - 1].d.x;
-            const float dly = pathing->nodes[depth].d.y - pathing->nodes[depth - 1].d.y;
-            const float l = sqrtf(dlx * dlx + dly * dly);
-            pathing->nodes[depth + 1].d.x = pathing->nodes[depth].d.x;
-            pathing->nodes[depth + 1].d.y = pathing->nodes[depth].d.y;
-            if (l > 0) {
-                pathing->nodes[depth + 1].d.x += dlx / l;
-                pathing->nodes[depth + 1].d.y += dly / l;
-            }
-        }
+    job = MP_GetJob(unit->ai->state.job);
+
+    // If we're still waiting for a path there, keep waiting. Long searches
+    // take a few frames, and starting over would only delay them further.
+    if (pathing->ticket && v2distance(&pathing->goal, position) < 0.001f) {
+        return v2distance(&unit->position, position) / unit->type->moveSpeed;
+    }
 
-        // Success.
+    // Forget about the path we asked for before, this one replaces it.
+    if (pathing->ticket) {
+        MP_CancelPath(pathing->ticket);
+        pathing->ticket = 0;
+    }
+
+    // When moving to our job and it's the closest one, just follow the
+    // shared distance field, which is cheap enough to do right away.
+    if (job && isJobPosition(job, position) &&
+        MP_FindJobPath(unit, job, &path, &distance)) {
+        beginPath(unit, path);
         return distance / unit->type->moveSpeed;
     }
 
     // Could not find a path.
-    return -1.0f;
+    if (!MP_IsReachable(unit, position)) {
+        return -1.0f;
+    }
+
+    // Otherwise have the path searched in the background, and keep following
+    // the current path until then. Estimate the travel time using the direct
+    // distance, the rest is added to the job's delay once the path is known.
+    pathing->ticket = MP_RequestPath(unit, position, MP_AI_MOVE_POLICY, MP_AI_MOVE_FACTOR,
+                                     onPathFound);
+    pathing->goal = *position;
+    pathing->estimate = v2distance(&unit->position, position);
+    return pathing->estimate / unit->type->moveSpeed;
+}
+
+void MP_StopMoving(const MP_Unit* unit) {
+    AI_Path* pathing;
+
+    assert(unit);
+
+    pathing = &unit->ai->pathing;
+    if (pathing->ticket) {
+        MP_CancelPath(pathing->ticket);
+        pathing->ticket = 0;
+    }
+    endPath(unit);
+}
+
+vec2 MP_GetUnitPathNode(const MP_Unit* unit, unsigned int index) {
+    assert(unit);
+    assert(unit->ai->pathing.path);
+
+    return getPathNode(&unit->ai->pathing, index);
 }
 
 void MP_UpdateAI(MP_Unit* unit) {
@@ -323,3 +1029,20 @@ void MP_UpdateAI(MP_Unit* unit) {
     // Run job logic.
     updateJob(unit);
 }
+
+void MP_GetJobSearchStats(AI_JobSearchStats* stats) {
+    assert(stats);
+
+    *stats = gSearchStats;
+    stats->depth = gIdleQueue.count + gBusyQueue.count;
+    stats->idleDepth = gIdleQueue.count;
+    stats->averageTime = gSearchFrames ? (float) (gSearchTimeSum / gSearchFrames) : 0.0f;
+}
+
+void MP_InitAI(void) {
+    MP_AddBlockTypeChangedEventListener(onBlockChanged);
+    MP_AddBlockRoomChangedEventListener(onBlockChanged);
+    MP_AddMapChangeEventListener(onMapChange);
+    MP_AddUpdateEventListener(onUpdate);
+    MP_AddJobAddedEventListener(onJobAdded);
+}
@@ -8,6 +8,7 @@
 #define	UNIT_AI_H
 
 #include "astar.h"
+#include "astar_mp.h"
 #include "config.h"
 #include "types.h"
 
@@ -17,28 +18,60 @@ extern "C" {
 
     /** A single entry in a unit's AI stack */
     typedef struct {
-        /** Updates to wait before performing the next job search */
-        unsigned int jobSearchDelay;
+        /** Updates to wait before performing the next job search. Stored
+         * with those of the other units of the player, which are all
+         * counted down at once */
+        unsigned int* jobSearchDelay;
 
-        /** Delay before re-evaluating the job's logic */
-        unsigned int jobRunDelay;
+        /** Delay before re-evaluating the job's logic, stored and counted
+         * down like jobSearchDelay */
+        unsigned int* jobRunDelay;
 
-        /** The actual job (workplace) we are active at */
-        MP_Job* job;
+        /** The actual job (workplace) we are active at, zero if none. The
+         * job may have been deleted since, see MP_GetJob */
+        MP_JobHandle job;
 
         /** Whether the job is active (saturation rises or sinks) */
         bool active;
+
+        /** The last round of job assignments the unit got a job in */
+        unsigned int assignment;
+
+        /** Whether the unit is waiting for its turn to look for jobs */
+        bool queued;
+
+        /** Changed whenever the unit starts or stops waiting for jobs to be
+         * added, entries in the wait lists with another value are outdated */
+        unsigned int waiting;
     } AI_State;
 
+    /** Statistics on scheduled job searches */
+    typedef struct {
+        /** Number of units waiting to look for jobs, and how many of them
+         * have no job at all */
+        unsigned int depth;
+        unsigned int idleDepth;
+
+        /** Highest number of waiting units so far */
+        unsigned int peakDepth;
+
+        /** Number of job searches so far */
+        unsigned int searches;
+
+        /** Time spent on job searches in the last frame, on average and at
+         * most per frame so far, in milliseconds */
+        float lastTime;
+        float averageTime;
+        float peakTime;
+    } AI_JobSearchStats;
+
     /** Pathing information for traveling along a path */
     typedef struct AI_Path {
-        /** The path the unit currently follows (if moving) */
-        vec2 nodes[MP_AI_PATH_DEPTH + 2];
-
-        /** The total depth of the path (number of nodes) */
-        unsigned int depth;
+        /** The path the unit currently follows (if moving), in the shared
+         * path pool */
+        MP_PathHandle path;
 
-        /** The current node of the path */
+        /** The current node of the path, starting at one */
         unsigned int index;
 
         /** Distance to next node in the path */
@@ -46,6 +79,17 @@ extern "C" {
 
         /** Distance already traveled to the next node */
         float traveled;
+
+        /** Whether blocks along the path changed since it was last checked */
+        bool dirty;
+
+        /** The path request we're waiting for, zero if none. While a path is
+         * pending the unit keeps following its current path, if any */
+        MP_PathTicket ticket;
+
+        /** Where the pending path leads, and the distance estimated for it */
+        vec2 goal;
+        float estimate;
     } AI_Path;
 
     /**
@@ -75,17 +119,46 @@ extern "C" {
      */
     float MP_MoveTo(const MP_Unit* unit, const vec2* position);
 
+    /**
+     * Makes a unit stop moving, dropping its current path and any path it is
+     * still waiting for.
+     * @param unit the unit that should stop.
+     */
+    void MP_StopMoving(const MP_Unit* unit);
+
+    /**
+     * Get a node of the path a unit is currently following. Nodes are
+     * numbered from one to the depth of the path, zero and depth plus one
+     * are extra nodes extending the path at either end, for smoothing it.
+     * @param unit the unit to get the path node for.
+     * @param index the index of the node.
+     * @return the position of the node.
+     */
+    vec2 MP_GetUnitPathNode(const MP_Unit* unit, unsigned int index);
+
     /**
      * Update AI logic for the specified unit.
      * @param unit the unit for which to update the AI.
      */
     void MP_UpdateAI(MP_Unit* unit);
 
+    /**
+     * Get statistics on scheduled job searches.
+     * @param stats used to return the statistics.
+     */
+    void MP_GetJobSearchStats(AI_JobSearchStats* stats);
+
     /**
      * Render pathing information for units (debug only).
      */
     void MP_RenderPathing(const MP_Unit* unit);
 
+    /**
+     * Initialize event handling for checking the paths of units that cross
+     * changed blocks, and for handing out the jobs units looked for.
+     */
+    void MP_InitAI(void);
+
 #ifdef	__cplusplus
 }
 #endif